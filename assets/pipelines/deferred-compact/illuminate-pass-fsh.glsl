@@ -0,0 +1,77 @@
+
+// the fraction of a light's shadow tile that sees worldPos, over 2x2 texels
+float shadowed(int light, vec3 worldPos)
+{
+    vec4 tile = texelFetch(u_lightData, ivec2(3, light), 0);
+    if (tile.w == 0.0)
+        return 1.0;
+
+    mat4 viewProj = mat4(texelFetch(u_lightData, ivec2(4, light), 0),
+                         texelFetch(u_lightData, ivec2(5, light), 0),
+                         texelFetch(u_lightData, ivec2(6, light), 0),
+                         texelFetch(u_lightData, ivec2(7, light), 0));
+    vec4 p = viewProj * vec4(worldPos, 1.0);
+    p.xyz = p.xyz / p.w * 0.5 + 0.5;
+
+    vec2 texel = 1.0 / vec2(textureSize(u_shadowAtlas, 0));
+    vec2 uv = tile.xy + p.xy * tile.z;
+    float lit = 0.0;
+    for (int i = 0; i < 4; ++i) {
+        vec2 o = (vec2(i & 1, i >> 1) - 0.5) * texel;
+        vec2 s = clamp(uv + o, tile.xy + texel * 0.5, tile.xy + tile.z - texel * 0.5);
+        lit += texture(u_shadowAtlas, s).x >= p.z ? 1.0 : 0.0;
+    }
+    return lit * 0.25;
+}
+
+// the point and spot lights in this pixel's froxel; see LightClusters.h
+vec3 clusteredLights(vec2 screenUV, vec3 viewPos, vec3 worldPos, vec3 normal)
+{
+    vec2 tiles = u_lightClusterGrid.xy;
+    ivec2 tile = ivec2(clamp(screenUV * tiles, vec2(0.0), tiles - 1.0));
+    float slice = clamp(floor(log(-viewPos.z) * u_lightClusterSlicing.x + u_lightClusterSlicing.y),
+                        0.0, u_lightClusterGrid.z - 1.0);
+    vec2 cell = texelFetch(u_lightGrid, ivec2(tile.x, tile.y + int(slice * tiles.y)), 0).xy;
+
+    vec3 result = vec3(0.0);
+    int first = int(cell.x);
+    int count = int(cell.y);
+    for (int k = 0; k < count; ++k) {
+        int index = first + k;
+        int light = int(texelFetch(u_lightIndices, ivec2(index % 1024, index / 1024), 0).x);
+        vec4 position = texelFetch(u_lightData, ivec2(0, light), 0);
+        vec4 color = texelFetch(u_lightData, ivec2(1, light), 0);
+        vec4 axis = texelFetch(u_lightData, ivec2(2, light), 0);
+
+        vec3 l = position.xyz - worldPos;
+        float dist = length(l);
+        l /= max(dist, 1e-4);
+        float falloff = clamp(1.0 - dist / position.w, 0.0, 1.0);
+        float cone = smoothstep(axis.w, color.w, dot(-l, axis.xyz));
+        float ndotl = max(dot(normal, l), 0.0);
+        if (ndotl * falloff * cone > 0.0)
+            result += color.rgb * ndotl * falloff * falloff * cone * shadowed(light, worldPos);
+    }
+    return result;
+}
+
+void main()
+{
+    float depth = texture(u_depthTexture, vert.v_texCoord).x;
+    if (depth >= 1.0) {
+        discard;    // the sky pass has drawn here
+    }
+    else
+    {
+        vec3 normal = octDecode(texture(u_normalTexture, vert.v_texCoord).xy);
+        vec4 albedo = texture(u_albedoTexture, vert.v_texCoord);
+
+        vec2 screenUV = vert.v_texCoord / u_renderScale;
+        vec3 viewPos = positionFromDepth(screenUV, depth, u_inverseProjection);
+        vec3 worldPos = (u_inverseView * vec4(viewPos, 1.0)).xyz;
+
+        vec3 light = normalize(vec3(0.1, 0.4, 0.2));
+        vec3 lighting = vec3(max(dot(normal, light), 0.0)) + clusteredLights(screenUV, viewPos, worldPos, normal);
+        o_colorTexture = vec4(albedo.rgb * lighting, 1);
+    }
+}
@@ -1,4 +1,4 @@
 void main() {
-	vert.v_texCoord = a_uv;
+	vert.v_texCoord = a_uv * u_renderScale;
 	gl_Position = vec4(a_position, 1.0);
 }
@@ -0,0 +1,134 @@
+//
+//  ErrorCheckBench.cpp
+//  LabRenderExamples
+//
+//  Renders a pipeline into a hidden window under each way of checking for
+//  GL errors, and prints the CPU time of a frame and the checks that
+//  reached the driver per frame under each:
+//
+//      off         only creation and shader compiler failures are checked
+//      polled      exhaustive checks too, each calling glGetError
+//      async       exhaustive checks, reported by a KHR_debug callback
+//      sync        as async, with the driver reporting on the failing call
+//
+//  Exhaustive checks only exist below LABRENDER_MAX_TEST_CONDITIONS, which
+//  by default excludes them from NDEBUG builds; there the polled, async and
+//  sync rows measure the same checks as off.
+//
+//  usage: ErrorCheckBench <pipeline.json> [model] [frames]
+//
+//  Paths may use $(ASSET_ROOT). frames defaults to 500.
+//
+
+#include "LabRenderDemoApp.h"
+#include "extras/modelLoader.h"
+
+#include <LabRender/Camera.h>
+#include <LabRender/ErrorPolicy.h>
+#include <LabRender/PassRenderer.h>
+#include <LabRender/Utils.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+using lab::v2i;
+
+class ErrorCheckBenchApp : public lab::GLFWAppBase {
+public:
+    shared_ptr<lab::PassRenderer> dr;
+    lab::DrawList drawList;
+    lab::Camera camera;
+
+    ErrorCheckBenchApp()
+    : GLFWAppBase(false)
+    {
+        const char * env = getenv("ASSET_ROOT");
+        if (env)
+            lab::addPathVariable("$(ASSET_ROOT)", env);
+        else
+            lab::addPathVariable("$(ASSET_ROOT)", ASSET_ROOT);
+    }
+
+    void render()
+    {
+        v2i fbSize = frameBufferDimensions();
+
+        drawList.jacobian = camera.mount.jacobian();
+        drawList.view = camera.mount.viewTransform();
+        drawList.proj = camera.optics.perspective(float(fbSize.x) / float(fbSize.y));
+
+        dr->beginFrame();
+
+        lab::PassRenderer::RenderLock rl(dr, renderTime(), mousePosition());
+        renderStart(rl, renderTime(), V2I(0, 0), fbSize);
+        dr->render(rl, fbSize, drawList);
+        dr->endFrame();
+        renderEnd(rl);
+    }
+
+    // the mean CPU time of a frame, and the checks made per frame
+    void measure(const char * mode, int frames)
+    {
+        for (int frame = 0; frame < 16; ++frame)
+            render();
+
+        uint64_t checks = lab::errorCheckCount();
+        auto start = chrono::steady_clock::now();
+        for (int frame = 0; frame < frames; ++frame)
+            render();
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / frames;
+        checks = lab::errorCheckCount() - checks;
+
+        printf("%-8s %12.3f %12.1f\n", mode, ms, double(checks) / frames);
+    }
+};
+
+int main(int argc, char ** argv)
+{
+    if (argc < 2 || argc > 4) {
+        cerr << "usage: ErrorCheckBench <pipeline.json> [model] [frames]" << endl;
+        return EXIT_FAILURE;
+    }
+    const int frames = argc > 3 ? max(1, atoi(argv[3])) : 500;
+
+    shared_ptr<ErrorCheckBenchApp> app = make_shared<ErrorCheckBenchApp>();
+    app->dr = make_shared<lab::PassRenderer>();
+    app->dr->configure(argv[1]);
+
+    if (argc > 2) {
+        shared_ptr<lab::ModelBase> model = lab::loadMesh(argv[2]);
+        if (!model) {
+            cerr << "Can't load " << argv[2] << endl;
+            return EXIT_FAILURE;
+        }
+        app->drawList.deferredMeshes.push_back(model);
+        app->camera.position = {0, 0, -1000};
+        app->camera.frame(model->transform.transformBounds(model->localBounds()));
+    }
+    app->dr->warmUpShaders(app->frameBufferDimensions(), app->drawList);
+
+    bool exhaustive = (LABRENDER_MAX_TEST_CONDITIONS & lab::TestConditions::exhaustive) != 0;
+    printf("exhaustive checks %s\n", exhaustive ? "compiled in" : "compiled out");
+    printf("%-8s %12s %12s\n", "checks", "frame ms", "per frame");
+
+    lab::setActiveConditions(lab::TestConditions::allFailures);
+    app->measure("off", frames);
+
+    lab::setActiveConditions(lab::TestConditions::allErrors);
+    app->measure("polled", frames);
+
+    if (lab::enableDebugOutput(false)) {
+        app->measure("async", frames);
+        lab::disableDebugOutput();
+        lab::enableDebugOutput(true);
+        app->measure("sync", frames);
+        lab::disableDebugOutput();
+    }
+    else
+        printf("KHR_debug is not available\n");
+
+    return EXIT_SUCCESS;
+}
@@ -87,7 +87,8 @@ namespace lab {
 
     public:
 
-        GLFWAppBase()
+        // a hidden window still has a context to render offscreen with
+        GLFWAppBase(bool visible = true)
         : mouseIsDown(false)
         {
             // window creation
@@ -103,6 +104,9 @@ namespace lab {
                 glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 #           endif
 
+            if (!visible)
+                glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
             window = glfwCreateWindow(1280, 960, "LabRender", NULL, NULL);
             if (!window) {
                 glfwTerminate();
@@ -11,6 +11,7 @@
 
 #include <LabRender/Camera.h>
 #include <LabRender/PassRenderer.h>
+#include <LabRender/ShaderBuilder.h>
 #include <LabRender/UtilityModel.h>
 #include <LabRender/Utils.h>
 
@@ -93,16 +94,27 @@ public:
 		else
 			lab::addPathVariable("$(ASSET_ROOT)", ASSET_ROOT);
 
+        // an existing directory to keep linked shader programs in
+        const char * shaderCache = getenv("LABRENDER_SHADER_CACHE");
+        if (shaderCache)
+            lab::ShaderBuilder::binaryCache()->setDirectory(shaderCache);
+
 		//std::string path = "$(ASSET_ROOT)/pipelines/deferred.json";
 		//std::string path = "$(ASSET_ROOT)/pipelines/shadertoy.json";
 		std::string path = "$(ASSET_ROOT)/pipelines/deferred_fxaa.json";
 		std::cout << "Loading pipeline configuration " << path << std::endl;
         dr = make_shared<lab::PassRenderer>();
         dr->configure(path.c_str());
+
+        // edits to the pipeline and its shaders show up on the next frame
+        dr->setHotReload(true);
     }
 
     void createScene()
 	{
+        // compile the pipeline's shaders side by side before the first frame
+        dr->warmUpShaders(frameBufferDimensions());
+
         std::vector<std::shared_ptr<lab::ModelBase>>& meshes = drawList.deferredMeshes;
         //shared_ptr<lab::ModelBase> model = lab::Model::loadMesh("$(ASSET_ROOT)/models/starfire.25.obj");
         shared_ptr<lab::ModelBase> model = lab::loadMesh("$(ASSET_ROOT)/models/ShaderBall/shaderBallNoCrease/shaderBall.obj");
@@ -140,12 +152,18 @@ public:
         drawList.view = camera.mount.viewTransform();
         drawList.proj = camera.optics.perspective(float(fbSize.x) / float(fbSize.y));
 
+        // blocks only if the GPU is more than framesInFlight() frames behind
+        dr->beginFrame();
+
         lab::PassRenderer::RenderLock rl(dr, renderTime(), mousePosition());
 		v2i fbOffset = V2I(0, 0);
         renderStart(rl, renderTime(), fbOffset, fbSize);
 
         dr->render(rl, fbSize, drawList);
 
+        // fence the frame before the swap in renderEnd
+        dr->endFrame();
+
         renderEnd(rl);
 
         lab::checkError(lab::ErrorPolicy::onErrorThrow,
@@ -200,10 +218,20 @@ int main(void)
 
     app->createScene();
 
+    bool firstFrame = true;
     while (!app->isFinished())
     {
         app->render();
         app->frameEnd();
+
+        if (firstFrame) {
+            // the shaders made for the first frame, cold or from the cache
+            const lab::ProgramBinaryCache::Stats & shaders = lab::ShaderBuilder::binaryCache()->stats();
+            std::cout << "Shaders: " << shaders.compiled << " compiled in " << shaders.compileMs << " ms, "
+                      << shaders.loaded << " loaded in " << shaders.loadMs << " ms, "
+                      << shaders.rejected << " rejected" << std::endl;
+            firstFrame = false;
+        }
     }
 
     exit(EXIT_SUCCESS);
@@ -0,0 +1,76 @@
+//
+//  LightClusterBench.cpp
+//  LabRenderExamples
+//
+//  Times LightClusters::build over a sweep of light counts, from a few
+//  hundred to tens of thousands of point lights scattered through the view
+//  of a 16:9 camera, and prints the build time and the froxel assignments
+//  at each count. Assignment does not touch GL, so no window is opened.
+//
+//  usage: LightClusterBench [workers]
+//
+//  workers is the number of threads in addition to the calling one; by
+//  default it is picked from the hardware.
+//
+
+#include <LabRender/Camera.h>
+#include <LabRender/DrawList.h>
+#include <LabRender/FrameArena.h>
+#include <LabRender/LightClusters.h>
+#include <LabRender/Transform.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+using namespace std;
+
+int main(int argc, char ** argv)
+{
+    int workers = argc > 1 ? atoi(argv[1]) : -1;
+
+    lab::Optics optics;
+    optics.setZclip(0.1f, 200.f);
+
+    lab::DrawList drawList;
+    drawList.proj = optics.perspective(16.f / 9.f);
+
+    lab::FrameArena arena(4 * 1024 * 1024);
+    lab::LightClusters clusters(workers);
+    printf("%d workers, %dx%dx%d froxels\n", clusters.workerCount(),
+           clusters.settings().tilesX, clusters.settings().tilesY, clusters.settings().slices);
+    printf("%8s %8s %10s %10s %12s\n", "lights", "visible", "indices", "build ms", "us / light");
+
+    const int frames = 50;
+    mt19937 random(1);
+    uniform_real_distribution<float> unit(-1.f, 1.f);
+    for (int count = 250; count <= 32000; count *= 2) {
+        // the radii don't shrink as the count grows, so the froxels fill up
+        drawList.lights.clear();
+        for (int i = 0; i < count; ++i) {
+            shared_ptr<lab::PointLight> point = make_shared<lab::PointLight>();
+            point->radius = 2.f + unit(random);
+            shared_ptr<lab::Light> light = point;
+            shared_ptr<lab::Transform> transform = make_shared<lab::Transform>();
+            float depth = 100.f + 95.f * unit(random);
+            transform->setTranslate(lab::v3f(0.45f * depth * unit(random), 0.25f * depth * unit(random), -depth));
+            drawList.lights.push_back(make_shared<lab::Illuminant>(light, transform));
+        }
+
+        // the first build sizes the retained buffers
+        clusters.build(drawList, arena);
+        arena.reset();
+
+        auto start = chrono::steady_clock::now();
+        for (int frame = 0; frame < frames; ++frame) {
+            clusters.build(drawList, arena);
+            arena.reset();
+        }
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / frames;
+
+        const lab::LightClusters::Stats & stats = clusters.stats();
+        printf("%8d %8d %10d %10.3f %12.4f\n", stats.lights, stats.visible, stats.indices, ms, 1000.0 * ms / count);
+    }
+    return EXIT_SUCCESS;
+}
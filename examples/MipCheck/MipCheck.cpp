@@ -0,0 +1,187 @@
+//
+//  MipCheck.cpp
+//  LabRenderExamples
+//
+//  Checks the mip chains buildMipChain makes against a reference computed
+//  in double precision, and that splitting the levels across threads
+//  doesn't change them; then times a 4096x4096 chain. Exits with failure
+//  if any chain is off.
+//
+//  usage: MipCheck
+//
+//  Each reference level is the 2x2 box filter, in linear light for sRGB
+//  color, of the level the chain actually made above it, so that errors
+//  don't compound down the chain. The tolerances are
+//
+//      u8            exact, half a code
+//      u8 sRGB       half a code, and the float rounding at its edge
+//      f32           1e-6, relative
+//      f16           half precision, 1/1024 relative
+//
+
+#include <LabRender/Texture.h>
+#include <LabRender/TextureImage.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+using namespace std;
+using lab::TextureImage;
+using lab::TextureType;
+
+namespace {
+
+    enum class Element { u8, f32, f16 };
+
+    double srgbDecode(double v) { return v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4); }
+    double srgbEncode(double v) { return v <= 0.0031308 ? v * 12.92 : 1.055 * pow(v, 1 / 2.4) - 0.055; }
+
+    double halfToDouble(uint16_t h)
+    {
+        const int exponent = (h >> 10) & 0x1f;
+        const int mantissa = h & 0x3ff;
+        double v = exponent ? ldexp(1024 + mantissa, exponent - 25) : ldexp(mantissa, -24);
+        return h & 0x8000 ? -v : v;
+    }
+
+    // small values, exactly representable in half precision
+    uint16_t randomHalf(mt19937 & random)
+    {
+        const int sixtyFourths = int(random() % 2048);
+        if (!sixtyFourths)
+            return 0;
+        int exponent;
+        double mantissa = frexp(sixtyFourths / 64.0, &exponent);
+        return uint16_t((exponent + 14) << 10 | (int(ldexp(mantissa, 11)) & 0x3ff));
+    }
+
+    double element(const TextureImage & image, int level, size_t i, Element e)
+    {
+        const uint8_t * p = image.levels[level].data();
+        switch (e) {
+            case Element::u8:  return p[i];
+            case Element::f32: return reinterpret_cast<const float *>(p)[i];
+            default:           return halfToDouble(reinterpret_cast<const uint16_t *>(p)[i]);
+        }
+    }
+
+    // the largest error of a chain against the reference, absolute for u8
+    // and relative for float types
+    double chainError(const TextureImage & image, int channels, Element e, bool srgb)
+    {
+        double worst = 0;
+        int w = image.width, h = image.height;
+        for (size_t level = 1; level < image.levels.size(); ++level) {
+            const int dw = std::max(1, w / 2), dh = std::max(1, h / 2);
+            for (int y = 0; y < dh; ++y)
+                for (int x = 0; x < dw; ++x)
+                    for (int c = 0; c < channels; ++c) {
+                        const int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+                        const int y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+                        double s[4] = { element(image, int(level) - 1, (size_t(y0) * w + x0) * channels + c, e),
+                                        element(image, int(level) - 1, (size_t(y0) * w + x1) * channels + c, e),
+                                        element(image, int(level) - 1, (size_t(y1) * w + x0) * channels + c, e),
+                                        element(image, int(level) - 1, (size_t(y1) * w + x1) * channels + c, e) };
+                        double expected;
+                        if (srgb && c < 3)
+                            expected = 255 * srgbEncode((srgbDecode(s[0] / 255) + srgbDecode(s[1] / 255) +
+                                                         srgbDecode(s[2] / 255) + srgbDecode(s[3] / 255)) / 4);
+                        else
+                            expected = (s[0] + s[1] + s[2] + s[3]) / 4;
+
+                        double error = fabs(element(image, int(level), (size_t(y) * dw + x) * channels + c, e) - expected);
+                        if (e != Element::u8)
+                            error /= std::max(1.0, fabs(expected));
+                        worst = std::max(worst, error);
+                    }
+            w = dw;
+            h = dh;
+        }
+        return worst;
+    }
+
+    bool check(TextureType type, int channels, Element e, bool srgb, int width, int height, mt19937 & random)
+    {
+        TextureImage image;
+        image.type = type;
+        image.width = width;
+        image.height = height;
+        image.levels.emplace_back(lab::Texture::imageByteSize(type, width, height));
+
+        vector<uint8_t> & base = image.levels[0];
+        switch (e) {
+            case Element::u8:
+                for (uint8_t & b : base)
+                    b = uint8_t(random());
+                break;
+            case Element::f32:
+                for (size_t i = 0; i < base.size() / 4; ++i)
+                    reinterpret_cast<float *>(base.data())[i] = float(random() % 10000) / 77.f;
+                break;
+            case Element::f16:
+                for (size_t i = 0; i < base.size() / 2; ++i)
+                    reinterpret_cast<uint16_t *>(base.data())[i] = randomHalf(random);
+                break;
+        }
+
+        TextureImage one = image, four = image;
+        lab::buildMipChain(one, srgb, 1);
+        lab::buildMipChain(four, srgb, 4);
+        const bool same = one.levels == four.levels;
+
+        const double error = chainError(one, channels, e, srgb);
+        const double tolerance = e == Element::u8 ? (srgb ? 0.501 : 0.5) : e == Element::f32 ? 1e-6 : 1.0 / 1024;
+        const bool ok = same && error <= tolerance;
+        printf("%-6s %-5s %4dx%-4d %2d levels  error %-12g %s%s\n", e == Element::u8 ? (srgb ? "sRGB" : "u8") : e == Element::f32 ? "f32" : "f16",
+               channels == 1 ? "x1" : channels == 3 ? "x3" : "x4", width, height, int(one.levels.size()), error,
+               ok ? "ok" : "FAILED", same ? "" : ", threads differ");
+        return ok;
+    }
+
+} // anon
+
+int main()
+{
+    mt19937 random(1);
+    int failures = 0;
+
+    const int sizes[][2] = { { 256, 256 }, { 37, 13 }, { 1, 9 }, { 640, 480 } };
+    for (auto & size : sizes) {
+        const int w = size[0], h = size[1];
+        failures += !check(TextureType::u8x4,  4, Element::u8,  false, w, h, random);
+        failures += !check(TextureType::u8x4,  4, Element::u8,  true,  w, h, random);
+        failures += !check(TextureType::u8x3,  3, Element::u8,  true,  w, h, random);
+        failures += !check(TextureType::u8x1,  1, Element::u8,  false, w, h, random);
+        failures += !check(TextureType::f32x4, 4, Element::f32, false, w, h, random);
+        failures += !check(TextureType::f32x3, 3, Element::f32, false, w, h, random);
+        failures += !check(TextureType::f16x4, 4, Element::f16, false, w, h, random);
+    }
+
+    TextureImage big;
+    big.type = TextureType::u8x4;
+    big.width = big.height = 4096;
+    big.levels.emplace_back(size_t(4096) * 4096 * 4);
+    for (uint8_t & b : big.levels[0])
+        b = uint8_t(random());
+    for (int threads : { 1, -1 }) {
+        TextureImage linear = big, srgb = big;
+        auto start = chrono::steady_clock::now();
+        lab::buildMipChain(linear, false, threads);
+        auto middle = chrono::steady_clock::now();
+        lab::buildMipChain(srgb, true, threads);
+        auto end = chrono::steady_clock::now();
+        printf("4096x4096 u8x4, %s: linear %.1f ms, sRGB %.1f ms\n", threads == 1 ? "one thread" : "threads from the hardware",
+               chrono::duration<double, milli>(middle - start).count(), chrono::duration<double, milli>(end - middle).count());
+    }
+
+    if (failures)
+        printf("%d chains FAILED\n", failures);
+    else
+        printf("all chains ok\n");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
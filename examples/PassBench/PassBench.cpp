@@ -0,0 +1,139 @@
+//
+//  PassBench.cpp
+//  LabRenderExamples
+//
+//  Renders a pipeline into a hidden window for a number of frames and
+//  prints the CPU time each scheduled pass takes to submit, averaged over
+//  the frames, along with the CPU time of the whole render call. The pass
+//  times come from the renderer's frame profile, and so cover binding the
+//  pass's buffers, textures and uniforms as well as its draws.
+//
+//  usage: PassBench <pipeline.json> [model] [frames]
+//
+//  Without a model only the pipeline's quad passes draw anything. Paths may
+//  use $(ASSET_ROOT). frames defaults to 500.
+//
+
+#include "LabRenderDemoApp.h"
+#include "extras/modelLoader.h"
+
+#include <LabRender/Camera.h>
+#include <LabRender/PassRenderer.h>
+#include <LabRender/Utils.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+
+using namespace std;
+using lab::v2i;
+
+class PassBenchApp : public lab::GLFWAppBase {
+public:
+    shared_ptr<lab::PassRenderer> dr;
+    lab::DrawList drawList;
+    lab::Camera camera;
+
+    PassBenchApp()
+    : GLFWAppBase(false)
+    {
+        const char * env = getenv("ASSET_ROOT");
+        if (env)
+            lab::addPathVariable("$(ASSET_ROOT)", env);
+        else
+            lab::addPathVariable("$(ASSET_ROOT)", ASSET_ROOT);
+    }
+
+    void render()
+    {
+        v2i fbSize = frameBufferDimensions();
+
+        drawList.jacobian = camera.mount.jacobian();
+        drawList.view = camera.mount.viewTransform();
+        drawList.proj = camera.optics.perspective(float(fbSize.x) / float(fbSize.y));
+
+        dr->beginFrame();
+
+        lab::PassRenderer::RenderLock rl(dr, renderTime(), mousePosition());
+        renderStart(rl, renderTime(), V2I(0, 0), fbSize);
+        dr->render(rl, fbSize, drawList);
+        dr->endFrame();
+        renderEnd(rl);
+    }
+};
+
+int main(int argc, char ** argv)
+{
+    if (argc < 2 || argc > 4) {
+        cerr << "usage: PassBench <pipeline.json> [model] [frames]" << endl;
+        return EXIT_FAILURE;
+    }
+    const int frames = argc > 3 ? max(1, atoi(argv[3])) : 500;
+
+    shared_ptr<PassBenchApp> app = make_shared<PassBenchApp>();
+    app->dr = make_shared<lab::PassRenderer>();
+    app->dr->configure(argv[1]);
+    app->dr->setProfilingEnabled(true);
+
+    if (argc > 2) {
+        shared_ptr<lab::ModelBase> model = lab::loadMesh(argv[2]);
+        if (!model) {
+            cerr << "Can't load " << argv[2] << endl;
+            return EXIT_FAILURE;
+        }
+        app->drawList.deferredMeshes.push_back(model);
+        app->camera.position = {0, 0, -1000};
+        app->camera.frame(model->transform.transformBounds(model->localBounds()));
+    }
+
+    // compiles, allocations and the profiler's query ring all settle first
+    app->dr->warmUpShaders(app->frameBufferDimensions(), app->drawList);
+    for (int frame = 0; frame < 16; ++frame)
+        app->render();
+
+    // the profile lags the frame it describes, so each one is taken once,
+    // by its frame number
+    struct Total
+    {
+        double cpuMs = 0;
+        int draws = 0;
+        int frames = 0;
+    };
+    vector<string> order;
+    map<string, Total> totals;
+    uint64_t lastProfiled = app->dr->lastFrameProfile().frameNumber;
+    double renderMs = 0;
+
+    for (int frame = 0; frame < frames; ++frame) {
+        auto start = chrono::steady_clock::now();
+        app->render();
+        renderMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        const lab::FrameProfile & profile = app->dr->lastFrameProfile();
+        if (profile.frameNumber == lastProfiled)
+            continue;
+        lastProfiled = profile.frameNumber;
+        for (const lab::PassProfile & pass : profile.passes) {
+            if (pass.depth != 0)
+                continue;
+            if (!totals.count(pass.name))
+                order.push_back(pass.name);
+            Total & total = totals[pass.name];
+            total.cpuMs += pass.cpuMs;
+            total.draws += pass.drawCount;
+            ++total.frames;
+        }
+    }
+
+    const lab::PassRenderer::RenderGraphStats & graph = app->dr->renderGraphStats();
+    printf("%d passes scheduled, %d culled, %d frames\n", graph.passes, graph.culledPasses, frames);
+    printf("%-24s %12s %10s\n", "pass", "cpu us", "draws");
+    for (const string & name : order) {
+        const Total & total = totals[name];
+        printf("%-24s %12.2f %10.1f\n", name.c_str(), 1000.0 * total.cpuMs / total.frames, double(total.draws) / total.frames);
+    }
+    printf("%-24s %12.2f\n", "render", 1000.0 * renderMs / frames);
+    return EXIT_SUCCESS;
+}
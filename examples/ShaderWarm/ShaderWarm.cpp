@@ -0,0 +1,72 @@
+//
+//  ShaderWarm.cpp
+//  LabRenderExamples
+//
+//  Compiles every shader a pipeline and a set of assets can draw with into
+//  a program binary cache, so that a run pointed at the cache compiles
+//  nothing, and writes a manifest of the programs made.
+//
+//  usage: ShaderWarm <pipeline.json> <asset list> <cache directory> <manifest.json>
+//
+//  The asset list names a model per line; blank lines and lines starting
+//  with # are skipped. Paths may use $(ASSET_ROOT). The cache directory
+//  must exist.
+//
+
+#include "ShaderWarmApp.h"
+
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+int main(int argc, char ** argv)
+{
+    if (argc != 5) {
+        cerr << "usage: ShaderWarm <pipeline.json> <asset list> <cache directory> <manifest.json>" << endl;
+        return EXIT_FAILURE;
+    }
+    const string pipeline = argv[1];
+    const string assets = argv[2];
+    const string directory = argv[3];
+    const string manifest = argv[4];
+
+    shared_ptr<ShaderWarmApp> app = make_shared<ShaderWarmApp>();
+
+    lab::ProgramBinaryCache * cache = lab::ShaderBuilder::binaryCache();
+    cache->setDirectory(directory);
+
+    app->dr = make_shared<lab::PassRenderer>();
+    app->dr->configure(pipeline.c_str());
+    if (!app->loadAssets(assets))
+        return EXIT_FAILURE;
+
+    // every pass and model variant, submitted side by side
+    app->dr->warmUpShaders(app->frameBufferDimensions(), app->drawList);
+    const int warmed = programsMade();
+
+    // Draws wait for the warmed programs, which are saved as they finish.
+    // Neither the first frame nor a steady one after it may make another.
+    app->render();
+    const int firstFrame = programsMade() - warmed;
+    app->render();
+    const int steadyFrame = programsMade() - warmed - firstFrame;
+
+    const lab::ProgramBinaryCache::Stats & stats = cache->stats();
+    cout << "Programs: " << warmed << " warmed, " << stats.compiled << " compiled in " << stats.compileMs << " ms, "
+         << stats.loaded << " loaded in " << stats.loadMs << " ms, " << stats.rejected << " rejected" << endl;
+
+    ofstream out(lab::expandPath(manifest.c_str()));
+    if (!out) {
+        cerr << "Can't write the manifest " << manifest << endl;
+        return EXIT_FAILURE;
+    }
+    cache->writeManifest(out);
+
+    if (firstFrame || steadyFrame) {
+        cerr << "Warm up missed programs: the first frame made " << firstFrame
+             << ", a steady frame made " << steadyFrame << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,103 @@
+//
+//  ShaderWarmApp.h
+//  LabRenderExamples
+//
+//  The hidden window and draw list shared by ShaderWarm, which fills a
+//  program binary cache, and ShaderWarmCheck, which checks that a run
+//  pointed at the filled cache makes no programs in steady state.
+//
+//  The asset list names a model per line; blank lines and lines starting
+//  with # are skipped. Paths may use $(ASSET_ROOT).
+//
+
+#pragma once
+
+#include "LabRenderDemoApp.h"
+#include "extras/modelLoader.h"
+
+#include <LabRender/Camera.h>
+#include <LabRender/PassRenderer.h>
+#include <LabRender/ProgramBinaryCache.h>
+#include <LabRender/ShaderBuilder.h>
+#include <LabRender/Utils.h>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+class ShaderWarmApp : public lab::GLFWAppBase {
+public:
+    std::shared_ptr<lab::PassRenderer> dr;
+    lab::DrawList drawList;
+    lab::Camera camera;
+
+    ShaderWarmApp()
+    : GLFWAppBase(false)
+    {
+        const char * env = getenv("ASSET_ROOT");
+        if (env)
+            lab::addPathVariable("$(ASSET_ROOT)", env);
+        else
+            lab::addPathVariable("$(ASSET_ROOT)", ASSET_ROOT);
+    }
+
+    bool loadAssets(const std::string & listPath)
+    {
+        std::ifstream list(lab::expandPath(listPath.c_str()));
+        if (!list) {
+            std::cerr << "Can't read the asset list " << listPath << std::endl;
+            return false;
+        }
+
+        bool first = true;
+        lab::Bounds bounds;
+        std::string line;
+        while (getline(list, line)) {
+            while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t'))
+                line.pop_back();
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            std::shared_ptr<lab::ModelBase> model = lab::loadMesh(line);
+            if (!model) {
+                std::cerr << "Can't load " << line << std::endl;
+                return false;
+            }
+            drawList.deferredMeshes.push_back(model);
+
+            lab::Bounds b = model->transform.transformBounds(model->localBounds());
+            bounds = first ? b : lab::extendBounds(bounds, b);
+            first = false;
+        }
+
+        // all of it in view, so that every model is drawn
+        camera.position = {0, 0, -1000};
+        if (!first)
+            camera.frame(bounds);
+        return true;
+    }
+
+    void render()
+    {
+        lab::v2i fbSize = frameBufferDimensions();
+
+        drawList.jacobian = camera.mount.jacobian();
+        drawList.view = camera.mount.viewTransform();
+        drawList.proj = camera.optics.perspective(float(fbSize.x) / float(fbSize.y));
+
+        dr->beginFrame();
+
+        lab::PassRenderer::RenderLock rl(dr, renderTime(), mousePosition());
+        renderStart(rl, renderTime(), lab::v2i(0, 0), fbSize);
+        dr->render(rl, fbSize, drawList);
+        dr->endFrame();
+        renderEnd(rl);
+    }
+};
+
+// programs made by the cache, compiled or loaded
+inline int programsMade()
+{
+    const lab::ProgramBinaryCache::Stats & stats = lab::ShaderBuilder::binaryCache()->stats();
+    return stats.compiled + stats.loaded;
+}
@@ -0,0 +1,72 @@
+//
+//  ShaderWarmCheck.cpp
+//  LabRenderExamples
+//
+//  Checks that once a pipeline and a set of assets are warmed up, drawing
+//  them makes no more programs: the first frame may only wait for the
+//  warmed programs, and the steady frames after it may make none. Exits
+//  with failure, naming the frames that did, otherwise.
+//
+//  usage: ShaderWarmCheck <pipeline.json> <asset list> [cache directory] [frames]
+//
+//  The asset list is read as ShaderWarm reads it. With a cache directory,
+//  as filled by ShaderWarm, the programs are loaded from it, and the
+//  programs it had to compile are reported. frames, the steady frames
+//  checked, defaults to 60.
+//
+
+#include "ShaderWarmApp.h"
+
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+int main(int argc, char ** argv)
+{
+    if (argc < 3 || argc > 5) {
+        cerr << "usage: ShaderWarmCheck <pipeline.json> <asset list> [cache directory] [frames]" << endl;
+        return EXIT_FAILURE;
+    }
+    const string pipeline = argv[1];
+    const string assets = argv[2];
+    const int frames = argc > 4 ? max(1, atoi(argv[4])) : 60;
+
+    shared_ptr<ShaderWarmApp> app = make_shared<ShaderWarmApp>();
+
+    lab::ProgramBinaryCache * cache = lab::ShaderBuilder::binaryCache();
+    if (argc > 3)
+        cache->setDirectory(argv[3]);
+
+    app->dr = make_shared<lab::PassRenderer>();
+    app->dr->configure(pipeline.c_str());
+    if (!app->loadAssets(assets))
+        return EXIT_FAILURE;
+
+    app->dr->warmUpShaders(app->frameBufferDimensions(), app->drawList);
+    const int warmed = programsMade();
+
+    app->render();
+    const int firstFrame = programsMade() - warmed;
+
+    int failures = firstFrame ? 1 : 0;
+    if (firstFrame)
+        cerr << "The first frame made " << firstFrame << " programs the warm up missed" << endl;
+
+    for (int frame = 0; frame < frames; ++frame) {
+        const int before = programsMade();
+        app->render();
+        const int made = programsMade() - before;
+        if (made) {
+            cerr << "Steady frame " << frame << " made " << made << " programs" << endl;
+            ++failures;
+        }
+    }
+
+    const lab::ProgramBinaryCache::Stats & stats = cache->stats();
+    cout << "Programs: " << warmed << " warmed, " << stats.compiled << " compiled, "
+         << stats.loaded << " loaded, " << stats.rejected << " rejected; "
+         << frames << " steady frames checked" << endl;
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
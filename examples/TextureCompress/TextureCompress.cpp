@@ -0,0 +1,66 @@
+//
+//  TextureCompress.cpp
+//  LabRenderExamples
+//
+//  Encodes an image to a block compressed DDS container with its full mip
+//  chain, which FileTextureProvider and the texture streamer upload as is.
+//
+//  usage: TextureCompress <bc1|bc3|bc5|bc7> <input image> <output.dds>
+//
+//  bc1 is for opaque or cut out color, bc3 for color with alpha, bc5 for
+//  two channel data such as normal maps, and bc7 for color with alpha at
+//  higher quality. Paths may use $(ASSET_ROOT).
+//
+
+#include <LabRender/Texture.h>
+#include <LabRender/TextureImage.h>
+#include <LabRender/Utils.h>
+
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+int main(int argc, char ** argv)
+{
+    if (argc != 4) {
+        cerr << "usage: TextureCompress <bc1|bc3|bc5|bc7> <input image> <output.dds>" << endl;
+        return EXIT_FAILURE;
+    }
+    const string format = argv[1];
+    const string input = argv[2];
+    const string output = argv[3];
+
+    const char * env = getenv("ASSET_ROOT");
+    if (env)
+        lab::addPathVariable("$(ASSET_ROOT)", env);
+
+    lab::TextureType type = lab::stringToTextureType(format);
+    if (!lab::Texture::isCompressed(type)) {
+        cerr << "Unknown block format " << format << endl;
+        return EXIT_FAILURE;
+    }
+
+    lab::TextureImage image;
+    if (!lab::readTextureImage(lab::expandPath(input.c_str()), image) || image.type != lab::TextureType::u8x4) {
+        cerr << "Can't decode " << input << endl;
+        return EXIT_FAILURE;
+    }
+    // bc5 holds data, such as normals, rather than sRGB color
+    lab::buildMipChain(image, type != lab::TextureType::bc5, -1);
+
+    lab::TextureImage compressed = lab::compressTextureImage(image, type);
+    if (!lab::writeDDS(lab::expandPath(output.c_str()), compressed)) {
+        cerr << "Can't write " << output << endl;
+        return EXIT_FAILURE;
+    }
+
+    size_t before = 0, after = 0;
+    for (auto & level : image.levels)
+        before += level.size();
+    for (auto & level : compressed.levels)
+        after += level.size();
+    cout << input << ": " << image.width << "x" << image.height << ", " << compressed.levels.size() << " levels, "
+         << before << " bytes as u8x4, " << after << " as " << format << endl;
+    return EXIT_SUCCESS;
+}
@@ -1,6 +1,7 @@
 
 #include <LabRender/LabRender.h>
 #include <LabRender/Model.h>
+#include <LabRender/Profiler.h>
 #include <LabRender/gl4.h>
 #include <LabRender/utils.h>
 
@@ -606,6 +607,7 @@ namespace lab
 
 	std::shared_ptr<Model> loadMesh(const std::string& srcFilename)
 	{
+		LR_PROFILE_ZONE("loadMesh");
 		unsigned int flags =
 			aiProcess_Triangulate
 			| aiProcess_FlipUVs
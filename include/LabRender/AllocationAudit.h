@@ -0,0 +1,70 @@
+//
+//  AllocationAudit.h
+//  LabRender
+//
+//
+
+#pragma once
+
+#include "LabRender/ErrorPolicy.h"
+#include "LabRender/LabRender.h"
+
+#include <stdint.h>
+
+namespace lab {
+
+    /**
+        When LabRender is built with LABRENDER_ALLOCATION_AUDIT, the global
+        operator new and delete are replaced by versions that count heap
+        allocations per thread. Otherwise the counts are always zero and the
+        audit does nothing.
+
+        Renderer audits the render thread between beginFrame and endFrame,
+        and applies the audit's error policy to any frame after the warm-up
+        that allocates. The check does not depend on NDEBUG, so it holds in
+        release builds too. Work that is
+        expected to allocate, such as the jobs a RenderLock drains, is wrapped
+        in an AllowAllocations scope.
+     */
+
+    LR_API bool allocationAuditEnabled();
+
+    // allocations made by the calling thread outside AllowAllocations scopes
+    LR_API uint64_t threadAllocationCount();
+
+    class AllowAllocations
+    {
+    public:
+        LR_API AllowAllocations();
+        LR_API ~AllowAllocations();
+
+        AllowAllocations(const AllowAllocations &) = delete;
+        AllowAllocations & operator=(const AllowAllocations &) = delete;
+    };
+
+    class AllocationAudit
+    {
+    public:
+        explicit AllocationAudit(int warmUpFrames = 8, ErrorPolicy policy = ErrorPolicy::onErrorLogThrow)
+        : _warmUpFrames(warmUpFrames), _policy(policy) {}
+
+        void setErrorPolicy(ErrorPolicy policy) { _policy = policy; }
+
+        LR_API void beginFrame();
+
+        // reports a frame after the warm-up that allocated
+        LR_API void endFrame();
+
+        uint64_t lastFrameAllocations() const { return _lastFrame; }
+        int framesAudited() const             { return _frames; }
+
+    private:
+        int _warmUpFrames;
+        ErrorPolicy _policy;
+        int _frames = 0;
+        uint64_t _mark = 0;
+        uint64_t _lastFrame = 0;
+        bool _inFrame = false;
+    };
+
+} // lab
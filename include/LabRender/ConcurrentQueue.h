@@ -28,6 +28,15 @@ public:
         the_condition_variable.notify_one();
     }
 
+    void push(Data&& data)
+    {
+        {
+            std::lock_guard<std::mutex> lock(the_mutex);
+            the_queue.push(std::move(data));
+        }
+        the_condition_variable.notify_one();
+    }
+
     bool empty() const
     {
         std::lock_guard<std::mutex> lock(the_mutex);
@@ -40,7 +49,7 @@ public:
         if (the_queue.empty())
             return false;
 
-        popped_value = the_queue.front();
+        popped_value = std::move(the_queue.front());
         the_queue.pop();
         return true;
     }
@@ -51,7 +60,7 @@ public:
         while (the_queue.empty())
             the_condition_variable.wait(lock);
 
-        popped_value = the_queue.front();
+        popped_value = std::move(the_queue.front());
         the_queue.pop();
     }
 
@@ -0,0 +1,67 @@
+//
+//  DynamicResolution.h
+//  LabRender
+//
+//
+
+#pragma once
+
+#include "LabRender/LabRender.h"
+
+#include <stdint.h>
+
+namespace lab {
+
+    /**
+        DynamicResolution chooses a render scale that keeps the measured GPU
+        frame time within a budget. Measurements are smoothed, and the scale
+        drops as soon as a couple of frames run over budget, but only grows
+        again after a sustained run of frames well under it, so it settles
+        instead of oscillating around the target.
+
+        GPU times arrive several frames late, so measurements of frames
+        rendered before the last change are ignored.
+     */
+
+    class DynamicResolution
+    {
+    public:
+        struct Settings
+        {
+            double targetMs = 16.0;     // GPU time budget per frame
+            float minScale = 0.5f;
+            float maxScale = 1.f;
+            float step = 0.05f;         // the scale is a multiple of step
+            double dropAbove = 1.0;     // fraction of the budget that counts as over
+            int dropFrames = 2;         // consecutive frames over before shrinking
+            double raiseBelow = 0.85;   // fraction of the budget that counts as under
+            int raiseFrames = 30;       // consecutive frames under before growing
+            double smoothing = 0.3;     // weight of a new measurement in the average
+        };
+
+        LR_API void setSettings(const Settings &);
+        const Settings & settings() const { return _settings; }
+
+        // Feeds the GPU time of a frame. nextFrame is the number of the frame
+        // about to be rendered, which is the first to use a changed scale.
+        // Returns true if the scale changed.
+        LR_API bool update(uint64_t frame, double gpuMs, uint64_t nextFrame);
+
+        LR_API void reset(float scale = 1.f);
+
+        float scale() const       { return _scale; }
+        double smoothedMs() const { return _smoothedMs; }
+
+    private:
+        float quantize(float scale) const;
+
+        Settings _settings;
+        float _scale = 1.f;
+        double _smoothedMs = 0;
+        int _over = 0;
+        int _under = 0;
+        uint64_t _settleFrame = 0;
+        bool _hasMeasurement = false;
+    };
+
+} // lab
@@ -9,6 +9,7 @@
 #pragma once
 
 #include <LabRender/LabRender.h>
+#include <stdint.h>
 
 namespace lab {
 
@@ -24,14 +25,45 @@ namespace lab {
         allErrors = allFailures | exhaustive
     };
 
+    // Conditions outside LABRENDER_MAX_TEST_CONDITIONS are compiled out of
+    // checkError entirely. By default exhaustive checks, which call
+    // glGetError around every pass and draw, only exist in debug builds.
+#ifndef LABRENDER_MAX_TEST_CONDITIONS
+# ifdef NDEBUG
+#  define LABRENDER_MAX_TEST_CONDITIONS (lab::TestConditions::allFailures)
+# else
+#  define LABRENDER_MAX_TEST_CONDITIONS (lab::TestConditions::allErrors)
+# endif
+#endif
+
     LR_API Error handleError(ErrorPolicy, char const*const error, char const*const source = nullptr);
+
+    // Applies the policy to an error found by other means than GL, whatever
+    // the test conditions.
+    LR_API Error reportError(ErrorPolicy, char const*const what, char const*const error);
 	LR_API Error handleGLError(ErrorPolicy, int glErr, char const*const error, char const*const source = nullptr);
 	LR_API char const*const glEnumString(int err);
 
 	LR_API TestConditions activeConditions();
 	LR_API void setActiveConditions(TestConditions);
 
+    // With GL_KHR_debug available, errors are reported by the driver through
+    // a callback instead of being polled with glGetError. The callback only
+    // records the message, and the next checkError applies its policy to it,
+    // so checks no longer force a pipeline sync. Asynchronous output is
+    // faster, but the error may be reported by a later check than the one
+    // that follows the offending call. Returns false if KHR_debug is missing.
+	LR_API bool enableDebugOutput(bool synchronous = false);
+	LR_API void disableDebugOutput();
+	LR_API bool debugOutputEnabled();
+
+    // the number of error checks that reached the driver, for measuring
+    // the overhead of the active conditions
+	LR_API uint64_t errorCheckCount();
+
     inline Error checkError(ErrorPolicy policy, TestConditions conditions, char const*const error, char const*const source = nullptr) {
+        if (!(conditions & LABRENDER_MAX_TEST_CONDITIONS))
+            return Error::errorNone;
         if (!(conditions & activeConditions()))
             return Error::errorNone;
 
@@ -0,0 +1,98 @@
+//
+//  FrameArena.h
+//  LabRender
+//
+//
+
+#pragma once
+
+#include "LabRender/LabRender.h"
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace lab {
+
+    /**
+        FrameArena is a linear allocator for memory that lives for one frame.
+        allocate bumps a pointer; nothing is freed individually, and reset
+        releases everything at once. Renderer resets its arena in beginFrame.
+
+        A frame that needs more than the capacity chains extra blocks, and the
+        next reset coalesces them into a single block large enough for that
+        frame, so after the first few frames the arena stops touching the heap.
+
+        Destructors are never run, so only trivially destructible data, or
+        containers that use ArenaAllocator, should be placed in the arena.
+     */
+
+    class FrameArena
+    {
+    public:
+        LR_API explicit FrameArena(size_t capacity = 256 * 1024);
+        LR_API ~FrameArena();
+
+        FrameArena(const FrameArena &) = delete;
+        FrameArena & operator=(const FrameArena &) = delete;
+
+        LR_API void * allocate(size_t bytes, size_t align = alignof(std::max_align_t));
+
+        template <typename T>
+        T * allocateArray(size_t count)
+        {
+            return static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+        }
+
+        LR_API void reset();
+
+        size_t used() const      { return _used; }
+        size_t capacity() const  { return _capacity; }
+        size_t highWater() const { return _highWater; }
+
+    private:
+        struct Block
+        {
+            char * data;
+            size_t size;
+        };
+
+        void addBlock(size_t size);
+
+        std::vector<Block> _blocks;
+        char * _cursor = nullptr;
+        char * _end = nullptr;
+        size_t _used = 0;           // bytes handed out since the last reset
+        size_t _capacity = 0;       // bytes in all blocks
+        size_t _highWater = 0;
+    };
+
+    // adapts a FrameArena for std containers; deallocate is a no-op
+    template <typename T>
+    class ArenaAllocator
+    {
+    public:
+        typedef T value_type;
+
+        explicit ArenaAllocator(FrameArena & arena) : _arena(&arena) {}
+        template <typename U>
+        ArenaAllocator(const ArenaAllocator<U> & other) : _arena(other.arena()) {}
+
+        T * allocate(size_t n)       { return _arena->allocateArray<T>(n); }
+        void deallocate(T *, size_t) {}
+
+        FrameArena * arena() const { return _arena; }
+
+        template <typename U>
+        bool operator==(const ArenaAllocator<U> & other) const { return _arena == other.arena(); }
+        template <typename U>
+        bool operator!=(const ArenaAllocator<U> & other) const { return _arena != other.arena(); }
+
+    private:
+        FrameArena * _arena;
+    };
+
+    template <typename T>
+    using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+} // lab
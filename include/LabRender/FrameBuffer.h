@@ -34,8 +34,10 @@ namespace lab {
 		unsigned int id = 0;
         unsigned int renderbuffer = 0;
         bool autoDepth = true;
+        bool depthTextureAttached = false;
         bool resizeViewport = true;
         int newViewport[4], oldViewport[4];
+        float viewportScale = 1.f;  // fraction of the attachments drawn, from the lower left
         int renderbufferWidth = 0, renderbufferHeight = 0;
         ErrorPolicy errorPolicy;
         std::vector<unsigned int> drawBuffers;
@@ -58,20 +60,24 @@ namespace lab {
         void bindForRead(const std::vector<std::string> & attachments);
 		void bindForWrite(const std::vector<std::string> & attachments);
 
+        // drawBufferTable holds, per attachment, GL_COLOR_ATTACHMENTi or GL_NONE
+		void bindForWrite(const std::vector<unsigned int> & drawBufferTable);
+
         class FrameBufferSpec {
         public:
             class AttachmentSpec {
             public:
                 AttachmentSpec() {}
 
-                AttachmentSpec(const std::string & b, const std::string & o, const std::string & u, TextureType t)
-                : base_name(b), output_name(o), uniform_name(u), type(t) {}
+                AttachmentSpec(const std::string & b, const std::string & o, const std::string & u, TextureType t, float s = 1.f)
+                : base_name(b), output_name(o), uniform_name(u), type(t), scale(s) {}
 
                 AttachmentSpec(const AttachmentSpec & rh)
-                : base_name(rh.base_name), output_name(rh.output_name), uniform_name(rh.uniform_name), type(rh.type) {}
+                : base_name(rh.base_name), output_name(rh.output_name), uniform_name(rh.uniform_name), type(rh.type), scale(rh.scale) {}
 
                 const AttachmentSpec & operator=(const AttachmentSpec & rh) {
                     base_name = rh.base_name; output_name = rh.output_name; uniform_name = rh.uniform_name; type = rh.type;
+                    scale = rh.scale;
                     return *this;
                 }
 
@@ -79,15 +85,36 @@ namespace lab {
                 std::string output_name;
                 std::string uniform_name;
                 TextureType type;
+                float scale = 1.f;      // of the framebuffer size
             };
 
             FrameBufferSpec() {}
-            FrameBufferSpec(const FrameBufferSpec & rh) : attachments(rh.attachments), hasDepth(rh.hasDepth) {}
+            FrameBufferSpec(const FrameBufferSpec & rh) : attachments(rh.attachments), hasDepth(rh.hasDepth), persistent(rh.persistent) {}
 
             std::vector<AttachmentSpec> attachments;
-            bool hasDepth;
+            bool hasDepth = false;
+
+            // persistent buffers keep their contents across frames; they are
+            // never culled, and their textures are never shared
+            bool persistent = false;
+
+            // A framebuffer only renders to the area all of its attachments
+            // cover, so a buffer has a single scale; FramebufferSet makes the
+            // attachments agree with the first.
+            float scale() const { return attachments.size() ? attachments[0].scale : 1.f; }
         };
-        void create(const FrameBufferSpec &, int width, int height);
+
+        // Non-null entries in shared are used as the corresponding color
+        // attachment instead of allocating a texture; an entry following the
+        // color attachments is used as the depth texture. They must already
+        // have been created at the requested size.
+        void create(const FrameBufferSpec &, int width, int height,
+                    const std::vector<std::shared_ptr<Texture>> & shared = std::vector<std::shared_ptr<Texture>>());
+
+        // A framebuffer with only a depth texture, for depth-only passes such
+        // as shadow maps. depth, if given, is (re)created at the size and
+        // used, so that a caller holding it keeps a valid handle.
+        void createDepth(int width, int height, std::shared_ptr<Texture> depth = std::shared_ptr<Texture>());
 
         // Draw to texture 2D in the indicated attachment location (or a 2D layer of
         // a 3D texture).
@@ -102,19 +129,104 @@ namespace lab {
         FrameBuffer& checkFbo();
     };
 
+    // Render target textures, keyed by format and size. Textures released by
+    // one allocation are handed out again by the next, so resizing back to a
+    // recent size, or moving between a few render scales, doesn't allocate.
+    class RenderTargetPool {
+    public:
+        // TextureType::none with depth set is a depth texture
+        std::shared_ptr<Texture> acquire(TextureType, int width, int height, int filter, bool depth = false);
+
+        // every texture becomes available to acquire again
+        void releaseAll();
+
+        // destroys textures that haven't been acquired for maxAge generations;
+        // a generation ends at each releaseAll
+        void trim(int maxAge);
+
+        size_t bytes() const;
+        int textureCount() const { return int(_entries.size()); }
+
+    private:
+        struct Entry
+        {
+            TextureType type;
+            bool depth;
+            int width, height;
+            int generation;     // when last acquired
+            bool inUse;
+            std::shared_ptr<Texture> texture;
+        };
+
+        std::vector<Entry> _entries;
+        int _generation = 0;
+    };
+
     class FramebufferSet {
     public:
+        struct PoolSlot
+        {
+            TextureType type;
+            float scale;
+        };
+
         FramebufferSet();
         ~FramebufferSet() {}
 
         void add_fbo(const std::string & name, const FrameBuffer::FrameBufferSpec &);
         std::shared_ptr<FrameBuffer> fbo(const std::string & named) const;
+        const FrameBuffer::FrameBufferSpec * spec(const std::string & named) const;
+        std::vector<std::string> names() const;
 
         bool setSize(int width, int height);
 
+        // Multiplies the scale of every buffer; the buffers are reallocated,
+        // from the render target pool, on the next setSize.
+        void setRenderScale(float);
+        float renderScale() const { return _renderScale; }
+
+        // the size a buffer is allocated at for the current size and scale
+        v2i bufferSize(const FrameBuffer::FrameBufferSpec &) const;
+
+        // Draws every buffer into the lower left fraction of its attachments,
+        // without reallocating. Shaders that read the buffers scale their
+        // texture coordinates by the same fraction, see u_renderScale.
+        void setViewportScale(float);
+        float viewportScale() const { return _viewportScale; }
+
+        const RenderTargetPool & renderTargets() const { return _targets; }
+
+        // Allocation plan, normally produced by compiling a pass graph.
+        // Buffers marked unused are never allocated. Each attachment of a
+        // buffer may name a slot in the shared pool; attachments with the
+        // same slot share one texture, the others get their own. -1 is a
+        // private texture. Changing the plan reallocates on the next setSize.
+        void setPool(const std::vector<PoolSlot> & slots);
+        void setAllocation(const std::string & name, bool used, const std::vector<int> & slots);
+        void clearAllocation();
+
+        // render target memory, per pixel of the framebuffer at a render
+        // scale of one; requested is the memory every buffer would take if
+        // allocated individually
+        double allocatedBytesPerPixel() const;
+        double requestedBytesPerPixel() const;
+
     private:
+        struct Allocation
+        {
+            bool used = true;
+            std::vector<int> slots;
+        };
+
+        double bufferBytesPerPixel(const FrameBuffer::FrameBufferSpec &, const Allocation *) const;
+
         int _width, _height;
+        float _renderScale;
+        float _viewportScale;
         std::map<std::string, std::pair<FrameBuffer::FrameBufferSpec, std::shared_ptr<FrameBuffer>>> _fbos;
+        std::map<std::string, Allocation> _allocation;
+        std::vector<std::pair<PoolSlot, std::shared_ptr<Texture>>> _pool;
+        RenderTargetPool _targets;
     };
 
 } // LabRender
@@ -0,0 +1,91 @@
+//
+//  FrameFences.h
+//  LabRender
+//
+//
+
+#pragma once
+
+#include "LabRender/LabRender.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace lab {
+
+    /**
+        FrameFences tracks frames that have been submitted by the CPU but not
+        yet retired by the GPU. Each frame occupies a slot in a ring of
+        configurable depth; a glFenceSync is inserted at endFrame, and
+        beginFrame only blocks if the slot it is about to reuse is still in
+        flight. Resources that are rewritten every frame (streaming vertex
+        data, uniform buffers) should be kept per slot, see PerFrame below.
+     */
+
+    class FrameFences
+    {
+    public:
+        struct Timings
+        {
+            double cpuFrameMs = 0;      // beginFrame to endFrame of the last frame
+            double fenceWaitMs = 0;     // time beginFrame blocked waiting on the ring
+            double gpuLatencyMs = 0;    // submission to observed retirement of the last retired frame
+            int framesInFlight = 0;     // frames submitted but not yet retired
+        };
+
+        LR_API explicit FrameFences(int depth = 2);
+        LR_API ~FrameFences();
+
+        // changing the depth drains the ring first
+        LR_API void setDepth(int depth);
+        int depth() const { return int(_frames.size()); }
+
+        // returns the slot index for the frame being prepared
+        LR_API int beginFrame();
+        LR_API void endFrame();
+
+        // block until every submitted frame has been retired
+        LR_API void drain();
+
+        int slot() const { return _slot; }
+        uint64_t frameNumber() const { return _frameNumber; }
+        const Timings & timings() const { return _timings; }
+
+    private:
+        struct Frame
+        {
+            void* fence = nullptr;     // GLsync
+            double submitTime = 0;
+        };
+
+        void retire(Frame &, bool wait);
+
+        std::vector<Frame> _frames;
+        int _slot = 0;
+        uint64_t _frameNumber = 0;
+        double _beginTime = 0;
+        bool _inFrame = false;
+        Timings _timings;
+    };
+
+    // PerFrame holds one T per FrameFences slot, so that a CPU write for
+    // frame N+1 never touches storage the GPU may still be reading for frame N.
+
+    template <typename T>
+    class PerFrame
+    {
+        std::vector<T> _slots;
+
+    public:
+        explicit PerFrame(int depth = 2) : _slots(depth) {}
+
+        void resize(int depth) { _slots.resize(depth); }
+        int size() const { return int(_slots.size()); }
+
+        T & operator[](int slot) { return _slots[slot % _slots.size()]; }
+        const T & operator[](int slot) const { return _slots[slot % _slots.size()]; }
+
+        T & current(const FrameFences & f) { return (*this)[f.slot()]; }
+    };
+
+} // lab
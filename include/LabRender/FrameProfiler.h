@@ -0,0 +1,132 @@
+//
+//  FrameProfiler.h
+//  LabRender
+//
+//
+
+#pragma once
+
+#include "LabRender/LabRender.h"
+
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace lab {
+
+    // One timed region of a frame; either a pass (depth 0) or a draw bucket
+    // within a pass (depth 1). Times are in milliseconds, starts are relative
+    // to the beginning of the frame.
+
+    struct PassProfile
+    {
+        std::string name;
+        int depth = 0;
+        double gpuStartMs = 0;
+        double gpuMs = 0;
+        double cpuStartMs = 0;
+        double cpuMs = 0;
+        int drawCount = 0;
+        int64_t triangleCount = 0;
+
+        // fragments that passed the depth test, for zones that count them,
+        // and the pixels of the target they were drawn into
+        int64_t samplesPassed = -1;
+        int64_t pixels = 0;
+
+        // fragments shaded per pixel drawn into, or zero if not counted
+        double overdraw() const { return samplesPassed >= 0 && pixels > 0 ? double(samplesPassed) / double(pixels) : 0; }
+    };
+
+    struct FrameProfile
+    {
+        uint64_t frameNumber = 0;
+        double gpuMs = 0;
+        double cpuMs = 0;
+        std::vector<PassProfile> passes;
+    };
+
+    // Writes a profile as Chrome trace event JSON (chrome://tracing, Perfetto).
+    LR_API void writeChromeTrace(std::ostream &, const FrameProfile &);
+
+    /**
+        FrameProfiler brackets regions of a frame with GL_TIMESTAMP query
+        pairs. Queries are kept in a ring several frames deep and are only
+        read back once the GPU has retired them, so profiling never stalls
+        the pipeline; the profile returned by lastFrameProfile() is therefore
+        a few frames old.
+     */
+
+    class FrameProfiler
+    {
+    public:
+        LR_API explicit FrameProfiler(int latency = 4);
+        LR_API ~FrameProfiler();
+
+        void setEnabled(bool e) { _enabled = e; }
+        bool enabled() const { return _enabled; }
+
+        LR_API void beginFrame();
+        LR_API void endFrame();
+
+        // returns a zone handle to pass to endZone
+        LR_API int beginZone(const char * name, int depth = 0);
+        LR_API void endZone(int zone, int drawCount, int64_t triangleCount);
+
+        // Counts the fragments that pass the depth test until the zone
+        // ends, over a target of the given number of pixels. Counting zones
+        // can't nest.
+        LR_API void countSamples(int zone, int64_t pixels);
+
+        // leave draws out of the count, such as those under other occlusion
+        // queries, which can't be active at the same time
+        LR_API void pauseSamples();
+        LR_API void resumeSamples();
+
+        const FrameProfile & lastFrameProfile() const { return _last; }
+
+        // the number the next frame will be given
+        uint64_t frameNumber() const { return _frameNumber; }
+
+    private:
+        struct Zone
+        {
+            std::string name;
+            int depth = 0;
+            unsigned int queries[2] = { 0, 0 };
+            std::vector<unsigned int> samplesQueries;   // summed; one per stretch between pauses
+            int samplesUsed = 0;
+            bool countsSamples = false;
+            int64_t pixels = 0;
+            double cpuBegin = 0;
+            double cpuEnd = 0;
+            int drawCount = 0;
+            int64_t triangleCount = 0;
+        };
+
+        struct Frame
+        {
+            std::vector<Zone> zones;
+            int zoneCount = 0;
+            unsigned int lastQuery = 0;
+            uint64_t frameNumber = 0;
+            double cpuBegin = 0;
+            double cpuEnd = 0;
+            bool pending = false;
+        };
+
+        bool resolve(Frame &);
+        void beginSamples(Zone &);
+
+        std::vector<Frame> _frames;
+        int _current = 0;
+        uint64_t _frameNumber = 0;
+        bool _enabled = true;
+        bool _inFrame = false;
+        int _countingZone = -1;
+        bool _samplesPaused = false;
+        FrameProfile _last;
+    };
+
+} // lab
@@ -0,0 +1,119 @@
+//
+//  GLState.h
+//  LabRender
+//
+//
+
+#pragma once
+
+#include "LabRender/LabRender.h"
+
+#include <unordered_map>
+#include <vector>
+
+namespace lab {
+
+    /**
+        GLState shadows the GL state LabRender changes most often, and drops
+        calls that would set a value that is already current. The shadow can
+        only be trusted if every change goes through it, so code outside
+        LabRender that touches GL state must call invalidate() before
+        LabRender renders again. PassRenderer invalidates at the start of
+        every render for that reason.
+
+        There is one GLState per thread, matching the rule that a GL context
+        is current on one thread at a time.
+     */
+
+    class GLState
+    {
+    public:
+        struct Counters
+        {
+            int issued = 0;
+            int skipped = 0;
+        };
+
+        LR_API GLState();
+
+        // forget everything; the next call of each kind is always issued
+        LR_API void invalidate();
+
+        // counters accumulate until beginFrame, which saves them as the last frame's
+        LR_API void beginFrame();
+        const Counters & counters() const { return _counters; }
+        const Counters & lastFrameCounters() const { return _lastFrame; }
+
+        LR_API void useProgram(unsigned int program);
+        LR_API void bindVertexArray(unsigned int vao);
+
+        // GL_FRAMEBUFFER binds both the draw and read framebuffers
+        LR_API void bindFramebuffer(unsigned int target, unsigned int fbo);
+        unsigned int drawFramebuffer() const { return _drawFramebuffer; }
+
+        // draw buffers are framebuffer state, applied to the bound draw framebuffer
+        LR_API void drawBuffers(int count, const unsigned int * buffers);
+
+        LR_API void enable(unsigned int cap);
+        LR_API void disable(unsigned int cap);
+        LR_API void depthFunc(unsigned int func);
+        LR_API void depthMask(bool write);
+
+        // the current depth state, or GL's defaults if it isn't known
+        LR_API unsigned int depthFunc() const;
+        bool depthMask() const { return _depthMask != 0; }
+        LR_API void blendFunc(unsigned int src, unsigned int dst);
+        LR_API void cullFace(unsigned int mode);
+        LR_API void viewport(int x, int y, int w, int h);
+        LR_API void scissor(int x, int y, int w, int h);
+
+        // writes the current viewport, querying GL only if it isn't known
+        LR_API void getViewport(int * xywh);
+
+        LR_API void activeTexture(unsigned int unit);
+        LR_API void bindTexture(unsigned int unit, unsigned int target, unsigned int texture);
+
+        // Objects must be deleted through these, so that a recycled name is
+        // not mistaken for a binding that is still current.
+        LR_API void deleteProgram(unsigned int program);
+        LR_API void deleteVertexArray(unsigned int vao);
+        LR_API void deleteFramebuffer(unsigned int fbo);
+        LR_API void deleteTexture(unsigned int texture);
+
+    private:
+        bool skip(bool same);
+
+        enum Cap { depthTest, blend, cullFace_, scissorTest, stencilTest, polygonOffsetFill, capCount };
+        static int capIndex(unsigned int cap);
+
+        struct TextureUnit
+        {
+            unsigned int target;
+            unsigned int texture;
+        };
+
+        unsigned int _program;
+        unsigned int _vao;
+        unsigned int _drawFramebuffer;
+        unsigned int _readFramebuffer;
+        int _caps[capCount];
+        unsigned int _depthFunc;
+        int _depthMask;
+        unsigned int _blendSrc, _blendDst;
+        unsigned int _cullFace;
+        int _viewport[4];
+        bool _viewportKnown;
+        int _scissor[4];
+        bool _scissorKnown;
+        unsigned int _activeTexture;
+        std::vector<TextureUnit> _units;
+        std::unordered_map<unsigned int, std::vector<unsigned int>> _drawBuffers;
+
+        Counters _counters;
+        Counters _lastFrame;
+    };
+
+    // the state cache for the calling thread's context
+    LR_API GLState & glState();
+
+} // lab
@@ -26,7 +26,8 @@ enum class TextureType {
     f32x1, f32x2, f32x3, f32x4,
     f16x1, f16x2, f16x3, f16x4,
     u8x1,  u8x2,  u8x3,  u8x4,
-    s8x1,  s8x2,  s8x3,  s8x4
+    s8x1,  s8x2,  s8x3,  s8x4,
+    bc1,   bc3,   bc5,   bc7        // block compressed, in 4x4 texel blocks
 };
 
 LR_API TextureType stringToTextureType(const std::string & s);
@@ -84,6 +85,11 @@ enum class AutomaticUniform {
     skyMatrix,
     renderTime,
     mousePosition,
+    renderScale,
+    inverseProjection,
+    inverseView,
+    lightClusterGrid,
+    lightClusterSlicing,
 };
 
 LR_API AutomaticUniform stringToAutomaticUniform(const std::string & s);
@@ -22,9 +22,27 @@ namespace lab {
         virtual ~SkyDomeLight() {}
     };
 
+    // Point and spot lights are positioned by their Illuminant's transform,
+    // and have no effect beyond radius.
     class PointLight : public Light {
     public:
         virtual ~PointLight() {}
+
+        v3f color { 1, 1, 1 };
+        float intensity = 1.f;
+        float radius = 10.f;
+    };
+
+    // A spot light shines down the -z axis of its transform; the cone
+    // angles are in degrees from the axis.
+    class SpotLight : public PointLight {
+    public:
+        virtual ~SpotLight() {}
+
+        float innerAngle = 20.f;
+        float outerAngle = 30.f;
+
+        bool castsShadow = false;
     };
 
     struct Illuminant {
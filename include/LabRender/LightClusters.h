@@ -0,0 +1,151 @@
+//
+//  LightClusters.h
+//  LabRender
+//
+//
+
+#pragma once
+
+#include "LabRender/LabRender.h"
+#include "LabRender/MathTypes.h"
+#include "LabRender/WorkerPool.h"
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+namespace lab {
+
+    class DrawList;
+    class FrameArena;
+    class ShadowAtlas;
+    struct Texture;
+
+    /**
+        LightClusters assigns the point and spot lights of a DrawList to a
+        grid of froxels, screen tiles that are sliced exponentially in view
+        depth, so that a lighting pass only visits the lights that can reach
+        each pixel. The cost per pixel depends on how many lights overlap,
+        rather than on how many lights there are.
+
+        Each light's sphere is bounded on screen and in depth, and only the
+        froxels inside those bounds are tested against it, so assignment
+        costs roughly the number of froxels each light touches. The slices
+        are then tested in parallel, each whole by one thread, and merged in
+        slice order, so the result is the same whatever the thread count.
+
+        The results are uploaded as three float textures, registered with
+        the renderer so that pipelines can sample them by name:
+
+            light_data     kLightTexels per light, one light per row
+                             (world position, radius)
+                             (color * intensity, cos inner angle)
+                             (world direction, cos outer angle)
+                             (shadow tile x, y, size, 1 if shadowed)
+                             the shadow tile's view projection, by column
+            light_grid     (first index, count) per froxel; the froxel of
+                             tile x, y in slice z is at (x, y + z * tilesY)
+            light_indices  light rows, kIndexRowWidth to a row
+
+        The automatic uniforms light_cluster_grid, (tilesX, tilesY, slices,
+        lights), and light_cluster_slicing, (scale, bias), locate a froxel:
+        slice = floor(log(view depth) * scale + bias).
+
+        Only perspective projections are clustered; under any other, no
+        lights are assigned.
+     */
+
+    class LightClusters
+    {
+    public:
+        static const int kIndexRowWidth = 1024;
+        static const int kLightTexels = 8;
+
+        struct Settings
+        {
+            int tilesX = 16;
+            int tilesY = 9;
+            int slices = 24;
+        };
+
+        struct Stats
+        {
+            int lights = 0;         // point and spot lights in the draw list
+            int visible = 0;        // lights that touched at least one froxel
+            int indices = 0;        // entries in the index list
+        };
+
+        // workers in addition to the calling thread; negative picks from
+        // the hardware. They are started by the first build.
+        LR_API explicit LightClusters(int workers = -1);
+
+        LR_API void setSettings(const Settings &);
+        const Settings & settings() const { return _settings; }
+
+        // Assigns the lights; scratch memory comes from the arena. Lights
+        // with a tile in shadows record it. Does not touch GL.
+        LR_API void build(const DrawList &, FrameArena &, const ShadowAtlas * shadows = nullptr);
+
+        // Uploads the last build to the textures.
+        LR_API void upload();
+
+        const std::shared_ptr<Texture> & lightTexture() const { return _lightTexture; }
+        const std::shared_ptr<Texture> & gridTexture() const  { return _gridTexture; }
+        const std::shared_ptr<Texture> & indexTexture() const { return _indexTexture; }
+
+        v4f gridUniform() const    { return v4f(float(_settings.tilesX), float(_settings.tilesY), float(_settings.slices), float(_lightCount)); }
+        v2f slicingUniform() const { return v2f(_sliceScale, _sliceBias); }
+
+        int workerCount() const { return _pool.workerCount(); }
+        const Stats & stats() const { return _stats; }
+
+        // the lights in each froxel, as offsets and counts into indices()
+        const std::vector<v2f> & grid() const      { return _grid; }
+        const std::vector<float> & indices() const { return _indices; }
+
+    private:
+        struct Assignment
+        {
+            uint32_t froxel;
+            uint32_t light;
+        };
+
+        // a light's view space sphere, and the slices and tiles it may touch;
+        // empty when it touches none
+        struct Span
+        {
+            v4f sphere;
+            int s0, s1;
+            int tx0, tx1, ty0, ty1;
+        };
+
+        void updateFroxels(const m44f & proj);
+        void assignSlice(int slice);
+
+        Settings _settings;
+        Stats _stats;
+
+        m44f _proj;
+        bool _perspective = false;
+        float _near = 0, _far = 0;
+        float _sliceScale = 0, _sliceBias = 0;
+        std::vector<Bounds> _froxels;   // view space bounds, in grid order
+
+        int _lightCount = 0;
+        std::vector<v4f> _lights;
+        std::vector<v2f> _grid;
+        std::vector<float> _indices;
+
+        std::vector<Span> _spans;
+        std::vector<uint32_t> _sliceStart;      // into _sliceLights, per slice and one past
+        std::vector<uint32_t> _sliceLights;
+        std::vector<std::vector<Assignment>> _assignments;  // per slice
+
+        WorkerPool _pool;
+
+        std::shared_ptr<Texture> _lightTexture;
+        std::shared_ptr<Texture> _gridTexture;
+        std::shared_ptr<Texture> _indexTexture;
+    };
+
+} // lab
@@ -321,7 +321,14 @@ namespace lab {
 	template <typename T> inline float vector_dot(const T & a, const T & b) { return dot(a, b); }
 
 	inline v3f vector_cross(const v3f & a, const v3f & b) { return cross(a, b); }
-	LR_API v4f matrix_multiply(const m44f & a, const v4f & v);
+	// a's columns weighted by v, as simd's matrix_multiply; so a point,
+	// with w of one, is carried by a's translation
+	inline v4f matrix_multiply(const m44f & a, const v4f & v) {
+		return v4f(a.m[0] * v.x + a.m[4] * v.y + a.m[8]  * v.z + a.m[12] * v.w,
+		           a.m[1] * v.x + a.m[5] * v.y + a.m[9]  * v.z + a.m[13] * v.w,
+		           a.m[2] * v.x + a.m[6] * v.y + a.m[10] * v.z + a.m[14] * v.w,
+		           a.m[3] * v.x + a.m[7] * v.y + a.m[11] * v.z + a.m[15] * v.w);
+	}
 	LR_API m44f matrix_multiply(const m44f & a, const m44f & b);
 
 	LR_API m44f matrix_invert(const m44f & a);
@@ -345,6 +352,25 @@ namespace lab {
         return extendBounds(ret, xyz.second);
     }
 
+    // corner i of a box takes its x, y and z from the max for bits 0, 1 and 2
+    inline v3f boundsCorner(const Bounds & b, int i) {
+        return v3f((i & 1) ? b.second.x : b.first.x,
+                   (i & 2) ? b.second.y : b.first.y,
+                   (i & 4) ? b.second.z : b.first.z);
+    }
+
+    // the box around the corners of a box transformed by an affine m
+    inline Bounds transformBounds(const m44f & m, const Bounds & b) {
+        Bounds ret;
+        for (int i = 0; i < 8; ++i) {
+            v3f c = boundsCorner(b, i);
+            v4f p = matrix_multiply(m, v4f(c.x, c.y, c.z, 1.f));
+            v3f xyz(p.x, p.y, p.z);
+            ret = i ? extendBounds(ret, xyz) : Bounds(xyz, xyz);
+        }
+        return ret;
+    }
+
 
 }
 
@@ -26,7 +26,8 @@ namespace lab {
     public:
         enum class ShaderType {
             meshShader,
-            skyShader, customShader };
+            skyShader, customShader,
+            depthShader };          // position only, for depth prepasses
 
 		LR_API ModelPart() : _shaderType(ShaderType::meshShader) {}
 		LR_API virtual ~ModelPart() {}
@@ -45,6 +46,18 @@ namespace lab {
 
 		LR_API virtual void draw(FrameBuffer & fbo, Renderer::RenderLock &) override;
 
+        // Mesh shaded parts draw with a position only variant of their
+        // shader; parts whose material supplies shaders or depth state draw
+        // with their usual shader, as the prepass must match them exactly.
+		LR_API virtual void drawDepth(FrameBuffer & fbo, Renderer::RenderLock &) override;
+
+		LR_API virtual void prepareShaders(FrameBuffer & fbo, bool depth) override;
+
+        // the vertex and fragment shader files of the material, once read;
+        // a program that fails to compile on a reload is kept
+		LR_API virtual void shaderFiles(std::vector<std::string> & files) const override;
+		LR_API virtual void reloadShaders(const std::vector<std::string> & changed) override;
+
 		LR_API VAO * verts() const { return _verts.get(); }
 
 		LR_API void setShader(std::shared_ptr<Shader> shader) { _shader = shader; }
@@ -61,10 +74,39 @@ namespace lab {
         }
 
     protected:
+        void requestShader(FrameBuffer & fbo);
+        void requestDepthShader(FrameBuffer & fbo);
+
+        // true if drawDepth draws as draw does, see drawDepth
+        bool drawsDepthAsColor() const;
+
+        // locations of the uniforms draw sets, looked up when the program changes
+        struct UniformLocations
+        {
+            uint32_t program = 0;
+            int view = -1;
+            int modelView = -1;
+            int modelViewProj = -1;
+            int jacobian = -1;
+            int texture = -1;
+        };
+
         ShaderType              _shaderType;
         std::shared_ptr<Shader> _shader;
+        std::shared_ptr<Shader> _depthShader;
         std::unique_ptr<VAO>    _verts;
         Bounds                  _localBounds;
+        UniformLocations        _locations;
+        UniformLocations        _depthLocations;
+
+        // shaders are looked up once per set of vertices, so that a part
+        // that can't have one isn't asked again every draw
+        bool                    _shaderRequested = false;
+        bool                    _depthShaderRequested = false;
+
+        // the files the shader was read from, and whether one was written since
+        std::vector<std::string> _shaderFiles;
+        bool                    _shaderStale = false;
     };
 
     class Model : public ModelBase {
@@ -74,6 +116,10 @@ namespace lab {
 		LR_API  virtual void update(double time) override;
 		LR_API  virtual void draw() override;
 		LR_API  virtual void draw(FrameBuffer & fbo, Renderer::RenderLock &) override;
+		LR_API  virtual void drawDepth(FrameBuffer & fbo, Renderer::RenderLock &) override;
+		LR_API  virtual void prepareShaders(FrameBuffer & fbo, bool depth) override;
+		LR_API  virtual void shaderFiles(std::vector<std::string> & files) const override;
+		LR_API  virtual void reloadShaders(const std::vector<std::string> & changed) override;
 
 		LR_API  void addPart(std::shared_ptr<ModelBase> p) { _parts.push_back(p); }
 
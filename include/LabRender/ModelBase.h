@@ -11,11 +11,14 @@
 #include "LabRender/Transform.h"
 #include "LabRender/Renderer.h"
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace lab {
     
     struct FrameBuffer;
     class Material;
+    struct OccluderMesh;
     
     class ModelBase {
     public:
@@ -23,11 +26,32 @@ namespace lab {
         virtual void update(double time) = 0;
         virtual void draw() = 0;
         virtual void draw(FrameBuffer & fbo, Renderer::RenderLock &) = 0;
+
+        // Draws only depth, for a depth prepass; color writes are already
+        // off. Models without a cheaper way draw as usual.
+        virtual void drawDepth(FrameBuffer & fbo, Renderer::RenderLock & rl) { draw(fbo, rl); }
+
+        // Requests the shaders that draw, or drawDepth when the flag is set,
+        // would use with the framebuffer, without drawing; see
+        // PassRenderer::warmUpShaders.
+        virtual void prepareShaders(FrameBuffer &, bool) {}
+
+        // Appends the files the model's shaders were read from, by their
+        // expanded paths; after some were written, reloadShaders has the
+        // shaders read from them made again when next drawn. See
+        // PassRenderer::setHotReload.
+        virtual void shaderFiles(std::vector<std::string> &) const {}
+        virtual void reloadShaders(const std::vector<std::string> &) {}
+
         virtual Bounds localBounds() const = 0;
         
         Transform transform;
         
         std::shared_ptr<Material> material;
+
+        // a simplified stand-in, lying within the model, that hides what is
+        // behind it; see SoftwareOcclusion.h
+        std::shared_ptr<OccluderMesh> occluder;
     };
 
 }
@@ -0,0 +1,158 @@
+//
+//  OcclusionCuller.h
+//  LabRender
+//
+//
+
+#pragma once
+
+#include "LabRender/LabRender.h"
+#include "LabRender/MathTypes.h"
+#include "LabRender/Renderer.h"
+
+#include <memory>
+#include <vector>
+
+namespace lab {
+
+    class DrawList;
+    class ModelBase;
+    class ModelPart;
+    struct Shader;
+    struct Texture;
+
+    /**
+        OcclusionCuller skips the opaque models that were hidden behind the
+        depth of an earlier frame.
+
+        A "depth-pyramid" pass reduces a depth buffer into a pyramid, each
+        texel the farthest depth of the texels below it. The first level no
+        larger than readbackSize is copied into a pixel buffer and read back
+        once its fence has passed, a frame or more later, so the GPU is never
+        waited on; the coarser levels are finished on the CPU.
+
+        update() projects each model's bounds with the view projection the
+        pyramid was made with, and culls the models whose nearest depth is
+        behind the farthest depth under them. Bounds that cross the near
+        plane, then or now, or that were wholly off screen, are kept.
+
+        A culled model may have come into view since. The first opaque pass
+        to reach it draws its bounds against the depth drawn so far under an
+        occlusion query, after the visible models, and draws the model only
+        if some of the box passed; later passes reuse the result. A model is
+        therefore never missing, only cheaper when it stays hidden.
+
+        setDepth() builds the CPU pyramid from a depth image, as the readback
+        does, so that culling can be exercised without a GPU.
+     */
+
+    class OcclusionCuller
+    {
+    public:
+        struct Settings
+        {
+            int readbackSize = 128;     // largest width or height read back
+            int maxAgeFrames = 4;       // an older pyramid doesn't cull
+        };
+
+        struct Stats
+        {
+            int tested = 0;
+            int culled = 0;
+            int retested = 0;       // culled models whose bounds were queried
+            int pyramidAge = -1;    // frames since the pyramid in use was drawn, -1 if none
+        };
+
+        LR_API OcclusionCuller();
+        LR_API ~OcclusionCuller();
+
+        LR_API void setSettings(const Settings &);
+        const Settings & settings() const { return _settings; }
+
+        // picks up any finished readback and tests drawList.deferredMeshes
+        LR_API void update(const DrawList &);
+
+        bool culled(size_t meshIndex) const { return meshIndex < _culled.size() && _culled[meshIndex]; }
+
+        // Queries the bounds of every culled model against the depth buffer
+        // bound for write; only the first call in a frame does anything.
+        LR_API void retest(Renderer::RenderLock &);
+
+        // bracket the draw of a culled model, after retest
+        LR_API void beginConditional(size_t meshIndex);
+        LR_API void endConditional();
+
+        // reduces the size pixels at the origin of depth; viewProj is the
+        // matrix they were drawn with
+        LR_API void buildPyramid(Renderer::RenderLock &, const Texture & depth, v2i size, const m44f & viewProj);
+
+        // makes the pyramid and box programs without drawing; see
+        // PassRenderer::warmUpShaders
+        LR_API void prepareShaders();
+
+        LR_API void setDepth(const float * depth, int width, int height, const m44f & viewProj);
+
+        // true if the bounds are hidden in the CPU pyramid
+        LR_API bool occluded(const m44f & model, const Bounds & local) const;
+
+        const Stats & stats() const { return _stats; }
+
+    private:
+        struct Level
+        {
+            int width = 0, height = 0;
+            std::vector<float> depth;
+        };
+
+        struct Readback
+        {
+            unsigned int pbo = 0;
+            size_t bytes = 0;
+            void * fence = nullptr;     // GLsync
+            int width = 0, height = 0;
+            float texelsX = 0, texelsY = 0;
+            m44f viewProj;
+            uint64_t frame = 0;
+        };
+
+        struct GpuLevel
+        {
+            std::shared_ptr<Texture> texture;
+            unsigned int fbo = 0;
+        };
+
+        void buildCpuPyramid(const float * depth, int width, int height,
+                             float texelsX, float texelsY, const m44f & viewProj, uint64_t frame);
+        void collectReadbacks();
+
+        Settings _settings;
+        Stats _stats;
+        uint64_t _frame = 0;
+
+        // the pyramid culling is done against; texels are the level 0 texels
+        // spanning the viewport, not always a whole number when read back
+        std::vector<Level> _levels;
+        float _texelsX = 0, _texelsY = 0;
+        m44f _viewProj;
+        uint64_t _pyramidFrame = 0;
+        bool _hasPyramid = false;
+
+        std::vector<uint8_t> _culled;
+        std::vector<unsigned int> _queries;     // per mesh, made as needed
+        bool _retested = false;
+        m44f _currentViewProj;
+
+        std::vector<GpuLevel> _gpuLevels;
+        int _gpuWidth = 0, _gpuHeight = 0;
+        std::vector<Readback> _readbacks;
+        int _nextReadback = 0;
+
+        std::shared_ptr<Shader> _reduceShader;
+        std::shared_ptr<Shader> _boxShader;
+        std::shared_ptr<ModelPart> _quad;
+        std::shared_ptr<ModelPart> _box;
+        int _sourceLocation = -1, _sourceSizeLocation = -1, _destSizeLocation = -1;
+        int _boxMvpLocation = -1;
+    };
+
+} // lab
@@ -10,12 +10,19 @@
 
 #include <LabRender/LabRender.h>
 #include "LabRender/DrawList.h"
+#include "LabRender/DynamicResolution.h"
 #include "LabRender/FrameBuffer.h"
+#include "LabRender/FrameProfiler.h"
+#include "LabRender/LightClusters.h"
 #include "LabRender/Model.h"
+#include "LabRender/OcclusionCuller.h"
 #include "LabRender/Renderer.h"
+#include "LabRender/ShadowAtlas.h"
 #include "LabRender/Shader.h"
 #include "LabRender/ShaderBuilder.h"
+#include "LabRender/SoftwareOcclusion.h"
 #include "LabRender/Texture.h"
+#include "LabRender/TextureStreamer.h"
 
 #include <string>
 
@@ -38,11 +45,11 @@ namespace lab {
 
             int passNumber() const { return _passNumber; }
 
-            void bindInputTextures(RenderLock &, const FramebufferSet &);
+            void bindInputTextures(RenderLock &);
 
-            virtual void run(RenderLock &, const FramebufferSet &);
+            virtual void run(RenderLock &);
 
-            std::string name() const { return _name; }
+            const std::string & name() const { return _name; }
 
             ShaderBuilder::ShaderSpec shaderSpec;
 
@@ -56,10 +63,50 @@ namespace lab {
             bool clearGbuffer = false;
             bool isQuadPass = false;
             bool drawOpaqueGeometry = false;
+            bool drawDepthPrepass = false;      // opaque geometry into the depth buffer only
+            bool drawShadowCasters = false;     // renders the shadow atlas; see ShadowAtlas.h
+            bool buildDepthPyramid = false;     // of its depth input, for occlusion culling
 
             std::shared_ptr<ModelPart> _fullScreenQuadMesh;
 
+            // Names resolved when the pass graph is compiled, so that
+            // rendering does no lookups by name.
+            struct InputTexture
+            {
+                std::shared_ptr<FrameBuffer> fbo;
+                int attachment;
+                std::string uniformName;
+                int location;       // in the pass's shader, -1 until resolved
+            };
+
+            std::shared_ptr<FrameBuffer> writeFbo;
+            bool writesVisible = true;
+            std::vector<unsigned int> drawBufferTable;
+            std::vector<InputTexture> inputTextures;
+            uint32_t inputProgram = 0;  // the program inputTextures' locations belong to
+
             void prepareFullScreenQuadAndShader(const FramebufferSet&);
+
+            // Makes the pass's shader from its spec, without setting it,
+            // and replaces it; for reloading. See PassRenderer::setHotReload.
+            std::shared_ptr<Shader> makeShader(const FramebufferSet&);
+            std::shared_ptr<Shader> shader() const { return _shader; }
+            void setShader(std::shared_ptr<Shader>);
+            void adoptShader(const Pass &);     // another's shader and quad
+        };
+
+        // The pass list is compiled into a schedule before the first render.
+        // Passes whose outputs never reach the visible buffer, or a persistent
+        // buffer, are culled; buffers no live pass touches are not allocated;
+        // and transient attachments whose lifetimes don't overlap share
+        // textures.
+        struct RenderGraphStats
+        {
+            int passes = 0;
+            int culledPasses = 0;
+            int aliasedTextures = 0;    // textures saved by sharing
+            double requestedBytesPerPixel = 0;     // at a render scale of one
+            double allocatedBytesPerPixel = 0;
         };
 
         LR_API PassRenderer();
@@ -67,7 +114,19 @@ namespace lab {
 
         LR_API void configure(char const*const path);
 
+        // Submits the shader of every scheduled pass at once, for the driver
+        // to compile in parallel, rather than one at a time as the first
+        // frame reaches them. Call after configure with the size of the
+        // first frame; see ShaderBuilder::setAsyncCompile.
+        LR_API void warmUpShaders(v2i fbSize);
+
+        // As above, and the shader of every variant the draw list's models
+        // will draw with in the pipeline's geometry and depth prepasses, so
+        // that drawing the list compiles nothing.
+        LR_API void warmUpShaders(v2i fbSize, const DrawList &);
+
         LR_API virtual std::shared_ptr<Texture> texture(const std::string & name) override;
+        LR_API virtual uint64_t textureGeneration() const override;
 
         LR_API std::shared_ptr<FrameBuffer> framebuffer(const std::string & name);
 
@@ -81,8 +140,73 @@ namespace lab {
 
         LR_API virtual void render(RenderLock & rl, v2i fbSize, DrawList &) override;
 
+        LR_API const RenderGraphStats & renderGraphStats() const;
+
+        // GPU and CPU timings per pass, and per draw bucket for opaque passes.
+        // Opaque and depth prepass passes also count the fragments that pass
+        // the depth test, see PassProfile::overdraw. The profile lags the
+        // current frame by a few frames so that reading back the queries
+        // never stalls.
+        LR_API const FrameProfile & lastFrameProfile() const;
+        LR_API void setProfilingEnabled(bool);
+
+        // writes lastFrameProfile() as Chrome trace JSON
+        LR_API bool saveFrameProfile(char const*const path) const;
+
+        // Scales every offscreen buffer on top of the scales given in the
+        // pipeline; passes drawing to the visible buffer sample them filtered.
+        // Buffers are reallocated from a pool keyed by format and size, so
+        // returning to a recent scale doesn't allocate.
+        LR_API void setRenderScale(float);
+        LR_API float renderScale() const;
+
+        // With a positive target, every pass draws into a fraction of its
+        // buffers chosen to keep the profiled GPU frame time on target, and
+        // the result is stretched over the visible buffer. Only the viewport
+        // changes, so nothing is reallocated. Zero turns it off. Pipelines
+        // opt in with "dynamic_resolution": "yes", which promises that their
+        // quad passes scale texture coordinates by u_renderScale.
+        LR_API void setDynamicResolution(double targetGpuMs, float minScale = 0.5f);
+        LR_API DynamicResolution & dynamicResolution();
+        LR_API float dynamicResolutionScale() const;
+
+        // The draw list's point and spot lights are binned into froxels
+        // each frame that the schedule has a pass that samples light_data,
+        // light_grid or light_indices.
+        LR_API LightClusters & lightClusters();
+
+        // Pipelines with a "shadow-casters" pass render the shadows of spot
+        // lights that cast them into an atlas, registered as shadow_atlas.
+        LR_API ShadowAtlas & shadowAtlas();
+
+        // Pipelines with a "depth-pyramid" pass skip the opaque models that
+        // its pyramid shows were hidden; see OcclusionCuller.h.
+        LR_API OcclusionCuller & occlusionCuller();
+
+        // When on, the models of the draw list that have an occluder mesh
+        // are rasterized on the CPU each frame, and opaque models found to
+        // be behind them are not drawn; see SoftwareOcclusion.h. The
+        // rasterizer and its threads exist only while it is on.
+        LR_API void setSoftwareOcclusion(bool);
+        LR_API SoftwareOcclusion * softwareOcclusion();
+
+        // Streams the mip levels of the pipeline's textures, and of any
+        // texture loaded through it, by the density draws sample them at.
+        LR_API TextureStreamer & textureStreamer();
+
+        // Watches the pipeline, the shader files of its passes and those of
+        // the materials of the models drawn, and reloads what was written
+        // between frames. Passes whose definition or shader files changed,
+        // and models whose shader files did, get new programs; one that
+        // fails to compile keeps its old program. Textures and buffers only
+        // change on a restart, as the models' shaders are made for the
+        // buffers.
+        LR_API void setHotReload(bool);
+        LR_API bool hotReload() const;
+
     private:
         Pass* _findPass(const std::string &) const;
+        void warmUpShaders(v2i fbSize, const DrawList *);
 
         class Detail;
         Detail *_detail;
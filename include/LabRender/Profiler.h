@@ -0,0 +1,78 @@
+//
+//  Profiler.h
+//  LabRender
+//
+//
+
+#pragma once
+
+#include "LabRender/LabRender.h"
+
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+
+// LABRENDER_PROFILING is set by the build; when it is zero the zone macros
+// below expand to nothing and no profiler code is referenced.
+
+#ifndef LABRENDER_PROFILING
+# define LABRENDER_PROFILING 0
+#endif
+
+namespace lab {
+namespace profiler {
+
+    // The timebase is steady_clock, or the time stamp counter on x86 when
+    // LABRENDER_PROFILING_RDTSC is set. ticksPerMs() converts either.
+
+    LR_API uint64_t ticks();
+    LR_API double ticksPerMs();
+
+    // Zone names must be string literals; only the pointer is recorded.
+
+    LR_API void beginZone(const char * name);
+    LR_API void endZone();
+
+    class Zone
+    {
+    public:
+        template <size_t N>
+        explicit Zone(const char (&name)[N]) { beginZone(name); }
+        ~Zone() { endZone(); }
+
+        Zone(const Zone &) = delete;
+        Zone & operator=(const Zone &) = delete;
+    };
+
+    struct ZoneSummary
+    {
+        const char * name = nullptr;
+        int calls = 0;
+        double totalMs = 0;
+        double maxMs = 0;
+    };
+
+    // Collects the events every thread has recorded since the previous mark,
+    // and folds them into the frame summary and, if capturing, the trace.
+    LR_API void frameMark();
+
+    // per zone totals for the frame ending at the last frameMark; a copy,
+    // since the next frameMark may come from another thread
+    LR_API std::vector<ZoneSummary> lastFrameSummary();
+
+    // Capture accumulates events across frames until the trace is written.
+    LR_API void beginCapture();
+    LR_API void endCapture(std::ostream & chromeTraceJson);
+
+} // profiler
+} // lab
+
+#if LABRENDER_PROFILING
+# define LR_PROFILE_CONCAT_(a, b) a##b
+# define LR_PROFILE_CONCAT(a, b) LR_PROFILE_CONCAT_(a, b)
+# define LR_PROFILE_ZONE(name) lab::profiler::Zone LR_PROFILE_CONCAT(_lrProfileZone, __LINE__)(name)
+# define LR_PROFILE_FRAME() lab::profiler::frameMark()
+#else
+# define LR_PROFILE_ZONE(name)
+# define LR_PROFILE_FRAME()
+#endif
@@ -0,0 +1,90 @@
+//
+//  ProgramBinaryCache.h
+//  LabRender
+//
+//
+
+#pragma once
+
+#include "LabRender/LabRender.h"
+
+#include <iosfwd>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace lab {
+
+    struct Shader;
+
+    /**
+        ProgramBinaryCache keeps linked shader programs on disk between runs.
+
+        A program is keyed by a hash of its final generated sources and the
+        GL vendor, renderer and version strings, so a driver update or a
+        different GPU misses rather than loading a binary it can't use. A
+        binary the driver rejects anyway is deleted and the program compiled
+        again. Programs are compiled as usual while no directory is set, or
+        if the driver offers no binary formats.
+
+        Stats separate the time spent compiling from the time spent loading,
+        so that a cold start can be compared with a warm one. The time of an
+        async compile is only that of submitting it.
+     */
+
+    class ProgramBinaryCache
+    {
+    public:
+        struct Stats
+        {
+            int compiled = 0;
+            int loaded = 0;
+            int rejected = 0;       // binaries the driver refused
+            double compileMs = 0;   // compiling, linking and saving
+            double loadMs = 0;
+        };
+
+        // a program made by program(), kept in the order they were asked for
+        struct Program
+        {
+            std::string name;
+            uint64_t key = 0;       // names its binary; 0 while the cache is off
+            bool loaded = false;    // rather than compiled
+        };
+
+        // the directory must exist; empty turns the cache off
+        LR_API void setDirectory(const std::string &);
+        const std::string & directory() const { return _directory; }
+
+        // The program of a vertex and fragment shader, loaded if a binary of
+        // it was saved, otherwise compiled, linked and saved. A program
+        // compiled async is saved once it is finished, see Shader::ready.
+        LR_API std::shared_ptr<Shader> program(const std::string & name,
+                                               const std::string & vertex, const std::string & fragment,
+                                               bool async = false);
+
+        const Stats & stats() const { return _stats; }
+        void resetStats() { _stats = Stats(); }
+
+        const std::vector<Program> & programs() const { return _programs; }
+
+        // Writes the programs made so far as JSON, with the driver and the
+        // file each binary is kept in, to ship alongside a warmed cache.
+        LR_API void writeManifest(std::ostream &) const;
+
+    private:
+        bool available();
+        uint64_t key(const std::string & vertex, const std::string & fragment) const;
+        std::string path(uint64_t key) const;
+        std::shared_ptr<Shader> load(uint64_t key, uint64_t sourceBytes);
+        void save(uint64_t key, uint64_t sourceBytes, const Shader &) const;
+
+        std::string _directory;
+        std::string _driver;    // vendor, renderer and version
+        int _formats = -1;      // binary formats the driver offers, -1 until asked
+        Stats _stats;
+        std::vector<Program> _programs;
+    };
+
+} // lab
@@ -7,12 +7,15 @@
 #pragma once
 
 #include "LabRender/LabRender.h"
+#include "LabRender/AllocationAudit.h"
 #include "LabRender/ConcurrentQueue.h"
+#include "LabRender/FrameArena.h"
+#include "LabRender/FrameFences.h"
+#include "LabRender/Profiler.h"
 #include "LabRender/Texture.h"
 #include "LabRender/ViewMatrices.h"
 
 #include <atomic>
-#include <unordered_map>
 #include <memory>
 #include <mutex>
 #include <vector>
@@ -21,6 +24,12 @@
 namespace lab {
 
     class DrawList;
+    class FrameProfiler;
+    class LightClusters;
+    class OcclusionCuller;
+    class ShadowAtlas;
+    class SoftwareOcclusion;
+    class TextureStreamer;
     struct Texture;
 
     /**
@@ -36,6 +45,9 @@ namespace lab {
         std::string _renderLockerId;
 
         concurrent_queue<std::function<void(void)>> _jobs;
+        FrameFences _frameFences;
+        FrameArena _frameArena;
+        AllocationAudit _allocationAudit;
 
     public:
         class RenderLock;
@@ -44,13 +56,52 @@ namespace lab {
         virtual ~Renderer() {}
 
         virtual std::shared_ptr<Texture> texture(const std::string & name) = 0;
+
+        // changes when texture() may return something different for a name;
+        // see TextureSet::generation
+        virtual uint64_t textureGeneration() const = 0;
         virtual void render(RenderLock & rl, v2i fbSize, DrawList &) = 0;
 
         void enqueCommand(std::function<void(void)> c) 
 		{
-            _jobs.push(c);
+            _jobs.push(std::move(c));
         }
 
+        /**
+         beginFrame and endFrame bracket the work for one frame, so that the
+         CPU can prepare frame N+1 while the GPU is still working on frame N.
+         beginFrame only blocks if framesInFlight() frames are already queued.
+         Call endFrame after the last draw, and before the buffer swap.
+         The frame arena is reset, and the allocation audit window opened,
+         by beginFrame.
+         */
+
+        void beginFrame()
+        {
+            _frameFences.beginFrame();
+            _frameArena.reset();
+            _allocationAudit.beginFrame();
+        }
+
+        void endFrame()
+        {
+            _frameFences.endFrame();
+            _allocationAudit.endFrame();
+            LR_PROFILE_FRAME();
+        }
+
+        void setFramesInFlight(int depth) { _frameFences.setDepth(depth); }
+        int framesInFlight() const        { return _frameFences.depth(); }
+
+        const FrameFences & frameFences() const           { return _frameFences; }
+        const FrameFences::Timings & frameTimings() const { return _frameFences.timings(); }
+
+        // scratch memory valid until the next beginFrame
+        FrameArena & frameArena() { return _frameArena; }
+
+        const AllocationAudit & allocationAudit() const { return _allocationAudit; }
+        AllocationAudit & allocationAudit()             { return _allocationAudit; }
+
 
 
         /**
@@ -70,10 +121,21 @@ namespace lab {
 				DrawList* drawList = nullptr;
 				int activeTextureUnit = 0;
 				v2i framebufferSize = { 0,0 };
+				v2i renderTargetSize = { 0,0 };     // of the buffer the current pass draws to
+				float renderScale = 1.f;            // fraction of each render target drawn this frame
 				v2f mousePosition = { 0,0 };
 				int32_t rootFramebuffer = 0;
+				int frameSlot = 0;      // FrameFences slot for per-frame resources
 				double renderTime = 0;
-				std::unordered_map<std::string, std::shared_ptr<Texture>> boundTextures;
+				int drawCount = 0;      // draws and triangles submitted so far this frame
+				int64_t triangleCount = 0;
+				FrameProfiler* profiler = nullptr;
+				FrameArena* arena = nullptr;   // the renderer's frame arena
+				const LightClusters* lightClusters = nullptr;   // this frame's light assignment, if any
+				ShadowAtlas* shadowAtlas = nullptr;             // rendered by the shadow-casters pass
+				OcclusionCuller* occlusion = nullptr;           // set when a depth-pyramid pass culls opaque geometry
+				const SoftwareOcclusion* softwareOcclusion = nullptr;   // set when occluders are rasterized on the CPU
+				TextureStreamer* textureStreamer = nullptr;     // told the texel density textures are drawn at
 			};
 
 			RenderContext context;
@@ -86,8 +148,13 @@ namespace lab {
                     _dr = dr;
                     context.mousePosition = mousePosition;
                     context.renderTime = renderTime;
+                    context.frameSlot = dr->_frameFences.slot();
+                    context.arena = &dr->_frameArena;
 
-                    // run any queued commands
+                    // run any queued commands; jobs are loads and edits, which
+                    // are allowed to allocate
+                    LR_PROFILE_ZONE("RenderLock::runJobs");
+                    AllowAllocations allow;
                     std::function<void(void)> run;
                     while (dr->_jobs.try_pop(run))
                         run();
@@ -106,26 +173,28 @@ namespace lab {
             bool renderInProgress() const    { return _renderInProgress.load(); }
             void setRenderInProgress(bool p) { _renderInProgress = p; }
 
+            std::shared_ptr<Texture> texture(const std::string & name) const
+            {
+                return _dr ? _dr->texture(name) : std::shared_ptr<Texture>();
+            }
+
+            uint64_t textureGeneration() const
+            {
+                return _dr ? _dr->textureGeneration() : 0;
+            }
+
             bool hasTexture(const std::string & name) const 
 			{
-				return context.boundTextures.find(name) != context.boundTextures.end();
+				return !!texture(name);
             }
 
-            void bindTexture(const std::string & name) 
+            // Looks the texture up every time rather than caching it for the
+            // frame; the renderer's lookup is a map find, and doesn't allocate.
+            void bindTexture(const std::string & name, int unit = 0) 
 			{
-				auto i = context.boundTextures.find(name);
-				if (i != context.boundTextures.end())
-				{
-					i->second->bind();
-					return;
-				}
-
-                std::shared_ptr<Texture> texture = _dr->texture(name);
-				if (!texture)
-					return;
-
-				context.boundTextures[name] = texture;
-                texture->bind();
+                std::shared_ptr<Texture> texture = this->texture(name);
+				if (texture)
+					texture->bind(unit);
             }
         };
 
@@ -62,7 +62,7 @@ namespace lab
 		{
 		public:
 			enum class Draw {
-				None, Quad, OpaqueGeometry,
+				None, Quad, OpaqueGeometry, DepthPrepass, ShadowCasters, DepthPyramid,
 			};
 
 			std::string name;
@@ -89,6 +89,7 @@ namespace lab
 		std::string filepath;
 		std::string name;
 		std::string version;
+		bool dynamic_resolution = false;
 
 		std::vector<Texture> textures;
 		std::vector<Buffer> buffers;
@@ -11,6 +11,9 @@
 #include "LabRender/Renderer.h"
 #include "LabRender/MathTypes.h"
 
+#include <functional>
+#include <string>
+
 namespace lab {
     
     // Use this macro to pass raw GLSL to Shader::shader()
@@ -28,6 +31,16 @@ namespace lab {
         uint32_t id = 0;
         ErrorPolicy errorPolicy;
         std::vector<unsigned int> stages;
+
+        // set before link() so that binary() can return the linked program
+        bool retrievable = false;
+
+        // Set before shader() so that neither it nor link() waits for the
+        // driver; errors are reported when the program is finished.
+        bool async = false;
+
+        // called once the program has linked, whether or not async
+        std::function<void(Shader &)> onLinked;
         
         Shader(ErrorPolicy ep = ErrorPolicy::onErrorThrow) : id(), errorPolicy(ep) {}
         ~Shader();
@@ -35,8 +48,24 @@ namespace lab {
         enum class ProgramType { Vertex = 0, Fragment, Geometry, TessControl, TessEval };
         
         Shader & shader(const std::string & name, ProgramType type, bool autoPreamble, char const*const source);
+
+        // what autoPreamble puts before a source
+        static std::string preamble(const std::string & name);
         
         void link();
+
+        // True once an async program can be used. Drivers with
+        // KHR_parallel_shader_compile are polled; others finish the program
+        // here, waiting for it. finish() always waits.
+        bool ready();
+        void finish();
+
+        // The linked program, in a driver specific format, and a program
+        // made from it in place of shader() and link(). The driver may
+        // reject a binary, such as one saved by another driver version.
+        bool binary(unsigned int & format, std::vector<uint8_t> & data) const;
+        bool loadBinary(unsigned int format, const void * data, size_t bytes);
+
         void bind(Renderer::RenderLock & rl) const;
         void unbind() const;
         
@@ -50,6 +79,31 @@ namespace lab {
         void uniform(const char *name, const v4f &v) const;
         
         void uniform(const char *name, const m44f &m, bool transpose = false) const;
+
+        // setters for locations looked up in advance; -1 is ignored
+        void uniformInt(int location, int i) const;
+        void uniformFloat(int location, float f) const;
+        void uniform(int location, const v2f &v) const;
+        void uniform(int location, const v4f &v) const;
+        void uniform(int location, const m44f &m, bool transpose = false) const;
+
+    private:
+        // The locations of automatics and samplers are looked up on the first
+        // bind, and the textures the samplers name whenever the renderer's
+        // textures have changed since the last bind, so that binding does no
+        // name lookups. automatics and sampledTextures must be complete by
+        // the first bind.
+        void resolve() const;
+        void resolveTextures(Renderer::RenderLock & rl) const;
+
+        bool _pending = false;      // linked async and not yet finished
+        std::vector<std::string> _sources;  // of an async program, for errors
+
+        mutable bool _resolved = false;
+        mutable std::vector<int> _automaticLocations;
+        mutable std::vector<int> _samplerLocations;
+        mutable std::vector<std::shared_ptr<Texture>> _samplerTextures;
+        mutable uint64_t _textureGeneration = 0;    // that _samplerTextures came from
     };
     
 }
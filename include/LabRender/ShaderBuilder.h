@@ -9,7 +9,9 @@
 #pragma once
 
 #include "LabRender/Model.h"
+#include "LabRender/ProgramBinaryCache.h"
 #include "LabRender/SemanticType.h"
+#include <stdint.h>
 #include <vector>
 #include <set>
 #include <string>
@@ -34,20 +36,47 @@ namespace lab {
             std::vector<std::pair<std::string, SemanticType>> varyings;
         };
 
+        // A shader variant; a feature bitmask in the low 16 bits, and a
+        // hash of any source it was given above them.
+        typedef uint64_t VariantKey;
+        static VariantKey variantKey(uint16_t features, uint64_t sourceHash) {
+            return (sourceHash << 16) | features; }
+
+        // Shaders by variant, safe to use from any thread. Keys are spread
+        // over shards with a lock each, so that concurrent lookups rarely
+        // contend.
         class Cache 
 		{
         public:
             Cache();
             ~Cache();
-            bool hasShader(const std::string&) const;
-            void add(const std::string&, std::shared_ptr<Shader>);
-            std::shared_ptr<Shader> shader(const std::string&) const;
+            LR_API std::shared_ptr<Shader> find(VariantKey) const;
+
+            // keeps the shader unless the key has one already, and returns
+            // the one kept
+            LR_API std::shared_ptr<Shader> add(VariantKey, std::shared_ptr<Shader>);
+
+            LR_API size_t size() const;
 
         private:
             class Detail;
             Detail* _detail;
         };
-        static Cache* cache();
+        LR_API static Cache* cache();
+
+        // programs made by makeShader are loaded from and saved to it
+        LR_API static ProgramBinaryCache* binaryCache();
+
+        // A renderer's own program, of sources that need only the preamble
+        // Shader::shader's autoPreamble adds, made through binaryCache() as
+        // makeShader's programs are, and async as they are.
+        LR_API static std::shared_ptr<Shader> makeProgram(const std::string & name,
+                                                          const char* vtxCode, const char* fgmtCode);
+
+        // When on, makeShader returns programs that may still be compiling,
+        // and draws are skipped until Shader::ready(). Off by default.
+        LR_API static void setAsyncCompile(bool);
+        LR_API static bool asyncCompile();
 
         ~ShaderBuilder();
 
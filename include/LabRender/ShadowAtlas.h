@@ -0,0 +1,149 @@
+//
+//  ShadowAtlas.h
+//  LabRender
+//
+//
+
+#pragma once
+
+#include "LabRender/LabRender.h"
+#include "LabRender/FrameBuffer.h"
+#include "LabRender/MathTypes.h"
+#include "LabRender/Renderer.h"
+
+#include <memory>
+#include <vector>
+
+namespace lab {
+
+    class DrawList;
+    class FrameArena;
+    class ModelBase;
+    struct Illuminant;
+    struct Shader;
+
+    /**
+        ShadowAtlas renders the shadow maps of the draw list's shadow casting
+        spot lights into tiles of a single depth texture.
+
+        Each light's tile size follows the size of its sphere of influence on
+        screen, rounded up to a power of two between minTile and maxTile.
+        Tiles are aligned to their size, so the atlas packs like a quadtree.
+
+        A tile is kept from frame to frame while its light keeps the same
+        size, and is only re-rendered when the light moves, or when a model
+        whose bounds overlap the light's frustum, before or after, moves or
+        is added or removed. Geometry that deforms without moving isn't
+        noticed; call invalidate() after editing it. No more than
+        maxUpdatesPerFrame tiles are rendered in a frame, most important
+        first; a postponed tile keeps its previous contents, and the matrix
+        they were rendered with, until its turn comes.
+
+        update() does the bookkeeping without touching GL; render() draws the
+        tiles that need it, and is called by the pipeline's "shadow-casters"
+        pass. Point lights would need six tiles each, and don't cast shadows.
+     */
+
+    class ShadowAtlas
+    {
+    public:
+        struct Settings
+        {
+            int size = 4096;                // of the atlas, in texels
+            int minTile = 128;
+            int maxTile = 1024;
+            float resolutionScale = 1.f;    // tile texels per screen pixel covered
+            int maxUpdatesPerFrame = 4;
+        };
+
+        struct Shadow
+        {
+            const Illuminant * light = nullptr;
+            int x = 0, y = 0, size = 0;     // the tile, in texels
+            float importance = 0;           // screen pixels the light covers
+            m44f viewProj;                  // of the light this frame
+            m44f renderedViewProj;          // that the tile's contents were rendered with
+            bool rendered = false;          // the tile holds a shadow map
+            bool dirty = true;              // the contents are out of date
+            bool renderThisFrame = false;
+
+            // the matrix that maps into the tile's contents once this frame's
+            // tiles are rendered
+            const m44f & samplingViewProj() const { return renderThisFrame ? viewProj : renderedViewProj; }
+        };
+
+        struct Stats
+        {
+            int shadowed = 0;       // lights with a tile
+            int rendered = 0;       // tiles rendered this frame
+            int cached = 0;         // tiles reused as they were
+            int postponed = 0;      // out of date tiles left for a later frame
+            int casterDraws = 0;
+        };
+
+        LR_API ShadowAtlas();
+        LR_API ~ShadowAtlas();
+
+        LR_API void setSettings(const Settings &);
+        const Settings & settings() const { return _settings; }
+
+        // allocates tiles and works out which are out of date; viewport is
+        // the size of the visible buffer, in pixels
+        LR_API void update(const DrawList &, v2i viewport, FrameArena &);
+
+        // draws the out of date tiles; leaves the atlas framebuffer bound
+        LR_API void render(Renderer::RenderLock &);
+
+        // makes the caster program without drawing; see
+        // PassRenderer::warmUpShaders
+        LR_API void prepareShaders();
+
+        // every tile is re-rendered, as the frame budget allows
+        LR_API void invalidate();
+
+        // the shadow of drawList.lights[i] as of the last update, if it has
+        // one that can be sampled
+        LR_API const Shadow * shadow(size_t lightIndex) const;
+
+        // (x, y, size) of a tile in texture coordinates
+        v3f tileRect(const Shadow & s) const
+        {
+            float inv = 1.f / float(_settings.size);
+            return v3f(s.x * inv, s.y * inv, s.size * inv);
+        }
+
+        const std::shared_ptr<Texture> & texture() const { return _texture; }
+        const Stats & stats() const { return _stats; }
+
+    private:
+        struct Caster
+        {
+            const ModelBase * model;
+            m44f transform;
+            Bounds bounds;
+        };
+
+        bool place(int size, int & x, int & y);
+        void occupy(int x, int y, int size);
+        bool isFree(int x, int y, int size) const;
+
+        Settings _settings;
+        Stats _stats;
+
+        std::vector<Shadow> _shadows;
+        std::vector<Shadow> _previous;
+        std::vector<int> _lightShadow;      // per draw list light, index into _shadows or -1
+        std::vector<Caster> _casters;       // sorted by model
+        std::vector<Caster> _previousCasters;
+        std::vector<uint8_t> _cells;        // minTile cells in use this frame
+        int _cellsPerRow = 0;
+        bool _invalidated = true;
+
+        std::shared_ptr<Texture> _texture;
+        FrameBuffer _fbo;
+        int _fboSize = 0;
+        std::shared_ptr<Shader> _shader;
+        int _mvpLocation = -1;
+    };
+
+} // lab
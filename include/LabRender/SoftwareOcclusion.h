@@ -0,0 +1,124 @@
+//
+//  SoftwareOcclusion.h
+//  LabRender
+//
+//
+
+#pragma once
+
+#include "LabRender/LabRender.h"
+#include "LabRender/MathTypes.h"
+#include "LabRender/WorkerPool.h"
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+namespace lab {
+
+    class DrawList;
+    class ModelPart;
+
+    // Triangles in model space standing in for a model as an occluder. An
+    // occluder must lie within what it stands for, or what is behind it
+    // could be culled where the model doesn't actually cover it.
+    struct OccluderMesh
+    {
+        std::vector<v3f> positions;
+        std::vector<uint32_t> indices;      // three per triangle
+
+        // copies the positions and indices of a part's vertex data, which
+        // are expected to be simplified already
+        LR_API static std::shared_ptr<OccluderMesh> fromModelPart(const ModelPart &);
+    };
+
+    /**
+        SoftwareOcclusion rasterizes the occluders of a draw list into a
+        small depth buffer on the CPU, and culls the opaque models whose
+        bounds are wholly behind it, before any GL calls are made.
+
+        The buffer is split into tiles. Occluder triangles are clipped to
+        the near plane and binned to the tiles they overlap; then each tile
+        is rasterized whole by one thread, so no locks are taken and the
+        result is the same whatever the thread count. Rows are rasterized
+        four pixels at a time with SSE2 where it is available.
+
+        Coverage is sampled at pixel centers, and a covered pixel keeps the
+        farthest depth of the triangle over the pixel. A bounds test covers
+        every pixel its rectangle touches and a pixel around them, as an
+        occluder's edge may cover a pixel center without covering the whole
+        pixel, and a model is culled only when its nearest depth is behind
+        all of them. Being drawn from the current view, no draw needs to be
+        retested. A gap between occluders narrower than a pixel of the
+        buffer may be taken as closed.
+     */
+
+    class SoftwareOcclusion
+    {
+    public:
+        enum : int {
+            Width = 256, Height = 128,
+            TileWidth = 32, TileHeight = 32,
+            TilesX = Width / TileWidth, TilesY = Height / TileHeight
+        };
+
+        struct Stats
+        {
+            int occluders = 0;
+            int triangles = 0;      // after clipping
+            int tested = 0;
+            int culled = 0;
+        };
+
+        // workers in addition to the calling thread; negative picks from
+        // the hardware
+        LR_API explicit SoftwareOcclusion(int workers = -1);
+
+        // Rasterizes the occluders of drawList.deferredMeshes and tests the
+        // bounds of every mesh against them.
+        LR_API void update(const DrawList &);
+
+        bool culled(size_t meshIndex) const { return meshIndex < _culled.size() && _culled[meshIndex]; }
+
+        // the steps of update, to rasterize occluders of one's own
+        LR_API void begin(const m44f & viewProj);
+        LR_API void addOccluder(const OccluderMesh &, const m44f & model);
+        LR_API void rasterize();
+
+        // true if the bounds are hidden behind the rasterized occluders
+        LR_API bool occluded(const m44f & model, const Bounds & local) const;
+
+        // window depth at a pixel, y up; 1 where nothing was drawn
+        LR_API float depth(int x, int y) const;
+
+        int workerCount() const { return _pool.workerCount(); }
+        const Stats & stats() const { return _stats; }
+
+    private:
+        // edge functions and depth plane over pixel centers
+        struct Triangle
+        {
+            float edge[3][3];           // a * x + b * y + c, >= 0 inside
+            float z0, dzdx, dzdy;       // at the origin, plus half a pixel of slope
+            float zmax;
+            int x0, y0, x1, y1;         // pixel bounds, inclusive
+        };
+
+        void setup(const v4f * clip);
+        void rasterizeTile(int tile);
+
+        m44f _viewProj;
+        Stats _stats;
+        bool _rasterized = false;
+
+        std::vector<float> _depth;          // tile after tile, rows within a tile
+        float _tileMax[TilesX * TilesY];
+        std::vector<Triangle> _triangles;
+        std::vector<v4f> _clip;             // an occluder's positions in clip space
+        std::vector<uint32_t> _bins[TilesX * TilesY];
+        std::vector<uint8_t> _culled;
+
+        WorkerPool _pool;
+    };
+
+} // lab
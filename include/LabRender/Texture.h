@@ -17,9 +17,22 @@
 
 namespace lab {
 
+    struct TextureImage;
+    class TextureStreamer;
+
     struct Texture
     {
-        static size_t pixelByteSize(TextureType);
+        static size_t pixelByteSize(TextureType);   // zero for block compressed types
+
+        static bool isCompressed(TextureType);
+
+        // false for block compressed types the GL context can't sample: bc1
+        // and bc3 need EXT_texture_compression_s3tc, and bc7 GL 4.2 or
+        // ARB_texture_compression_bptc
+        static bool isSupported(TextureType);
+
+        // the bytes of an image, rounded up to whole blocks when compressed
+        static size_t imageByteSize(TextureType, int w, int h);
 
         enum class Role {
             texture2d, textureDepth, textureCube };
@@ -47,16 +60,21 @@ namespace lab {
         Texture & create(int w, int h, TextureType resultType, int filter, int wrap, TextureType srcDataType, void *data);
         Texture & create(int w, int h, int depth, TextureType resultType, int filter, int wrap, TextureType srcDataType, void *data);
 
+        // a 2d texture with every level of the image; a mipmapped image
+        // is minified between its levels too
+        Texture & create(const TextureImage &, int filter, int wrap);
+
         // create a depth texture
         Texture & createDepth(int w, int h);
 
-        // cube from faces
+        // cube from faces; faces with data are mipmapped, with the color of
+        // sRGB u8 faces filtered in linear light
         Texture & createCube(int w, int h, TextureType resultType, int filter, int wrap, TextureType srcDataType,
-                             void* px, void* nx, void* py, void* ny, void* pz, void* nz);
+                             void* px, void* nx, void* py, void* ny, void* pz, void* nz, bool srgb = true);
 
         enum class CubeImageDataType { vstrip };
         Texture & createCube(int w, int h, TextureType resultType, int filter, int wrap, TextureType srcDataType,
-                             CubeImageDataType cubeType, void* image);
+                             CubeImageDataType cubeType, void* image, bool srgb = true);
 
         // offset is the texel offset in the texture where the data will be copied
         // format is the format of the supplied pixel data, see ibid
@@ -64,6 +82,13 @@ namespace lab {
         // todo should be Type srcDataType, not glType
         Texture & update(int xoffset, int yoffset, int width, int height, int format, int glType, void* data);
 
+        // sets the min and mag filter, eg GL_NEAREST
+        Texture & setFilter(int filter);
+
+        // builds the mips below the first level on the GPU, and minifies
+        // between them with a filter
+        Texture & generateMipmaps(int filter);
+
         // copy the texture data
         std::vector<uint8_t> get();
 
@@ -71,18 +96,28 @@ namespace lab {
     };
 
 
+    // The generation changes whenever a texture is added or replaced, and
+    // is never shared by two sets, so that a lookup cached against one
+    // generation can tell when it is stale.
+    LR_API uint64_t nextTextureSetGeneration();
+
     class TextureSet {
     public:
+        TextureSet() : _generation(nextTextureSetGeneration()) {}
+
         void add_texture(const std::string & id, std::shared_ptr<Texture> t) {
             _textures[id] = t;
+            _generation = nextTextureSetGeneration();
         }
         std::shared_ptr<Texture> texture(const std::string & id) const {
             auto t = _textures.find(id);
             return t != _textures.end()? t->second : std::shared_ptr<Texture>();
         }
+        uint64_t generation() const { return _generation; }
 
     private:
         std::map<std::string, std::shared_ptr<Texture>> _textures;
+        uint64_t _generation;
     };
 
 
@@ -94,9 +129,16 @@ namespace lab {
 
     /// @TUDO should also have a cube texture provider
 
+    // Loads a DDS or KTX2 container with its compressed mips, or any image
+    // stb_image decodes, and builds its mips; an sRGB image is filtered in
+    // linear light. The path alone decodes and uploads before the
+    // constructor returns; given a streamer, the texture is its placeholder
+    // until the streamer's workers have decoded the file and its update has
+    // uploaded it, with the streamer's srgb setting.
     class FileTextureProvider : public TextureProvider {
     public:
-        FileTextureProvider(const std::string & path);
+        FileTextureProvider(const std::string & path, bool srgb = true);
+        FileTextureProvider(TextureStreamer &, const std::string & path);
         virtual ~FileTextureProvider() {}
         virtual std::shared_ptr<Texture> texture() const override { return _texture; }
 
@@ -0,0 +1,58 @@
+//
+//  TextureImage.h
+//  LabRender
+//
+//
+
+#pragma once
+
+#include "LabRender/LabRender.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace lab {
+
+    /**
+        TextureImage is a 2d texture's image in memory with its mip chain, as
+        read from a file or on its way to one.
+
+        Block compressed images come from DDS and KTX2 containers, which hold
+        the mip chain computed offline, and so upload in a quarter to an
+        eighth of the bytes of u8x4. Other image files are decoded by
+        stb_image to a single u8x4 level.
+     */
+    struct TextureImage
+    {
+        TextureType type = TextureType::none;
+        int width = 0;
+        int height = 0;
+        std::vector<std::vector<uint8_t>> levels;   // finest first; each half the last, to 1x1
+    };
+
+    // Sets stb_image's global options for the images read here: colors
+    // unpremultiplied, and iPhone PNGs converted to RGB. Only the first
+    // call sets them, so call it before any thread may be decoding.
+    LR_API void initImageDecoding();
+
+    // Reads a DDS or KTX2 container of bc1, bc3, bc5 or bc7 levels, or else
+    // decodes the file with stb_image, as set by initImageDecoding. False
+    // if it can't be read.
+    LR_API bool readTextureImage(const std::string & path, TextureImage &);
+
+    // Writes a block compressed image to a DDS container with a DX10 header.
+    LR_API bool writeDDS(const std::string & path, const TextureImage &);
+
+    // Fills in the mip chain of an image from its first level with a 2x2
+    // box filter, splitting the larger levels across a number of threads;
+    // negative picks from the hardware. The color of sRGB u8 images is
+    // averaged in linear light. False for types that can't be filtered
+    // here, s8 and block compressed, which keep their one level.
+    LR_API bool buildMipChain(TextureImage &, bool srgb = false, int threads = 1);
+
+    // Encodes every level of a u8x4 image to a block compressed type. bc1
+    // keeps alpha as a one bit cut out, and bc5 keeps red and green.
+    LR_API TextureImage compressTextureImage(const TextureImage &, TextureType);
+
+} // lab
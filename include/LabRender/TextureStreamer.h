@@ -0,0 +1,162 @@
+//
+//  TextureStreamer.h
+//  LabRender
+//
+//
+
+#pragma once
+
+#include "LabRender/LabRender.h"
+#include "LabRender/MathTypes.h"
+#include "LabRender/TextureImage.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace lab {
+
+    struct Texture;
+
+    /**
+        TextureStreamer keeps the mip levels of file textures resident on the
+        GPU as draws need them, within a memory budget.
+
+        A streamed texture is read, and the mip chain of an image that has
+        none built, on a worker thread, while the texture stands in as a 1x1 placeholder;
+        loading returns at once, so many textures decode in parallel. The
+        chain is kept in system memory, and once decoded only its levels no
+        larger than residentSize are uploaded. Draws report the texel
+        density they sample a texture at, from which the finest level they
+        need follows; update()
+        uploads the missing levels, one level per texture per frame and no
+        more than uploadBytesPerFrame in all, and bounds each texture to its
+        finest resident level with GL_TEXTURE_BASE_LEVEL. Levels are defined
+        and freed one at a time on the texture's own GL object, so bindings
+        never change. Uploads are staged through a pixel buffer object that
+        is orphaned each time, so that the copy to the texture doesn't wait
+        for the previous one.
+
+        When a level doesn't fit the budget, the finest levels of the least
+        recently used textures that weren't needed in the last frame are
+        freed first. A request that can't be made room for waits, and is
+        counted as pending. A texture drawn coarser than it was wanted is a
+        miss. The levels below residentSize are never freed.
+     */
+
+    class TextureStreamer
+    {
+    public:
+        struct Settings
+        {
+            int64_t budgetBytes = 256 * 1024 * 1024;        // of streamed levels on the GPU
+            int64_t uploadBytesPerFrame = 8 * 1024 * 1024;  // at least one level is uploaded
+            int residentSize = 64;          // levels no larger are always resident
+            bool srgb = true;               // decoded images hold sRGB color, mipmapped in linear light
+        };
+
+        struct Stats
+        {
+            int textures = 0;
+            int64_t residentBytes = 0;
+            int pendingRequests = 0;    // levels wanted but not resident after the update
+            int misses = 0;             // textures drawn coarser than wanted in the last frame
+            int uploads = 0;            // levels uploaded by the update
+            int evictions = 0;          // levels freed by the update
+            int decoding = 0;           // loads not yet decoded and uploaded
+        };
+
+        // decoding threads; negative picks from the hardware
+        LR_API explicit TextureStreamer(int workers = -1);
+        LR_API ~TextureStreamer();
+
+        LR_API void setSettings(const Settings &);
+        const Settings & settings() const { return _settings; }
+
+        // A 1x1 placeholder, which becomes the image of the file once a
+        // worker has read it, as a block compressed container or decoded
+        // to RGBA8 with its mip chain, and an update has uploaded the levels
+        // no larger than residentSize. A file that can't be read leaves the
+        // placeholder.
+        LR_API std::shared_ptr<Texture> load(const std::string & path);
+
+        // Feedback from a draw sampling a texture at a number of texels of
+        // its finest level per screen pixel. Textures that aren't streamed
+        // are ignored.
+        LR_API void request(const Texture &, float texelsPerPixel);
+
+        // The texel density of a texture spread once over bounds, seen
+        // through a model view and a projection in a render target.
+        LR_API static float texelDensity(const Texture &, const Bounds & local,
+                                         const m44f & modelView, const m44f & projection, v2i renderTarget);
+
+        // Call once a frame, before drawing, with the GL context current;
+        // uploads finished decodes, and acts on the requests of the
+        // previous frame.
+        LR_API void update();
+
+        int workerCount() const { return int(_threads.size()); }
+
+        const Stats & stats() const { return _stats; }
+
+    private:
+        struct Entry
+        {
+            std::weak_ptr<Texture> texture;
+            std::vector<std::vector<uint8_t>> mips;     // finest first
+            std::vector<v2i> sizes;
+            TextureType type = TextureType::none;
+            int floor = 0;          // the finest level always resident
+            int resident = 0;       // the finest level resident
+            int wanted = 0;         // the finest level requested in the frame
+            uint64_t lastUsed = 0;  // frame
+            uint64_t missed = 0;    // frame of the last miss
+            uint64_t serial = 0;    // tells a reused address apart
+        };
+
+        // a load, from the file to the mip chain
+        struct Decode
+        {
+            const Texture * key = nullptr;
+            uint64_t serial = 0;
+            std::string path;
+            bool srgb = true;
+            TextureImage image;
+        };
+
+        static void decode(Decode &);
+        void work();
+        void finish(Decode &);
+
+        int64_t levelBytes(const Entry &, int level) const;
+        void upload(Entry &, int level);
+        void evict(Entry &);
+        bool makeRoom(int64_t bytes, const Entry * requester);
+
+        Settings _settings;
+        Stats _stats;
+        std::unordered_map<const Texture *, Entry> _entries;
+        std::vector<Entry *> _wanting;      // kept to reuse its storage
+        int64_t _residentBytes = 0;
+        uint64_t _frame = 1;
+        int _misses = 0;
+        uint64_t _serial = 0;
+        unsigned int _pbo = 0;
+
+        std::vector<std::thread> _threads;
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::deque<Decode> _queue;
+        std::vector<Decode> _decoded;       // done, for the next update
+        std::vector<Decode> _finishing;     // swapped with _decoded to reuse its storage
+        int _decoding = 0;
+        bool _quit = false;
+    };
+
+} // lab
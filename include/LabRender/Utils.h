@@ -10,6 +10,7 @@
 
 #include <LabRender/LabRender.h>
 #include <string>
+#include <vector>
 
 namespace lab {
 
@@ -20,5 +21,35 @@ namespace lab {
     
     LR_API std::string loadFile(char const*const path, bool errorIfNotFound = true);
     LR_API std::string expandPath(char const*const path);
+
+    /**
+        FileWatcher reports the files written since it was last polled.
+
+        On Linux the directories of the watched files are watched with
+        inotify, so that a file an editor replaces by renaming another over
+        it is still seen; elsewhere each poll compares the files' sizes and
+        modification times. Polling never blocks.
+     */
+
+    class FileWatcher
+    {
+    public:
+        LR_API FileWatcher();
+        LR_API ~FileWatcher();
+
+        // watches a file, named by its expanded path
+        LR_API void watch(const std::string & path);
+        LR_API void clear();
+
+        // the watched files written since the last poll, each once
+        LR_API std::vector<std::string> poll();
+
+    private:
+        FileWatcher(const FileWatcher &) = delete;
+        FileWatcher & operator=(const FileWatcher &) = delete;
+
+        class Detail;
+        Detail * _detail;
+    };
 }
 
@@ -147,6 +147,9 @@ namespace lab {
         //
 		LR_API VAO & setVertices(std::shared_ptr<BufferBase> vbo);
 		LR_API VAO & setIndices(std::shared_ptr<IndexBuffer> ibo);
+
+        const BufferBase * vertices() const { return _vertices.get(); }
+        const IndexBuffer * indices() const { return _indices.get(); }
         
         // Define an attribute called name in the provided shader. This attribute
         // has count elements of type T. If normalized is true, integer types are
@@ -170,6 +173,9 @@ namespace lab {
 
         // Draw the attached VBOs using instancing
 		LR_API void drawInstanced(int instances) const;
+
+        // Number of triangles submitted by draw()
+		LR_API size_t triangleCount() const;
         
         // to be called when the data has been modified
 		LR_API bool uploadVerts() const;
@@ -0,0 +1,66 @@
+//
+//  WorkerPool.h
+//  LabRender
+//
+//
+
+#pragma once
+
+#include "LabRender/LabRender.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace lab {
+
+    /**
+        WorkerPool runs the items of a batch on the calling thread and a few
+        worker threads at once. Each thread claims the next unclaimed item
+        until none are left, so the items may be taken in any order and by
+        any thread; run returns once every item has finished.
+
+        The workers are started by the first run that has items for them,
+        and wait between runs without spinning. A run neither allocates nor
+        copies the task, so it may be called every frame.
+     */
+
+    class WorkerPool
+    {
+    public:
+        // workers in addition to the calling thread; negative picks from
+        // the hardware
+        LR_API explicit WorkerPool(int workers = -1);
+        LR_API ~WorkerPool();
+
+        WorkerPool(const WorkerPool &) = delete;
+        WorkerPool & operator=(const WorkerPool &) = delete;
+
+        // calls task(i) for every i in [0, count), and waits for them all
+        LR_API void run(int count, const std::function<void(int)> & task);
+
+        int workerCount() const { return _workers; }
+
+    private:
+        void work();
+        void claim();
+
+        int _workers = 0;
+        std::vector<std::thread> _threads;
+        std::mutex _mutex;
+        std::condition_variable _wake, _done;
+        uint64_t _generation = 0;
+        int _busy = 0;
+        bool _quit = false;
+
+        // the batch of the current run
+        const std::function<void(int)> * _task = nullptr;
+        int _count = 0;
+        std::atomic<int> _next;
+    };
+
+} // lab
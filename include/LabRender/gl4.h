@@ -35,6 +35,7 @@
 #include <math.h>
 
 #include "LabRender/ErrorPolicy.h"
+#include "LabRender/GLState.h"
 #include "LabRender/SemanticType.h"
 #include "LabRender/Texture.h"
 #include "LabRender/MathTypes.h"
@@ -104,13 +105,13 @@ template <> struct TypeToOpenGL<unsigned short> { enum { value = GL_UNSIGNED_SHO
 class CaptureFrameBuffer {
 public:
     CaptureFrameBuffer()  { glGetIntegerv(GL_FRAMEBUFFER_BINDING, &currFramebuffer); }
-    ~CaptureFrameBuffer() { glBindFramebuffer(GL_FRAMEBUFFER, currFramebuffer); }
+    ~CaptureFrameBuffer() { lab::glState().bindFramebuffer(GL_FRAMEBUFFER, currFramebuffer); }
     GLint currFramebuffer;
 };
 class CaptureTexture2DBinding {
 public:
     CaptureTexture2DBinding()  { glGetIntegerv(GL_TEXTURE_BINDING_2D, &currentTextureBinding); }
-    ~CaptureTexture2DBinding() { glBindTexture(GL_TEXTURE_2D, currentTextureBinding); }
+    ~CaptureTexture2DBinding() { glBindTexture(GL_TEXTURE_2D, currentTextureBinding); lab::glState().invalidate(); }
     GLint currentTextureBinding;
 };
 
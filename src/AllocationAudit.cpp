@@ -0,0 +1,100 @@
+//
+//  AllocationAudit.cpp
+//  LabRender
+//
+//
+
+#include "LabRender/AllocationAudit.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifndef LABRENDER_ALLOCATION_AUDIT
+# define LABRENDER_ALLOCATION_AUDIT 0
+#endif
+
+namespace {
+    thread_local uint64_t t_allocations = 0;
+    thread_local int t_allowed = 0;
+}
+
+#if LABRENDER_ALLOCATION_AUDIT
+
+// Every replaceable form is defined, so that no allocation can reach the
+// default operator new and then be released by the replaced delete.
+
+namespace {
+    void * auditedAlloc(size_t size)
+    {
+        if (!t_allowed)
+            ++t_allocations;
+        return std::malloc(size ? size : 1);
+    }
+}
+
+void * operator new(size_t size)
+{
+    void * p = auditedAlloc(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void * operator new[](size_t size)
+{
+    void * p = auditedAlloc(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void * operator new(size_t size, const std::nothrow_t &) noexcept   { return auditedAlloc(size); }
+void * operator new[](size_t size, const std::nothrow_t &) noexcept { return auditedAlloc(size); }
+
+void operator delete(void * p) noexcept                            { std::free(p); }
+void operator delete[](void * p) noexcept                          { std::free(p); }
+void operator delete(void * p, const std::nothrow_t &) noexcept    { std::free(p); }
+void operator delete[](void * p, const std::nothrow_t &) noexcept  { std::free(p); }
+void operator delete(void * p, size_t) noexcept                    { std::free(p); }
+void operator delete[](void * p, size_t) noexcept                  { std::free(p); }
+
+#endif
+
+namespace lab {
+
+    bool allocationAuditEnabled()
+    {
+        return LABRENDER_ALLOCATION_AUDIT != 0;
+    }
+
+    uint64_t threadAllocationCount()
+    {
+        return t_allocations;
+    }
+
+    AllowAllocations::AllowAllocations()  { ++t_allowed; }
+    AllowAllocations::~AllowAllocations() { --t_allowed; }
+
+    void AllocationAudit::beginFrame()
+    {
+        if (!allocationAuditEnabled())
+            return;
+        _mark = t_allocations;
+        _inFrame = true;
+    }
+
+    void AllocationAudit::endFrame()
+    {
+        if (!_inFrame)
+            return;
+        _inFrame = false;
+        _lastFrame = t_allocations - _mark;
+        if (++_frames > _warmUpFrames && _lastFrame) {
+            char message[96];
+            snprintf(message, sizeof(message), "%d heap allocations in steady state frame %d", int(_lastFrame), _frames);
+            reportError(_policy, "allocation audit", message);
+        }
+    }
+
+} // lab
@@ -0,0 +1,74 @@
+//
+//  DynamicResolution.cpp
+//  LabRender
+//
+//
+
+#include "LabRender/DynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace lab {
+
+    void DynamicResolution::setSettings(const Settings & s)
+    {
+        _settings = s;
+        _settings.minScale = std::min(1.f, std::max(0.1f, s.minScale));
+        _settings.maxScale = std::min(1.f, std::max(_settings.minScale, s.maxScale));
+        _settings.step = std::max(0.01f, s.step);
+        _scale = quantize(_scale);
+    }
+
+    void DynamicResolution::reset(float scale)
+    {
+        _scale = quantize(scale);
+        _smoothedMs = 0;
+        _over = _under = 0;
+        _hasMeasurement = false;
+    }
+
+    float DynamicResolution::quantize(float scale) const
+    {
+        // round down, so that a shrink always lands under the estimate
+        float q = std::floor(scale / _settings.step + 1e-4f) * _settings.step;
+        return std::min(_settings.maxScale, std::max(_settings.minScale, q));
+    }
+
+    bool DynamicResolution::update(uint64_t frame, double gpuMs, uint64_t nextFrame)
+    {
+        if (frame < _settleFrame || gpuMs <= 0 || _settings.targetMs <= 0)
+            return false;
+
+        if (!_hasMeasurement) {
+            _smoothedMs = gpuMs;
+            _hasMeasurement = true;
+        }
+        else
+            _smoothedMs += (gpuMs - _smoothedMs) * _settings.smoothing;
+
+        const double target = _settings.targetMs;
+        _over = gpuMs > target * _settings.dropAbove ? _over + 1 : 0;
+        _under = _smoothedMs < target * _settings.raiseBelow ? _under + 1 : 0;
+
+        float scale = _scale;
+        if (_over >= _settings.dropFrames) {
+            // GPU time goes roughly with the pixel count, the square of the
+            // scale; aim for the budget in one move, but at least one step
+            float estimate = _scale * float(std::sqrt(target / std::max(gpuMs, _smoothedMs)));
+            scale = quantize(std::min(estimate, _scale - _settings.step));
+        }
+        else if (_under >= _settings.raiseFrames)
+            scale = quantize(_scale + _settings.step);
+
+        if (scale == _scale)
+            return false;
+
+        _scale = scale;
+        _over = _under = 0;
+        _hasMeasurement = false;
+        _settleFrame = nextFrame;
+        return true;
+    }
+
+} // lab
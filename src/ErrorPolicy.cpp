@@ -9,10 +9,62 @@
 #include "LabRender/ErrorPolicy.h"
 #include "LabRender/gl4.h"
 
+#include <atomic>
+#include <mutex>
+#include <string>
+
 namespace lab {
     
     namespace {
         TestConditions _activeConditions = TestConditions::allErrors;
+
+        std::atomic<uint64_t> _checkCount(0);
+        std::atomic<bool> _debugOutput(false);
+
+        // the first error reported by the debug callback since the last check
+        std::mutex _pendingLock;
+        std::string _pendingMessage;
+        bool _pending = false;
+
+#ifdef GL_DEBUG_OUTPUT
+        void GLAPIENTRY debugCallback(GLenum, GLenum, GLuint, GLenum,
+                                      GLsizei length, const GLchar* message, const void*)
+        {
+            std::lock_guard<std::mutex> lock(_pendingLock);
+            if (_pending)
+                return;
+            _pending = true;
+            if (length < 0)
+                _pendingMessage.assign(message);
+            else
+                _pendingMessage.assign(message, length);
+        }
+#endif
+
+        Error report(ErrorPolicy errorPolicy, char const*const what, char const*const error, char const*const source)
+        {
+            printf("LabRender GL error report");
+            printf("----- %s -----\n", what);
+            if (error) {
+                printf("%s\n", error);
+            }
+            if (source) {
+                printf("----- source code -----\n");
+                printf("%s\n", source);
+            }
+            switch (errorPolicy) {
+                case ErrorPolicy::onErrorLog:
+                    break;
+                    
+                case ErrorPolicy::onErrorExit:
+                    exit(0);
+                    
+                case ErrorPolicy::onErrorThrow:
+                case ErrorPolicy::onErrorLogThrow:
+                    throw std::runtime_error(error? error:"error");
+            }
+            return Error::errorRaised;
+        }
     }
     
     TestConditions activeConditions() {
@@ -61,37 +113,92 @@ namespace lab {
     }
 
     
+    Error reportError(ErrorPolicy errorPolicy, char const*const what, char const*const error)
+    {
+        return report(errorPolicy, what, error, nullptr);
+    }
+
     Error handleGLError(ErrorPolicy errorPolicy, int glErr, char const*const error, char const*const source)
     {
-        if (glErr != GL_NO_ERROR) {
-            printf("LabRender GL error report");
-            printf("----- %s -----\n", glEnumString(glErr));
-            if (error) {
-                printf("%s\n", error);
-            }
-            if (source) {
-                printf("----- source code -----\n");
-                printf("%s\n", source);
-            }
-            switch (errorPolicy) {
-                case ErrorPolicy::onErrorLog:
-                    break;
-                    
-                case ErrorPolicy::onErrorExit:
-                    exit(0);
-                    
-                case ErrorPolicy::onErrorThrow:
-                case ErrorPolicy::onErrorLogThrow:
-                    throw std::runtime_error(error? error:"error");
-            }
-        }
+        if (glErr != GL_NO_ERROR)
+            report(errorPolicy, glEnumString(glErr), error, source);
         return Error::errorRaised;
     }
     
     Error handleError(ErrorPolicy errorPolicy, char const*const error, char const*const source)
     {
+        _checkCount.fetch_add(1, std::memory_order_relaxed);
+
+        if (_debugOutput.load(std::memory_order_relaxed)) {
+            std::string message;
+            {
+                std::lock_guard<std::mutex> lock(_pendingLock);
+                if (!_pending)
+                    return Error::errorNone;
+                message.swap(_pendingMessage);
+                _pending = false;
+            }
+            return report(errorPolicy, message.c_str(), error, source);
+        }
+
         return handleGLError(errorPolicy, glGetError(), error, source);
     }
-    
+
+    bool enableDebugOutput(bool synchronous)
+    {
+#ifdef GL_DEBUG_OUTPUT
+# if defined(PLATFORM_WINDOWS)
+        if (!GLEW_KHR_debug)
+            return false;
+# endif
+        glDebugMessageCallback(debugCallback, nullptr);
+
+        // only errors are of interest here; performance and portability
+        // chatter would otherwise flood the callback
+        glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_FALSE);
+        glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_ERROR, GL_DONT_CARE, 0, nullptr, GL_TRUE);
+
+        glEnable(GL_DEBUG_OUTPUT);
+        if (synchronous)
+            glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+        else
+            glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+
+        // anything raised before the callback was installed is still in the
+        // error queue, clear it so it isn't lost silently
+        GLenum err = glGetError();
+        if (err != GL_NO_ERROR) {
+            std::lock_guard<std::mutex> lock(_pendingLock);
+            _pending = true;
+            _pendingMessage = glEnumString(err);
+        }
+
+        _debugOutput = true;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void disableDebugOutput()
+    {
+#ifdef GL_DEBUG_OUTPUT
+        if (!_debugOutput)
+            return;
+        glDisable(GL_DEBUG_OUTPUT);
+        glDebugMessageCallback(nullptr, nullptr);
+        _debugOutput = false;
+#endif
+    }
+
+    bool debugOutputEnabled()
+    {
+        return _debugOutput;
+    }
+
+    uint64_t errorCheckCount()
+    {
+        return _checkCount.load(std::memory_order_relaxed);
+    }
 
 } //lab
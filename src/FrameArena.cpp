@@ -0,0 +1,70 @@
+//
+//  FrameArena.cpp
+//  LabRender
+//
+//
+
+#include "LabRender/FrameArena.h"
+
+#include <cstdint>
+
+namespace lab {
+
+    FrameArena::FrameArena(size_t capacity)
+    {
+        if (capacity)
+            addBlock(capacity);
+    }
+
+    FrameArena::~FrameArena()
+    {
+        for (auto & b : _blocks)
+            delete [] b.data;
+    }
+
+    void FrameArena::addBlock(size_t size)
+    {
+        _blocks.push_back(Block{ new char[size], size });
+        _cursor = _blocks.back().data;
+        _end = _cursor + size;
+        _capacity += size;
+    }
+
+    void * FrameArena::allocate(size_t bytes, size_t align)
+    {
+        uintptr_t p = (reinterpret_cast<uintptr_t>(_cursor) + align - 1) & ~uintptr_t(align - 1);
+        if (!_cursor || p + bytes > reinterpret_cast<uintptr_t>(_end)) {
+            // the overflow block is at least as big as everything so far, so
+            // a frame that keeps growing chains only a few blocks
+            size_t size = bytes + align;
+            if (size < _capacity)
+                size = _capacity;
+            addBlock(size);
+            p = (reinterpret_cast<uintptr_t>(_cursor) + align - 1) & ~uintptr_t(align - 1);
+        }
+        _used += bytes;
+        _cursor = reinterpret_cast<char *>(p + bytes);
+        return reinterpret_cast<void *>(p);
+    }
+
+    void FrameArena::reset()
+    {
+        if (_used > _highWater)
+            _highWater = _used;
+
+        if (_blocks.size() > 1) {
+            size_t size = _capacity;
+            for (auto & b : _blocks)
+                delete [] b.data;
+            _blocks.clear();
+            _capacity = 0;
+            addBlock(size);
+        }
+        else if (!_blocks.empty()) {
+            _cursor = _blocks[0].data;
+            _end = _cursor + _blocks[0].size;
+        }
+        _used = 0;
+    }
+
+} // lab
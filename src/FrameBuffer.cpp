@@ -8,6 +8,8 @@
 #include "LabRender/FrameBuffer.h"
 #include "LabRender/gl4.h"
 #include "LabRender/Texture.h"
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
 
 using namespace std;
@@ -29,15 +31,17 @@ namespace lab {
     FrameBuffer::~FrameBuffer()
     {
         if (id)
-             glDeleteFramebuffers(1, &id);
+             glState().deleteFramebuffer(id);
 
         if (renderbuffer)
             glDeleteRenderbuffers(1, &renderbuffer);
     }
 
-    void FrameBuffer::create(const FrameBufferSpec & spec, int width, int height)
+    void FrameBuffer::create(const FrameBufferSpec & spec, int width, int height,
+                             const std::vector<std::shared_ptr<Texture>> & shared)
     {
         textures.clear();
+        depthTextureAttached = false;
         if (!spec.attachments.size()) {
             // special case; no attachments means the default frame buffer
             return;
@@ -46,19 +50,29 @@ namespace lab {
         textures.reserve(spec.attachments.size() + (spec.hasDepth ? 1 : 0));
 
         try {
-            for (int i = 0; i < spec.attachments.size(); ++i) {
-                textures.emplace_back(std::make_shared<Texture>());
-                textures[i]->create(width, height, spec.attachments[i].type, GL_NEAREST, GL_CLAMP_TO_EDGE);
+            for (size_t i = 0; i < spec.attachments.size(); ++i) {
+                if (i < shared.size() && shared[i]) {
+                    textures.push_back(shared[i]);
+                }
+                else {
+                    textures.emplace_back(std::make_shared<Texture>());
+                    textures[i]->create(width, height, spec.attachments[i].type, GL_NEAREST, GL_CLAMP_TO_EDGE);
+                }
                 attachColor(spec.attachments[i].base_name.c_str(),
                             spec.attachments[i].output_name.c_str(),
                             spec.attachments[i].uniform_name.c_str(),
-                            *textures[i], i);
+                            *textures[i], int(i));
             }
             if (spec.hasDepth) {
-                textures.emplace_back(std::make_shared<Texture>());
-                textures[spec.attachments.size()]->createDepth(width, height);
+                size_t d = spec.attachments.size();
+                if (d < shared.size() && shared[d])
+                    textures.push_back(shared[d]);
+                else {
+                    textures.emplace_back(std::make_shared<Texture>());
+                    textures[d]->createDepth(width, height);
+                }
 				int i = int(textures.size() - 1);
-				attachColor("_depth", "o__depthTexture", "u__depthTexture", *textures[i], i);
+				attachColor("_depth", "o__depthTexture", "u_depthTexture", *textures[i], i);
             }
             checkFbo();
         }
@@ -78,6 +92,24 @@ namespace lab {
         }
     }
 
+    void FrameBuffer::createDepth(int width, int height, std::shared_ptr<Texture> depth)
+    {
+        textures.clear();
+        drawBuffers.clear();
+        baseNames.clear();
+        drawBufferNames.clear();
+        uniformNames.clear();
+        samplerType.clear();
+        depthTextureAttached = false;
+
+        if (!depth)
+            depth = std::make_shared<Texture>();
+        depth->createDepth(width, height);
+        textures.push_back(depth);
+        attachColor("_depth", "o__depthTexture", "u_depthTexture", *depth, 0);
+        checkFbo();
+    }
+
     void FrameBuffer::bindForRead() 
 	{
 		size_t c = textures.size();
@@ -88,11 +120,16 @@ namespace lab {
 
 	void FrameBuffer::bindForWrite()
 	{
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, id);
+		glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, id);
 		if (resizeViewport)
 		{
-			glGetIntegerv(GL_VIEWPORT, oldViewport);
-			glViewport(newViewport[0], newViewport[1], newViewport[2], newViewport[3]);
+			glState().getViewport(oldViewport);
+			if (viewportScale == 1.f)
+				glState().viewport(newViewport[0], newViewport[1], newViewport[2], newViewport[3]);
+			else
+				glState().viewport(newViewport[0], newViewport[1],
+				                   std::max(1, int(newViewport[2] * viewportScale + 0.5f)),
+				                   std::max(1, int(newViewport[3] * viewportScale + 0.5f)));
 		}
 	}
 
@@ -116,24 +153,42 @@ namespace lab {
 	{
 		bindForWrite();
 
-		vector<GLenum> currentDrawBuffers;
+		if (!drawBuffers.size())
+			return;
+
+		// Fragment output i goes to attachment i, so attachments that aren't
+		// written keep their slot as GL_NONE. An empty list writes them all.
+		// Attachments whose textures are shared with other buffers must not
+		// be written unless named, or they would clobber the other buffer.
+		if (!attachments.size()) {
+			glState().drawBuffers((GLsizei)drawBuffers.size(), &drawBuffers[0]);
+			return;
+		}
+
+		vector<GLenum> currentDrawBuffers(drawBuffers.size(), GL_NONE);
 		for (auto a : attachments) {
-			for (int i = 0; i < baseNames.size(); ++i) {
+			for (size_t i = 0; i < baseNames.size(); ++i) {
 				if (a == baseNames[i]) {
-					currentDrawBuffers.push_back(drawBuffers[i]);
+					currentDrawBuffers[i] = drawBuffers[i];
 					break;
 				}
 			}
 		}
-		if (currentDrawBuffers.size())
-			glDrawBuffers((GLsizei)drawBuffers.size(), &drawBuffers[0]);
+		glState().drawBuffers((GLsizei)currentDrawBuffers.size(), &currentDrawBuffers[0]);
+	}
+
+	void FrameBuffer::bindForWrite(const std::vector<unsigned int> & drawBufferTable)
+	{
+		bindForWrite();
+		if (drawBufferTable.size())
+			glState().drawBuffers((GLsizei)drawBufferTable.size(), &drawBufferTable[0]);
 	}
 
     void FrameBuffer::unbind() 
 	{
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glState().bindFramebuffer(GL_FRAMEBUFFER, 0);
         if (resizeViewport) {
-            glViewport(oldViewport[0], oldViewport[1], oldViewport[2], oldViewport[3]);
+            glState().viewport(oldViewport[0], oldViewport[1], oldViewport[2], oldViewport[3]);
         }
     }
 
@@ -145,10 +200,12 @@ namespace lab {
     {
         newViewport[2] = texture.width;
         newViewport[3] = texture.height;
+        if (texture.depthTexture)
+            depthTextureAttached = true;
         if (!id)
             glGenFramebuffers(1, &id);
 
-		glBindFramebuffer(GL_FRAMEBUFFER, id);
+		glState().bindFramebuffer(GL_FRAMEBUFFER, id);
 
         // Bind a 2D texture (using a 2D layer of a 3D texture)
         if (texture.depthTexture)
@@ -176,13 +233,13 @@ namespace lab {
 
             //glDrawBuffers((GLsizei) drawBuffers.size(), drawBuffers.data());
         }
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glState().bindFramebuffer(GL_FRAMEBUFFER, 0);
 		return *this;
     }
 
     FrameBuffer & FrameBuffer::detachColor(unsigned int attachment)
     {
-		glBindFramebuffer(GL_FRAMEBUFFER, id);
+		glState().bindFramebuffer(GL_FRAMEBUFFER, id);
 
         // Update the draw buffers
         if (attachment < drawBuffers.size()) {
@@ -190,14 +247,16 @@ namespace lab {
             //glDrawBuffers((GLsizei) drawBuffers.size(), drawBuffers.data());
         }
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glState().bindFramebuffer(GL_FRAMEBUFFER, 0);
 		return *this;
     }
 
     FrameBuffer & FrameBuffer::checkFbo()
     {
-		glBindFramebuffer(GL_FRAMEBUFFER, id);
-		if (autoDepth)
+		glState().bindFramebuffer(GL_FRAMEBUFFER, id);
+
+		// a depth texture takes the place of the automatic renderbuffer
+		if (autoDepth && !depthTextureAttached)
 		{
             if (!renderbuffer || renderbufferWidth != newViewport[2] || renderbufferHeight != newViewport[3]) 
 			{
@@ -215,15 +274,71 @@ namespace lab {
         if (result != GL_FRAMEBUFFER_COMPLETE)
             handleGLError(errorPolicy, result, "FrameBuffer::check()");
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glState().bindFramebuffer(GL_FRAMEBUFFER, 0);
 		return *this;
     }
 
 
 
 
+    std::shared_ptr<Texture> RenderTargetPool::acquire(TextureType type, int width, int height, int filter, bool depth)
+    {
+        for (auto & e : _entries) {
+            if (!e.inUse && e.type == type && e.depth == depth && e.width == width && e.height == height) {
+                e.inUse = true;
+                e.generation = _generation;
+                if (!depth)
+                    e.texture->setFilter(filter);
+                return e.texture;
+            }
+        }
+
+        std::shared_ptr<Texture> t = std::make_shared<Texture>();
+        if (depth)
+            t->createDepth(width, height);
+        else
+            t->create(width, height, type, filter, GL_CLAMP_TO_EDGE);
+        _entries.push_back(Entry{ type, depth, width, height, _generation, true, t });
+        return t;
+    }
+
+    void RenderTargetPool::releaseAll()
+    {
+        for (auto & e : _entries)
+            e.inUse = false;
+        ++_generation;
+    }
+
+    void RenderTargetPool::trim(int maxAge)
+    {
+        _entries.erase(std::remove_if(_entries.begin(), _entries.end(),
+                                      [this, maxAge](const Entry & e) { return !e.inUse && _generation - e.generation > maxAge; }),
+                       _entries.end());
+    }
+
+    size_t RenderTargetPool::bytes() const
+    {
+        size_t result = 0;
+        for (auto & e : _entries)
+            result += size_t(e.width) * e.height * (e.depth ? 4 : Texture::pixelByteSize(e.type));
+        return result;
+    }
+
+
+
+    namespace {
+        // Targets released by a reallocation are kept for this many more, so
+        // that a size or scale that is revisited soon is not recreated.
+        const int kKeepTargetGenerations = 2;
+
+        int scaledSize(int size, float scale)
+        {
+            return std::max(1, int(float(size) * scale + 0.5f));
+        }
+    }
+
     FramebufferSet::FramebufferSet()
-    : _width(0), _height(0)
+    : _width(0), _height(0), _renderScale(1.f), _viewportScale(1.f)
     {}
 
     std::shared_ptr<FrameBuffer> FramebufferSet::fbo(const std::string & named) const
@@ -234,9 +349,117 @@ namespace lab {
         return i->second.second;
     }
 
+    const FrameBuffer::FrameBufferSpec * FramebufferSet::spec(const std::string & named) const
+    {
+        auto i = _fbos.find(named);
+        if (i == _fbos.end())
+            return nullptr;
+        return &i->second.first;
+    }
+
+    std::vector<std::string> FramebufferSet::names() const
+    {
+        std::vector<std::string> result;
+        for (auto & i : _fbos)
+            result.push_back(i.first);
+        return result;
+    }
+
     void FramebufferSet::add_fbo(const std::string & name, const FrameBuffer::FrameBufferSpec & spec)
     {
-        _fbos[name] = std::make_pair(spec, std::make_shared<FrameBuffer>());
+        FrameBuffer::FrameBufferSpec s(spec);
+        for (auto & a : s.attachments) {
+            if (a.scale != s.scale()) {
+                printf("Buffer %s: attachment %s scale %g differs from %g, using %g\n",
+                       name.c_str(), a.base_name.c_str(), a.scale, s.scale(), s.scale());
+                a.scale = s.scale();
+            }
+        }
+        _fbos[name] = std::make_pair(s, std::make_shared<FrameBuffer>());
+        _fbos[name].second->viewportScale = _viewportScale;
+        _width = _height = 0;
+    }
+
+    void FramebufferSet::setPool(const std::vector<PoolSlot> & slots)
+    {
+        _pool.clear();
+        for (const PoolSlot & s : slots)
+            _pool.push_back(std::make_pair(s, std::shared_ptr<Texture>()));
+        _width = _height = 0;
+    }
+
+    void FramebufferSet::setRenderScale(float scale)
+    {
+        if (scale == _renderScale)
+            return;
+        _renderScale = scale;
+        _width = _height = 0;
+    }
+
+    void FramebufferSet::setViewportScale(float scale)
+    {
+        _viewportScale = scale;
+        for (auto & i : _fbos)
+            i.second.second->viewportScale = scale;
+    }
+
+    v2i FramebufferSet::bufferSize(const FrameBuffer::FrameBufferSpec & spec) const
+    {
+        float scale = spec.scale() * _renderScale;
+        v2i size;
+        size.x = scaledSize(_width, scale);
+        size.y = scaledSize(_height, scale);
+        return size;
+    }
+
+    void FramebufferSet::setAllocation(const std::string & name, bool used, const std::vector<int> & slots)
+    {
+        Allocation & a = _allocation[name];
+        a.used = used;
+        a.slots = slots;
+        _width = _height = 0;
+    }
+
+    void FramebufferSet::clearAllocation()
+    {
+        _allocation.clear();
+        _pool.clear();
+        _width = _height = 0;
+    }
+
+    double FramebufferSet::bufferBytesPerPixel(const FrameBuffer::FrameBufferSpec & spec, const Allocation * a) const
+    {
+        if (!spec.attachments.size() || (a && !a->used))
+            return 0;
+
+        double bytes = 0;
+        for (size_t i = 0; i < spec.attachments.size(); ++i) {
+            bool pooled = a && i < a->slots.size() && a->slots[i] >= 0;
+            if (!pooled)
+                bytes += Texture::pixelByteSize(spec.attachments[i].type);
+        }
+        bytes += 4;         // GL_DEPTH_COMPONENT32F texture, or the automatic renderbuffer
+        return bytes * spec.scale() * spec.scale();
+    }
+
+    double FramebufferSet::allocatedBytesPerPixel() const
+    {
+        double bytes = 0;
+        for (auto & i : _fbos) {
+            auto a = _allocation.find(i.first);
+            bytes += bufferBytesPerPixel(i.second.first, a == _allocation.end() ? nullptr : &a->second);
+        }
+        for (auto & p : _pool)
+            bytes += Texture::pixelByteSize(p.first.type) * p.first.scale * p.first.scale;
+        return bytes;
+    }
+
+    double FramebufferSet::requestedBytesPerPixel() const
+    {
+        double bytes = 0;
+        for (auto & i : _fbos)
+            bytes += bufferBytesPerPixel(i.second.first, nullptr);
+        return bytes;
     }
 
     bool FramebufferSet::setSize(int width, int height) 
@@ -250,10 +473,45 @@ namespace lab {
         _width = width;
         _height = height;
 
-        for (auto i : _fbos) {
-            i.second.second->create(i.second.first, width, height);
+        // Every target goes back to the pool, and each buffer takes one of
+        // its format and size back out, so only sizes that changed allocate.
+        // Targets drawn at one size and sampled at another are filtered.
+        _targets.releaseAll();
+
+        for (auto & p : _pool) {
+            float scale = p.first.scale * _renderScale;
+            p.second = _targets.acquire(p.first.type, scaledSize(width, scale), scaledSize(height, scale),
+                                        scale == 1.f ? GL_NEAREST : GL_LINEAR);
+        }
+
+        for (auto & i : _fbos) {
+            const FrameBuffer::FrameBufferSpec & spec = i.second.first;
+            auto a = _allocation.find(i.first);
+            if (a != _allocation.end() && !a->second.used) {
+                i.second.second->textures.clear();
+                continue;
+            }
+            if (!spec.attachments.size()) {
+                i.second.second->create(spec, width, height);
+                continue;
+            }
+
+            v2i size = bufferSize(spec);
+            int filter = spec.scale() * _renderScale == 1.f ? GL_NEAREST : GL_LINEAR;
+            vector<shared_ptr<Texture>> textures;
+            for (size_t t = 0; t < spec.attachments.size(); ++t) {
+                int slot = a != _allocation.end() && t < a->second.slots.size() ? a->second.slots[t] : -1;
+                if (slot >= 0 && slot < int(_pool.size()))
+                    textures.push_back(_pool[slot].second);
+                else
+                    textures.push_back(_targets.acquire(spec.attachments[t].type, size.x, size.y, filter));
+            }
+            if (spec.hasDepth)
+                textures.push_back(_targets.acquire(TextureType::none, size.x, size.y, GL_NEAREST, true));
+            i.second.second->create(spec, size.x, size.y, textures);
         }
 
+        _targets.trim(kKeepTargetGenerations);
         return true;
     }
 
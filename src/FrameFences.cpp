@@ -0,0 +1,115 @@
+//
+//  FrameFences.cpp
+//  LabRender
+//
+//
+
+#include "LabRender/FrameFences.h"
+#include "LabRender/gl4.h"
+
+#include <chrono>
+
+namespace lab {
+
+    namespace {
+        double nowMs()
+        {
+            using namespace std::chrono;
+            return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+        }
+    }
+
+    FrameFences::FrameFences(int depth)
+    : _frames(depth < 1 ? 1 : depth)
+    {
+    }
+
+    FrameFences::~FrameFences()
+    {
+        for (auto & f : _frames)
+            if (f.fence)
+                glDeleteSync((GLsync) f.fence);
+    }
+
+    void FrameFences::setDepth(int depth)
+    {
+        if (depth < 1)
+            depth = 1;
+        if (depth == int(_frames.size()))
+            return;
+
+        drain();
+        _frames.resize(depth);
+        _slot = 0;
+    }
+
+    void FrameFences::retire(Frame & frame, bool wait)
+    {
+        if (!frame.fence)
+            return;
+
+        GLsync sync = (GLsync) frame.fence;
+        GLenum result = glClientWaitSync(sync, 0, 0);
+        if (wait) {
+            // flush on the first wait so the fence is guaranteed to be submitted
+            GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+            while (result == GL_TIMEOUT_EXPIRED) {
+                result = glClientWaitSync(sync, flags, 1000000); // 1ms
+                flags = 0;
+            }
+        }
+        if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED) {
+            _timings.gpuLatencyMs = nowMs() - frame.submitTime;
+            glDeleteSync(sync);
+            frame.fence = nullptr;
+        }
+    }
+
+    int FrameFences::beginFrame()
+    {
+        if (_inFrame)
+            return _slot;
+
+        // opportunistically retire anything that has already finished
+        for (auto & f : _frames)
+            retire(f, false);
+
+        // only the slot about to be reused has to be waited on
+        double waitStart = nowMs();
+        retire(_frames[_slot], true);
+        _beginTime = nowMs();
+        _timings.fenceWaitMs = _beginTime - waitStart;
+
+        _inFrame = true;
+        return _slot;
+    }
+
+    void FrameFences::endFrame()
+    {
+        if (!_inFrame)
+            return;
+
+        Frame & frame = _frames[_slot];
+        frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        frame.submitTime = nowMs();
+        _timings.cpuFrameMs = frame.submitTime - _beginTime;
+
+        int inFlight = 0;
+        for (auto & f : _frames)
+            if (f.fence)
+                ++inFlight;
+        _timings.framesInFlight = inFlight;
+
+        _slot = (_slot + 1) % int(_frames.size());
+        ++_frameNumber;
+        _inFrame = false;
+    }
+
+    void FrameFences::drain()
+    {
+        for (auto & f : _frames)
+            retire(f, true);
+        _timings.framesInFlight = 0;
+    }
+
+} // lab
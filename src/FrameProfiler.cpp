@@ -0,0 +1,249 @@
+//
+//  FrameProfiler.cpp
+//  LabRender
+//
+//
+
+#include "LabRender/FrameProfiler.h"
+#include "LabRender/gl4.h"
+
+#include <chrono>
+
+namespace lab {
+
+    namespace {
+        double nowMs()
+        {
+            using namespace std::chrono;
+            return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+        }
+
+        void writeEscaped(std::ostream & out, const std::string & s)
+        {
+            for (char c : s) {
+                if (c == '"' || c == '\\')
+                    out << '\\';
+                out << c;
+            }
+        }
+    }
+
+    void writeChromeTrace(std::ostream & out, const FrameProfile & profile)
+    {
+        // tid 0 is the CPU timeline, tid 1 the GPU timeline; times are microseconds
+        out << "{\"traceEvents\":[\n";
+        bool first = true;
+        for (const PassProfile & p : profile.passes) {
+            for (int tid = 0; tid < 2; ++tid) {
+                double ts = tid == 0 ? p.cpuStartMs : p.gpuStartMs;
+                double dur = tid == 0 ? p.cpuMs : p.gpuMs;
+                if (!first)
+                    out << ",\n";
+                first = false;
+                out << "{\"name\":\"";
+                writeEscaped(out, p.name);
+                out << "\",\"cat\":\"" << (tid == 0 ? "cpu" : "gpu")
+                    << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << tid
+                    << ",\"ts\":" << ts * 1000.0 << ",\"dur\":" << dur * 1000.0
+                    << ",\"args\":{\"frame\":" << profile.frameNumber
+                    << ",\"draws\":" << p.drawCount
+                    << ",\"triangles\":" << p.triangleCount;
+                if (p.samplesPassed >= 0)
+                    out << ",\"samples\":" << p.samplesPassed << ",\"overdraw\":" << p.overdraw();
+                out << "}}";
+            }
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    }
+
+    FrameProfiler::FrameProfiler(int latency)
+    : _frames(latency < 2 ? 2 : latency)
+    {
+    }
+
+    FrameProfiler::~FrameProfiler()
+    {
+        for (auto & f : _frames)
+            for (auto & z : f.zones) {
+                if (z.queries[0])
+                    glDeleteQueries(2, z.queries);
+                if (!z.samplesQueries.empty())
+                    glDeleteQueries(GLsizei(z.samplesQueries.size()), z.samplesQueries.data());
+            }
+    }
+
+    bool FrameProfiler::resolve(Frame & frame)
+    {
+        if (!frame.pending)
+            return true;
+
+        if (frame.zoneCount == 0 || !frame.lastQuery) {
+            frame.pending = false;
+            return true;
+        }
+
+        // the last query issued is the last to retire
+        GLint available = 0;
+        glGetQueryObjectiv(frame.lastQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return false;
+
+        GLuint64 gpuBegin = 0;
+        glGetQueryObjectui64v(frame.zones[0].queries[0], GL_QUERY_RESULT, &gpuBegin);
+
+        _last.frameNumber = frame.frameNumber;
+        _last.cpuMs = frame.cpuEnd - frame.cpuBegin;
+        _last.gpuMs = 0;
+        _last.passes.resize(frame.zoneCount);
+        for (int i = 0; i < frame.zoneCount; ++i) {
+            const Zone & z = frame.zones[i];
+            GLuint64 t0 = 0, t1 = 0;
+            glGetQueryObjectui64v(z.queries[0], GL_QUERY_RESULT, &t0);
+            glGetQueryObjectui64v(z.queries[1], GL_QUERY_RESULT, &t1);
+
+            PassProfile & p = _last.passes[i];
+            p.name = z.name;
+            p.depth = z.depth;
+            p.gpuStartMs = double(t0 - gpuBegin) * 1.0e-6;
+            p.gpuMs = double(t1 - t0) * 1.0e-6;
+            p.cpuStartMs = z.cpuBegin - frame.cpuBegin;
+            p.cpuMs = z.cpuEnd - z.cpuBegin;
+            p.drawCount = z.drawCount;
+            p.triangleCount = z.triangleCount;
+            p.samplesPassed = -1;
+            p.pixels = 0;
+            if (z.countsSamples) {
+                p.samplesPassed = 0;
+                for (int q = 0; q < z.samplesUsed; ++q) {
+                    GLuint64 samples = 0;
+                    glGetQueryObjectui64v(z.samplesQueries[q], GL_QUERY_RESULT, &samples);
+                    p.samplesPassed += int64_t(samples);
+                }
+                p.pixels = z.pixels;
+            }
+            if (z.depth == 0)
+                _last.gpuMs += p.gpuMs;
+        }
+        frame.pending = false;
+        return true;
+    }
+
+    void FrameProfiler::beginFrame()
+    {
+        if (!_enabled || _inFrame)
+            return;
+
+        // harvest every frame that has retired, oldest first; the slot about
+        // to be reused is the oldest
+        for (int i = 0; i < int(_frames.size()); ++i)
+            resolve(_frames[(_current + i) % _frames.size()]);
+
+        Frame & frame = _frames[_current];
+        if (frame.pending) {
+            // The GPU is more than a ring behind; drop the old results rather
+            // than block on them.
+            frame.pending = false;
+        }
+        frame.zoneCount = 0;
+        frame.lastQuery = 0;
+        frame.frameNumber = _frameNumber;
+        frame.cpuBegin = nowMs();
+        _inFrame = true;
+    }
+
+    void FrameProfiler::endFrame()
+    {
+        if (!_inFrame)
+            return;
+
+        Frame & frame = _frames[_current];
+        frame.cpuEnd = nowMs();
+        frame.pending = true;
+        _current = (_current + 1) % int(_frames.size());
+        ++_frameNumber;
+        _inFrame = false;
+    }
+
+    int FrameProfiler::beginZone(const char * name, int depth)
+    {
+        if (!_inFrame)
+            return -1;
+
+        Frame & frame = _frames[_current];
+        if (frame.zoneCount == int(frame.zones.size()))
+            frame.zones.emplace_back();
+
+        Zone & z = frame.zones[frame.zoneCount];
+        if (!z.queries[0])
+            glGenQueries(2, z.queries);
+        if (z.name != name)
+            z.name = name;
+        z.depth = depth;
+        z.drawCount = 0;
+        z.triangleCount = 0;
+        z.countsSamples = false;
+        z.cpuBegin = nowMs();
+        glQueryCounter(z.queries[0], GL_TIMESTAMP);
+        return frame.zoneCount++;
+    }
+
+    void FrameProfiler::endZone(int zone, int drawCount, int64_t triangleCount)
+    {
+        if (!_inFrame || zone < 0)
+            return;
+
+        Frame & frame = _frames[_current];
+        Zone & z = frame.zones[zone];
+        if (z.countsSamples && zone == _countingZone) {
+            if (!_samplesPaused)
+                glEndQuery(GL_SAMPLES_PASSED);
+            _countingZone = -1;
+            _samplesPaused = false;
+        }
+        glQueryCounter(z.queries[1], GL_TIMESTAMP);
+        frame.lastQuery = z.queries[1];
+        z.cpuEnd = nowMs();
+        z.drawCount = drawCount;
+        z.triangleCount = triangleCount;
+    }
+
+    void FrameProfiler::countSamples(int zone, int64_t pixels)
+    {
+        if (!_inFrame || zone < 0)
+            return;
+
+        Zone & z = _frames[_current].zones[zone];
+        z.countsSamples = true;
+        z.samplesUsed = 0;
+        z.pixels = pixels;
+        _countingZone = zone;
+        _samplesPaused = false;
+        beginSamples(z);
+    }
+
+    void FrameProfiler::beginSamples(Zone & z)
+    {
+        if (z.samplesUsed == int(z.samplesQueries.size())) {
+            z.samplesQueries.push_back(0);
+            glGenQueries(1, &z.samplesQueries.back());
+        }
+        glBeginQuery(GL_SAMPLES_PASSED, z.samplesQueries[z.samplesUsed++]);
+    }
+
+    void FrameProfiler::pauseSamples()
+    {
+        if (!_inFrame || _countingZone < 0 || _samplesPaused)
+            return;
+        glEndQuery(GL_SAMPLES_PASSED);
+        _samplesPaused = true;
+    }
+
+    void FrameProfiler::resumeSamples()
+    {
+        if (!_inFrame || _countingZone < 0 || !_samplesPaused)
+            return;
+        beginSamples(_frames[_current].zones[_countingZone]);
+        _samplesPaused = false;
+    }
+
+} // lab
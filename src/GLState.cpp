@@ -0,0 +1,294 @@
+//
+//  GLState.cpp
+//  LabRender
+//
+//
+
+#include "LabRender/GLState.h"
+#include "LabRender/gl4.h"
+
+#include <algorithm>
+
+namespace lab {
+
+    namespace {
+        const unsigned int unknown = ~0u;
+    }
+
+    GLState & glState()
+    {
+        thread_local GLState state;
+        return state;
+    }
+
+    GLState::GLState()
+    {
+        invalidate();
+    }
+
+    void GLState::invalidate()
+    {
+        _program = unknown;
+        _vao = unknown;
+        _drawFramebuffer = unknown;
+        _readFramebuffer = unknown;
+        for (int i = 0; i < capCount; ++i)
+            _caps[i] = -1;
+        _depthFunc = unknown;
+        _depthMask = -1;
+        _blendSrc = _blendDst = unknown;
+        _cullFace = unknown;
+        _viewportKnown = false;
+        _scissorKnown = false;
+        _activeTexture = unknown;
+        for (auto & u : _units)
+            u = TextureUnit{ unknown, unknown };
+
+        // keep the entries and their storage; an empty list never matches
+        for (auto & d : _drawBuffers)
+            d.second.clear();
+    }
+
+    void GLState::beginFrame()
+    {
+        _lastFrame = _counters;
+        _counters = Counters();
+    }
+
+    bool GLState::skip(bool same)
+    {
+        if (same)
+            ++_counters.skipped;
+        else
+            ++_counters.issued;
+        return same;
+    }
+
+    int GLState::capIndex(unsigned int cap)
+    {
+        switch (cap) {
+            case GL_DEPTH_TEST:          return depthTest;
+            case GL_BLEND:               return blend;
+            case GL_CULL_FACE:           return cullFace_;
+            case GL_SCISSOR_TEST:        return scissorTest;
+            case GL_STENCIL_TEST:        return stencilTest;
+            case GL_POLYGON_OFFSET_FILL: return polygonOffsetFill;
+            default:                     return -1;
+        }
+    }
+
+    void GLState::useProgram(unsigned int program)
+    {
+        if (skip(_program == program))
+            return;
+        glUseProgram(program);
+        _program = program;
+    }
+
+    void GLState::bindVertexArray(unsigned int vao)
+    {
+        if (skip(_vao == vao))
+            return;
+        glBindVertexArray(vao);
+        _vao = vao;
+    }
+
+    void GLState::bindFramebuffer(unsigned int target, unsigned int fbo)
+    {
+        switch (target) {
+            case GL_DRAW_FRAMEBUFFER:
+                if (skip(_drawFramebuffer == fbo))
+                    return;
+                _drawFramebuffer = fbo;
+                break;
+            case GL_READ_FRAMEBUFFER:
+                if (skip(_readFramebuffer == fbo))
+                    return;
+                _readFramebuffer = fbo;
+                break;
+            default:
+                if (skip(_drawFramebuffer == fbo && _readFramebuffer == fbo))
+                    return;
+                _drawFramebuffer = _readFramebuffer = fbo;
+                break;
+        }
+        glBindFramebuffer(target, fbo);
+    }
+
+    void GLState::drawBuffers(int count, const unsigned int * buffers)
+    {
+        // the default framebuffer's draw buffer is not cached
+        if (_drawFramebuffer == unknown || _drawFramebuffer == 0) {
+            skip(false);
+            glDrawBuffers(count, buffers);
+            return;
+        }
+
+        std::vector<unsigned int> & current = _drawBuffers[_drawFramebuffer];
+        if (skip(!current.empty() && int(current.size()) == count && std::equal(buffers, buffers + count, current.begin())))
+            return;
+        current.assign(buffers, buffers + count);
+        glDrawBuffers(count, buffers);
+    }
+
+    void GLState::enable(unsigned int cap)
+    {
+        int i = capIndex(cap);
+        if (i >= 0) {
+            if (skip(_caps[i] == 1))
+                return;
+            _caps[i] = 1;
+        }
+        else
+            skip(false);
+        glEnable(cap);
+    }
+
+    void GLState::disable(unsigned int cap)
+    {
+        int i = capIndex(cap);
+        if (i >= 0) {
+            if (skip(_caps[i] == 0))
+                return;
+            _caps[i] = 0;
+        }
+        else
+            skip(false);
+        glDisable(cap);
+    }
+
+    void GLState::depthFunc(unsigned int func)
+    {
+        if (skip(_depthFunc == func))
+            return;
+        glDepthFunc(func);
+        _depthFunc = func;
+    }
+
+    void GLState::depthMask(bool write)
+    {
+        if (skip(_depthMask == (write ? 1 : 0)))
+            return;
+        glDepthMask(write ? GL_TRUE : GL_FALSE);
+        _depthMask = write ? 1 : 0;
+    }
+
+    unsigned int GLState::depthFunc() const
+    {
+        return _depthFunc == unknown ? GL_LESS : _depthFunc;
+    }
+
+    void GLState::blendFunc(unsigned int src, unsigned int dst)
+    {
+        if (skip(_blendSrc == src && _blendDst == dst))
+            return;
+        glBlendFunc(src, dst);
+        _blendSrc = src;
+        _blendDst = dst;
+    }
+
+    void GLState::cullFace(unsigned int mode)
+    {
+        if (skip(_cullFace == mode))
+            return;
+        glCullFace(mode);
+        _cullFace = mode;
+    }
+
+    void GLState::viewport(int x, int y, int w, int h)
+    {
+        if (skip(_viewportKnown && _viewport[0] == x && _viewport[1] == y && _viewport[2] == w && _viewport[3] == h))
+            return;
+        glViewport(x, y, w, h);
+        _viewport[0] = x;
+        _viewport[1] = y;
+        _viewport[2] = w;
+        _viewport[3] = h;
+        _viewportKnown = true;
+    }
+
+    void GLState::scissor(int x, int y, int w, int h)
+    {
+        if (skip(_scissorKnown && _scissor[0] == x && _scissor[1] == y && _scissor[2] == w && _scissor[3] == h))
+            return;
+        glScissor(x, y, w, h);
+        _scissor[0] = x;
+        _scissor[1] = y;
+        _scissor[2] = w;
+        _scissor[3] = h;
+        _scissorKnown = true;
+    }
+
+    void GLState::getViewport(int * xywh)
+    {
+        if (!_viewportKnown) {
+            glGetIntegerv(GL_VIEWPORT, _viewport);
+            _viewportKnown = true;
+        }
+        for (int i = 0; i < 4; ++i)
+            xywh[i] = _viewport[i];
+    }
+
+    void GLState::activeTexture(unsigned int unit)
+    {
+        if (skip(_activeTexture == unit))
+            return;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        _activeTexture = unit;
+    }
+
+    void GLState::bindTexture(unsigned int unit, unsigned int target, unsigned int texture)
+    {
+        if (unit >= _units.size())
+            _units.resize(unit + 1, TextureUnit{ unknown, unknown });
+
+        TextureUnit & u = _units[unit];
+        if (skip(u.target == target && u.texture == texture))
+            return;
+        activeTexture(unit);
+        glBindTexture(target, texture);
+        u.target = target;
+        u.texture = texture;
+    }
+
+    void GLState::deleteProgram(unsigned int program)
+    {
+        if (!program)
+            return;
+        glDeleteProgram(program);
+        if (_program == program)
+            _program = unknown;
+    }
+
+    void GLState::deleteVertexArray(unsigned int vao)
+    {
+        if (!vao)
+            return;
+        glDeleteVertexArrays(1, &vao);
+        if (_vao == vao)
+            _vao = unknown;
+    }
+
+    void GLState::deleteFramebuffer(unsigned int fbo)
+    {
+        if (!fbo)
+            return;
+        glDeleteFramebuffers(1, &fbo);
+        if (_drawFramebuffer == fbo)
+            _drawFramebuffer = unknown;
+        if (_readFramebuffer == fbo)
+            _readFramebuffer = unknown;
+        _drawBuffers.erase(fbo);
+    }
+
+    void GLState::deleteTexture(unsigned int texture)
+    {
+        if (!texture)
+            return;
+        glDeleteTextures(1, &texture);
+        for (auto & u : _units)
+            if (u.texture == texture)
+                u.texture = unknown;
+    }
+
+} // lab
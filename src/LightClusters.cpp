@@ -0,0 +1,293 @@
+//
+//  LightClusters.cpp
+//  LabRender
+//
+//
+
+#include "LabRender/LightClusters.h"
+
+#include "LabRender/gl4.h"
+#include "LabRender/DrawList.h"
+#include "LabRender/FrameArena.h"
+#include "LabRender/Light.h"
+#include "LabRender/ShadowAtlas.h"
+#include "LabRender/Texture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace lab {
+
+    namespace {
+
+        int nextPowerOfTwo(int n)
+        {
+            int p = 1;
+            while (p < n)
+                p <<= 1;
+            return p;
+        }
+
+    } // anon
+
+    LightClusters::LightClusters(int workers)
+    : _pool(workers)
+    , _lightTexture(std::make_shared<Texture>())
+    , _gridTexture(std::make_shared<Texture>())
+    , _indexTexture(std::make_shared<Texture>())
+    {
+    }
+
+    void LightClusters::setSettings(const Settings & s)
+    {
+        _settings.tilesX = std::max(1, s.tilesX);
+        _settings.tilesY = std::max(1, s.tilesY);
+        _settings.slices = std::max(1, s.slices);
+        _froxels.clear();   // rebuilt by the next build
+    }
+
+    void LightClusters::updateFroxels(const m44f & proj)
+    {
+        if (!_froxels.empty() && !memcmp(&proj, &_proj, sizeof(m44f)))
+            return;
+
+        _proj = proj;
+        const float * m = proj.m;
+        _perspective = fabsf(m[11] + 1.f) < 1e-4f && fabsf(m[15]) < 1e-4f;
+
+        const int tilesX = _settings.tilesX;
+        const int tilesY = _settings.tilesY;
+        const int slices = _settings.slices;
+        _froxels.resize(size_t(tilesX) * tilesY * slices);
+        if (!_perspective)
+            return;
+
+        // near and far from the depth row of a GL perspective matrix; an
+        // infinite far plane is clipped to something finite to slice
+        _near = m[14] / (m[10] - 1.f);
+        _far = m[10] + 1.f < -1e-6f ? m[14] / (m[10] + 1.f) : _near * 1e4f;
+        float logRange = logf(_far / _near);
+        _sliceScale = slices / logRange;
+        _sliceBias = -slices * logf(_near) / logRange;
+
+        // view x is (ndc x + m[8]) * depth / m[0], and likewise for y
+        for (int s = 0; s < slices; ++s) {
+            float d0 = _near * powf(_far / _near, float(s) / slices);
+            float d1 = _near * powf(_far / _near, float(s + 1) / slices);
+            for (int ty = 0; ty < tilesY; ++ty) {
+                float ny0 = -1.f + 2.f * ty / tilesY + m[9];
+                float ny1 = -1.f + 2.f * (ty + 1) / tilesY + m[9];
+                for (int tx = 0; tx < tilesX; ++tx) {
+                    float nx0 = -1.f + 2.f * tx / tilesX + m[8];
+                    float nx1 = -1.f + 2.f * (tx + 1) / tilesX + m[8];
+                    Bounds & b = _froxels[(size_t(s) * tilesY + ty) * tilesX + tx];
+                    b.first = v3f(std::min(nx0 * d0, nx0 * d1) / m[0],
+                                  std::min(ny0 * d0, ny0 * d1) / m[5], -d1);
+                    b.second = v3f(std::max(nx1 * d0, nx1 * d1) / m[0],
+                                   std::max(ny1 * d0, ny1 * d1) / m[5], -d0);
+                }
+            }
+        }
+    }
+
+    void LightClusters::build(const DrawList & drawList, FrameArena & arena, const ShadowAtlas * shadows)
+    {
+        updateFroxels(drawList.proj);
+
+        const int tilesX = _settings.tilesX;
+        const int tilesY = _settings.tilesY;
+        const int slices = _settings.slices;
+
+        _stats = Stats();
+        _lights.clear();
+        _grid.assign(_froxels.size(), v2f(0, 0));
+        _indices.clear();
+
+        // gather the lights, in world space for shading, and in view space
+        // for assignment
+        FrameVector<v4f> spheres { ArenaAllocator<v4f>(arena) };
+        spheres.reserve(drawList.lights.size());
+        for (size_t l = 0; l < drawList.lights.size(); ++l) {
+            const auto & illuminant = drawList.lights[l];
+            const PointLight * light = dynamic_cast<const PointLight *>(illuminant->light.get());
+            if (!light || light->radius <= 0)
+                continue;
+
+            m44f t = illuminant->transform ? illuminant->transform->transform() : m44f_identity;
+            v3f position(t.m[12], t.m[13], t.m[14]);
+            v3f direction(-t.m[8], -t.m[9], -t.m[10]);
+            float len = length(direction);
+            direction = len > 0 ? direction / len : v3f(0, 0, -1);
+
+            // a point light is a spot light whose cone covers everything
+            float cosInner = -1.f;
+            float cosOuter = -2.f;
+            if (const SpotLight * spot = dynamic_cast<const SpotLight *>(light)) {
+                cosOuter = cosf(degToRad(spot->outerAngle));
+                cosInner = std::max(cosOuter + 1e-4f, cosf(degToRad(spot->innerAngle)));
+            }
+
+            _lights.push_back(v4f(position, light->radius));
+            _lights.push_back(v4f(light->color * light->intensity, cosInner));
+            _lights.push_back(v4f(direction, cosOuter));
+
+            const ShadowAtlas::Shadow * shadow = shadows ? shadows->shadow(l) : nullptr;
+            if (shadow) {
+                _lights.push_back(v4f(shadows->tileRect(*shadow), 1.f));
+                for (int i = 0; i < 4; ++i)
+                    _lights.push_back(shadow->samplingViewProj().columns[i]);
+            }
+            else
+                _lights.resize(_lights.size() + 5, v4f(0, 0, 0, 0));
+            v4f view = matrix_multiply(drawList.view, v4f(position, 1.f));
+            spheres.push_back(v4f(view.x, view.y, view.z, light->radius));
+        }
+        _lightCount = int(spheres.size());
+        _stats.lights = _lightCount;
+
+        if (!_perspective || !_lightCount) {
+            _indices.resize(kIndexRowWidth, 0.f);
+            return;
+        }
+
+        // bound each light on screen and in depth
+        const float * m = drawList.proj.m;
+        _spans.resize(_lightCount);
+        for (int i = 0; i < _lightCount; ++i) {
+            Span & span = _spans[i];
+            span.sphere = spheres[i];
+            span.s0 = 1;
+            span.s1 = 0;
+
+            v3f c(spheres[i].x, spheres[i].y, spheres[i].z);
+            float r = spheres[i].w;
+            float dmin = -c.z - r;
+            float dmax = -c.z + r;
+            if (dmax < _near || dmin > _far)
+                continue;
+
+            // the screen rectangle of the part of the sphere's bounding box
+            // in front of the near plane
+            float nx0 = 1e30f, nx1 = -1e30f, ny0 = 1e30f, ny1 = -1e30f;
+            for (float d : { std::max(dmin, _near), dmax }) {
+                for (float dx : { -r, r }) {
+                    float nx = m[0] * (c.x + dx) / d - m[8];
+                    nx0 = std::min(nx0, nx);
+                    nx1 = std::max(nx1, nx);
+                }
+                for (float dy : { -r, r }) {
+                    float ny = m[5] * (c.y + dy) / d - m[9];
+                    ny0 = std::min(ny0, ny);
+                    ny1 = std::max(ny1, ny);
+                }
+            }
+            if (nx1 < -1.f || nx0 > 1.f || ny1 < -1.f || ny0 > 1.f)
+                continue;
+
+            span.s0 = 0;
+            if (dmin > _near)
+                span.s0 = std::min(slices - 1, std::max(0, int(floorf(logf(dmin) * _sliceScale + _sliceBias))));
+            span.s1 = std::min(slices - 1, std::max(0, int(floorf(logf(dmax) * _sliceScale + _sliceBias))));
+            span.tx0 = std::max(0, int(floorf((nx0 + 1.f) * 0.5f * tilesX)));
+            span.tx1 = std::min(tilesX - 1, int(floorf((nx1 + 1.f) * 0.5f * tilesX)));
+            span.ty0 = std::max(0, int(floorf((ny0 + 1.f) * 0.5f * tilesY)));
+            span.ty1 = std::min(tilesY - 1, int(floorf((ny1 + 1.f) * 0.5f * tilesY)));
+        }
+
+        // the lights of each slice, in order
+        _sliceStart.assign(slices + 1, 0);
+        for (const Span & span : _spans)
+            for (int s = span.s0; s <= span.s1; ++s)
+                ++_sliceStart[s + 1];
+        for (int s = 0; s < slices; ++s)
+            _sliceStart[s + 1] += _sliceStart[s];
+        _sliceLights.resize(_sliceStart[slices]);
+        uint32_t * next = arena.allocateArray<uint32_t>(slices);
+        std::copy(_sliceStart.begin(), _sliceStart.end() - 1, next);
+        for (int i = 0; i < _lightCount; ++i)
+            for (int s = _spans[i].s0; s <= _spans[i].s1; ++s)
+                _sliceLights[next[s]++] = uint32_t(i);
+
+        // refine the bounds against each froxel, a slice at a time
+        _assignments.resize(slices);
+        _pool.run(slices, [this](int slice) { assignSlice(slice); });
+
+        // counting sort by froxel; the slices hold their froxels in order,
+        // and lights stay in order within a froxel
+        size_t count = 0;
+        bool * touched = arena.allocateArray<bool>(_lightCount);
+        std::fill(touched, touched + _lightCount, false);
+        for (int s = 0; s < slices; ++s) {
+            for (const Assignment & a : _assignments[s]) {
+                _grid[a.froxel].y += 1.f;
+                touched[a.light] = true;
+            }
+            count += _assignments[s].size();
+        }
+        _stats.visible = int(std::count(touched, touched + _lightCount, true));
+
+        uint32_t * cursor = arena.allocateArray<uint32_t>(_grid.size());
+        uint32_t offset = 0;
+        for (size_t f = 0; f < _grid.size(); ++f) {
+            _grid[f].x = float(offset);
+            cursor[f] = offset;
+            offset += uint32_t(_grid[f].y);
+        }
+
+        size_t rows = std::max<size_t>(1, (count + kIndexRowWidth - 1) / kIndexRowWidth);
+        _indices.resize(rows * kIndexRowWidth, 0.f);
+        for (int s = 0; s < slices; ++s)
+            for (const Assignment & a : _assignments[s])
+                _indices[cursor[a.froxel]++] = float(a.light);
+        _stats.indices = int(count);
+    }
+
+    void LightClusters::assignSlice(int s)
+    {
+        const int tilesX = _settings.tilesX;
+        const int tilesY = _settings.tilesY;
+        std::vector<Assignment> & assignments = _assignments[s];
+        assignments.clear();
+
+        for (uint32_t l = _sliceStart[s]; l < _sliceStart[s + 1]; ++l) {
+            uint32_t i = _sliceLights[l];
+            const Span & span = _spans[i];
+            v3f c(span.sphere.x, span.sphere.y, span.sphere.z);
+            float r2 = span.sphere.w * span.sphere.w;
+            for (int ty = span.ty0; ty <= span.ty1; ++ty)
+                for (int tx = span.tx0; tx <= span.tx1; ++tx) {
+                    uint32_t f = uint32_t((s * tilesY + ty) * tilesX + tx);
+                    const Bounds & b = _froxels[f];
+                    float dx = c.x - std::min(std::max(c.x, b.first.x), b.second.x);
+                    float dy = c.y - std::min(std::max(c.y, b.first.y), b.second.y);
+                    float dz = c.z - std::min(std::max(c.z, b.first.z), b.second.z);
+                    if (dx * dx + dy * dy + dz * dz <= r2)
+                        assignments.push_back(Assignment{ f, i });
+                }
+        }
+    }
+
+    void LightClusters::upload()
+    {
+        int lightRows = std::max(1, _lightCount);
+        if (_lightTexture->height < lightRows)
+            _lightTexture->create(kLightTexels, nextPowerOfTwo(lightRows), TextureType::f32x4, GL_NEAREST, GL_CLAMP_TO_EDGE);
+        if (_lightCount)
+            _lightTexture->update(0, 0, kLightTexels, _lightCount, GL_RGBA, GL_FLOAT, _lights.data());
+
+        int gridWidth = _settings.tilesX;
+        int gridHeight = _settings.tilesY * _settings.slices;
+        if (_gridTexture->width != gridWidth || _gridTexture->height != gridHeight)
+            _gridTexture->create(gridWidth, gridHeight, TextureType::f32x2, GL_NEAREST, GL_CLAMP_TO_EDGE);
+        if (!_grid.empty())
+            _gridTexture->update(0, 0, gridWidth, gridHeight, GL_RG, GL_FLOAT, _grid.data());
+
+        int indexRows = int(_indices.size() / kIndexRowWidth);
+        if (_indexTexture->height < indexRows)
+            _indexTexture->create(kIndexRowWidth, nextPowerOfTwo(indexRows), TextureType::f32x1, GL_NEAREST, GL_CLAMP_TO_EDGE);
+        if (indexRows)
+            _indexTexture->update(0, 0, kIndexRowWidth, indexRows, GL_RED, GL_FLOAT, _indices.data());
+    }
+
+} // lab
@@ -28,13 +28,6 @@ namespace lab {
 		return *reinterpret_cast<m44f*>(&m[0][0]);
 	}
 
-	v4f matrix_multiply(const m44f & a, const v4f & v) {
-		const glm::mat4& m = *reinterpret_cast<const glm::mat4*>(&a);
-		const glm::vec4 & vec = *reinterpret_cast<const glm::vec4*>(&v);
-		glm::vec4 r = vec * m;
-		return *reinterpret_cast<v4f*>(&r);
-	}
-
 	m44f matrix_multiply(const m44f & a, const m44f & b) {
 		const glm::mat4 & ma = *reinterpret_cast<const glm::mat4*>(&a);
 		const glm::mat4 & mb = *reinterpret_cast<const glm::mat4*>(&b);
@@ -16,12 +16,14 @@
 #include "LabRender/FrameBuffer.h"
 #include "LabRender/Material.h"
 #include "LabRender/MathTypes.h"
+#include "LabRender/Profiler.h"
 #include "LabRender/ShaderBuilder.h"
+#include "LabRender/TextureStreamer.h"
 #include "LabRender/Utils.h"
 #include "LabRender/Vertex.h"
 
+#include <algorithm>
 #include <iostream>
-#include <sstream>
 #include <map>
 #include <vector>
 
@@ -34,6 +36,21 @@ using std::string;
 
 namespace lab {
 
+    namespace {
+        // the features of a generated shader, the low bits of its variant key
+        enum : uint16_t {
+            DeferredVariant = 1 << 0,
+            CompactVariant  = 1 << 1,
+            TextureVariant  = 1 << 2,
+            PositionVariant = 1 << 3,
+            NormalVariant   = 1 << 4,
+            UVVariant       = 1 << 5,
+            ColorVariant    = 1 << 6,
+            UVWVariant      = 1 << 7,
+            ShaderTypeShift = 8     // ModelPart::ShaderType above
+        };
+    }
+
     std::shared_ptr<Shader> ModelPart::makeShader(FrameBuffer& fbo, ModelPart& mesh,
                                                   ModelPart::ShaderType shaderType,
                                                   char const*const vshSrc, char const*const fshSrc) 
@@ -65,14 +82,48 @@ namespace lab {
         else
             hasTexture = false;
 
-        bool deferred = fbo.drawBuffers.size() > 0;
+        // a depth shader writes no color, whatever the buffer holds
+        bool depthOnly = shaderType == ShaderType::depthShader;
+        bool deferred = !depthOnly && fbo.drawBuffers.size() > 0;
+
+        // a compact gbuffer holds albedo and an octahedral normal; position
+        // is reconstructed from depth by the passes that need it
+        bool compact = deferred &&
+            std::find(fbo.drawBufferNames.begin(), fbo.drawBufferNames.end(), "o_albedoTexture") != fbo.drawBufferNames.end();
+
+        // variant known, look it up by its features and any supplied source
 
-        // variant known, create variant identifier
+        uint16_t features = uint16_t(uint16_t(shaderType) << ShaderTypeShift);
+        if (deferred)             features |= DeferredVariant;
+        if (compact)              features |= CompactVariant;
+        if (hasTexture)           features |= TextureVariant;
+        if (hasPositionsAttr)     features |= PositionVariant;
+        if (hasNormalsAttr)       features |= NormalVariant;
+        if (hasTextureCoordsAttr) features |= UVVariant;
+        if (hasVertexColorAttr)   features |= ColorVariant;
+        if (hasTextureCubeAttr)   features |= UVWVariant;
+
+        uint64_t sourceHash = 0;
+        if (vshSrc)
+            sourceHash = TextScanner::Hash(vshSrc, strlen(vshSrc));
+        if (fshSrc)
+            sourceHash = sourceHash * 31 + TextScanner::Hash(fshSrc, strlen(fshSrc));
+
+        ShaderBuilder sb;
+        const ShaderBuilder::VariantKey key = ShaderBuilder::variantKey(features, sourceHash);
+        if (std::shared_ptr<Shader> shader = sb.cache()->find(key)) {
+            vao->unbindVAO();
+            return shader;
+        }
+
+        // create the shader, named for messages
 
         string variantName;
         if (deferred)                            variantName += "D";
+        if (compact)                             variantName += "c";
         if (hasTexture)                          variantName += "t";
         if (shaderType == ShaderType::skyShader) variantName += "S";
+        if (depthOnly)                           variantName += "Z";
 
         variantName += "/";
         if (hasPositionsAttr)     variantName += "P";
@@ -87,32 +138,12 @@ namespace lab {
 		{
             case ModelPart::ShaderType::skyShader:    shaderName = "sky/"; break;
             case ModelPart::ShaderType::customShader: shaderName = "custom/"; break;
+            case ModelPart::ShaderType::depthShader:  shaderName = "depth/"; break;
             default:
             case ModelPart::ShaderType::meshShader:   shaderName = "mesh/"; break;
         }
         shaderName += variantName;
 
-        // hash in unique source to shader name if source was provided
-
-        if (vshSrc) {
-            uint64_t hash = TextScanner::Hash(vshSrc, strlen(vshSrc));
-            std::stringstream ss;
-            ss << "/v" << hash;
-            shaderName += ss.str();
-        }
-        if (fshSrc) {
-            uint64_t hash = TextScanner::Hash(fshSrc, strlen(fshSrc));
-            std::stringstream ss;
-            ss << "/f" << hash;
-            shaderName += ss.str();
-        }
-
-        // create the shader if it doesn't already exist
-
-        ShaderBuilder sb;
-        if (sb.cache()->hasShader(shaderName))
-            return sb.cache()->shader(shaderName);
-
         Semantic varyings[] {
             { SemanticType::vec4_st, "v_pos", AutomaticUniform::none, 0 },
             { SemanticType::vec3_st, "v_normal", AutomaticUniform::none, 1 },
@@ -142,8 +173,21 @@ namespace lab {
         if (hasTextureCubeAttr || shaderType == ShaderType::skyShader) 
             uniforms[6].type = SemanticType::samplerCube_st;
 
-        sb.setGbuffer(fbo);
         sb.setAttributes(mesh);
+        if (depthOnly) {
+            // only the clip position, transformed exactly as the mesh shader
+            // does, so that an equal depth test passes against it
+            sb.setUniforms(&uniforms[3], 1);
+            string vsh = "invariant gl_Position;\n"
+                         "void main() {\n" glsl( gl_Position = u_modelViewProj * vec4(a_position, 1.0); ) "}\n";
+            string fsh = "void main() {}\n";
+            std::shared_ptr<Shader> shader = sb.makeShader(shaderName, vsh.c_str(), fsh.c_str(), * mesh.verts());
+            shader = sb.cache()->add(key, shader);
+            vao->unbindVAO();
+            return shader;
+        }
+
+        sb.setGbuffer(fbo);
         sb.setVaryings(varyings, hasVertexColorAttr? 4 : 3);
         sb.setUniforms(uniforms, sizeof(uniforms)/sizeof(Semantic));
         std::shared_ptr<Shader> shader = std::make_shared<Shader>();
@@ -153,7 +197,8 @@ namespace lab {
         if (vshSrc)
             vsh.assign(vshSrc);
         else {
-            vsh = "void main() {\n" glsl(
+            vsh = "invariant gl_Position;\n"
+                  "void main() {\n" glsl(
                                          vec4 pos = vec4(a_position, 1.0);
                                          vec4 n = u_jacobian * vec4(a_normal, 1.0);
                                          vec4 newPos = u_modelViewProj * pos;
@@ -177,18 +222,25 @@ namespace lab {
         else {
             fsh = "void main() { \n";
             if (deferred) {
-                fsh += glsl( o_normalTexture = vec4(vert.v_normal, 1.0);
-                             o_positionTexture = vert.v_pos; );
                 if (hasTexture && hasVertexColorAttr)
-                    fsh += glsl( o_diffuseTexture = texture(u_texture, vert.v_uv) * vert.v_color; );
+                    fsh += glsl( vec4 albedo = texture(u_texture, vert.v_uv) * vert.v_color; );
                 else if (hasTextureCubeAttr)
-                    fsh += glsl( o_diffuseTexture = texture(u_texture, vert.v_uvw).bgra; );
+                    fsh += glsl( vec4 albedo = texture(u_texture, vert.v_uvw).bgra; );
                 else if (hasTexture)
-                    fsh += glsl( o_diffuseTexture = texture(u_texture, vert.v_uv).bgra; );
+                    fsh += glsl( vec4 albedo = texture(u_texture, vert.v_uv).bgra; );
                 else if (hasVertexColorAttr)
-                    fsh += glsl( o_diffuseTexture = vert.v_color; );
+                    fsh += glsl( vec4 albedo = vert.v_color; );
+                else
+                    fsh += glsl( vec4 albedo = vec4(1.0,1.0,1.0,1.0); );
+
+                if (compact)
+                    // materials don't carry a roughness yet, so alpha holds a constant one
+                    fsh += glsl( o_albedoTexture = vec4(albedo.rgb, 0.5);
+                                 o_normalTexture = vec4(octEncode(normalize(vert.v_normal)), 0.0, 1.0); );
                 else
-                    fsh += glsl( o_diffuseTexture = vec4(1.0,1.0,1.0,1.0); );
+                    fsh += glsl( o_diffuseTexture = albedo;
+                                 o_normalTexture = vec4(vert.v_normal, 1.0);
+                                 o_positionTexture = vert.v_pos; );
             }
             else {
                 // forward shaded
@@ -211,7 +263,7 @@ namespace lab {
         }
 
         shader = sb.makeShader(shaderName, vsh.c_str(), fsh.c_str(), * mesh.verts());
-        sb.cache()->add(shaderName, shader);
+        shader = sb.cache()->add(key, shader);
 
         vao->unbindVAO();
 
@@ -220,8 +272,11 @@ namespace lab {
 
 
 
-    void ModelPart::draw(FrameBuffer& fbo, Renderer::RenderLock& rl) {
-        if (_verts && !_shader) {
+    void ModelPart::requestShader(FrameBuffer& fbo) {
+        if (_verts && ((!_shader && !_shaderRequested) || _shaderStale)) {
+            bool reloading = _shaderStale;
+            _shaderRequested = true;
+            _shaderStale = false;
             string vsh;
             string fsh;
 
@@ -232,6 +287,7 @@ namespace lab {
                 if (!!vsIO && !!fsIO) {
                     string vs = vsIO->value<string>();
                     string fs = fsIO->value<string>();
+                    _shaderFiles = { expandPath(vs.c_str()), expandPath(fs.c_str()) };
                     //const OutletData<string>* vs = vsIO->out<string>();
                     //const OutletData<string>* fs = fsIO->out<string>();
                     //std::string foo = vs->value();
@@ -265,29 +321,93 @@ namespace lab {
             }
 
             if (!vsh.length() || !fsh.length()) {
-                // if a shader has not been externally supplied, assume a default mesh shader
-                _shader = makeShader(fbo, *this, _shaderType, 0, 0);
+                // if a shader has not been externally supplied, assume a default mesh
+                // shader; files that can't be read on a reload keep the program
+                if (!reloading)
+                    _shader = makeShader(fbo, *this, _shaderType, 0, 0);
             }
-            else {
+            else if (!reloading) {
                 _shader = makeShader(fbo, *this, _shaderType, vsh.c_str(), fsh.c_str());
             }
+            else {
+                try {
+                    _shader = makeShader(fbo, *this, _shaderType, vsh.c_str(), fsh.c_str());
+                }
+                catch (std::exception & e) {
+                    printf("Reload: %s failed to compile, keeping its program\n%s\n", _shaderFiles.back().c_str(), e.what());
+                }
+            }
         }
-        if (_verts && _shader) {
+    }
+
+    void ModelPart::shaderFiles(std::vector<std::string> & files) const {
+        files.insert(files.end(), _shaderFiles.begin(), _shaderFiles.end());
+    }
+
+    void ModelPart::reloadShaders(const std::vector<std::string> & changed) {
+        for (auto & f : _shaderFiles)
+            if (std::find(changed.begin(), changed.end(), f) != changed.end())
+                _shaderStale = true;
+    }
+
+    void ModelPart::requestDepthShader(FrameBuffer& fbo) {
+        if (_verts && !_depthShader && !_depthShaderRequested) {
+            _depthShaderRequested = true;
+            _depthShader = makeShader(fbo, *this, ShaderType::depthShader, 0, 0);
+        }
+    }
+
+    bool ModelPart::drawsDepthAsColor() const {
+        bool ownState = false;
+        if (!!material) {
+            ownState = !!material->propertyInlet(ShaderMaterial::vertexShaderFileName()) ||
+                       !!material->propertyInlet(ShaderMaterial::depthWriteName()) ||
+                       !!material->propertyInlet(ShaderMaterial::depthRangeName()) ||
+                       !!material->propertyInlet(ShaderMaterial::depthFuncName());
+        }
+        return ownState || _shaderType != ShaderType::meshShader;
+    }
+
+    void ModelPart::prepareShaders(FrameBuffer& fbo, bool depth) {
+        if (depth && !drawsDepthAsColor())
+            requestDepthShader(fbo);
+        else
+            requestShader(fbo);
+    }
+
+    void ModelPart::draw(FrameBuffer& fbo, Renderer::RenderLock& rl) {
+        LR_PROFILE_ZONE("ModelPart::draw");
+        requestShader(fbo);
+
+        // a program warmed up async is waited for, unless draws may be skipped
+        if (_shader && !ShaderBuilder::asyncCompile())
+            _shader->finish();
+
+        // a program still compiling is skipped, see ShaderBuilder::setAsyncCompile
+        if (_verts && _shader && _shader->ready()) {
             _shader->bind(rl);
+            if (_locations.program != _shader->id) {
+                _locations.program = _shader->id;
+                _locations.view = _shader->uniform("u_view");
+                _locations.modelView = _shader->uniform("u_modelView");
+                _locations.modelViewProj = _shader->uniform("u_modelViewProj");
+                _locations.jacobian = _shader->uniform("u_jacobian");
+                _locations.texture = _shader->uniform("u_texture");
+            }
             if (_shaderType == ShaderType::skyShader) {
                 lab::m44f invMv = rl.context.viewMatrices.mv;
                 // remove translation
                 invMv.columns[3].x = 0;
                 invMv.columns[3].y = 0;
                 invMv.columns[3].z = 0;
-                _shader->uniform("u_modelView", invMv);
+                _shader->uniform(_locations.modelView, invMv);
                 lab::m44f mvproj = matrix_multiply(rl.context.viewMatrices.projection, invMv);
-                _shader->uniform("u_modelViewProj", mvproj);
+                _shader->uniform(_locations.modelViewProj, mvproj);
             }
             else {
-                _shader->uniform("u_view", rl.context.viewMatrices.view);
-                _shader->uniform("u_modelView", rl.context.viewMatrices.mv);
-                _shader->uniform("u_modelViewProj", rl.context.viewMatrices.mvp);
+                _shader->uniform(_locations.view, rl.context.viewMatrices.view);
+                _shader->uniform(_locations.modelView, rl.context.viewMatrices.mv);
+                _shader->uniform(_locations.modelViewProj, rl.context.viewMatrices.mvp);
             }
 
             lab::m44f jacobian = rl.context.viewMatrices.model;
@@ -295,24 +415,32 @@ namespace lab {
             jacobian.columns[3].y = 0;
             jacobian.columns[3].z = 0;
             jacobian = matrix_transpose(matrix_invert(jacobian));
-            _shader->uniform("u_jacobian", jacobian);
+            _shader->uniform(_locations.jacobian, jacobian);
 
-            bool depthWriteSet = true;
+            // a material's depth state lasts for its draw; the pass's comes back
+            // after, as a geometry pass behind a prepass tests for equality
+            bool passDepthWrite = glState().depthMask();
+            unsigned int passDepthFunc = glState().depthFunc();
+            bool depthWriteSet = false;
             bool depthRangeSet = false;
             bool depthFuncSet = false;
             if (!!material) {
                 shared_ptr<InOut> baseColorInOut = material->propertyInlet(ShaderMaterial::baseColorName());
                 if (!!baseColorInOut) {
                     shared_ptr<Texture> texture = baseColorInOut->value<shared_ptr<Texture>>();
+                    if (rl.context.textureStreamer && texture)
+                        rl.context.textureStreamer->request(*texture,
+                            TextureStreamer::texelDensity(*texture, _localBounds, rl.context.viewMatrices.mv,
+                                                          rl.context.viewMatrices.projection, rl.context.renderTargetSize));
                     int unit = rl.context.activeTextureUnit;
                     texture->bind(unit);
-                    _shader->uniformInt("u_texture", unit);
+                    _shader->uniformInt(_locations.texture, unit);
                     rl.context.activeTextureUnit++;
                 }
                 shared_ptr<InOut> dwInOut = material->propertyInlet(ShaderMaterial::depthWriteName());
                 if (!!dwInOut) {
-                    depthWriteSet = dwInOut->value<float>() > 0;
-                    glDepthMask(depthWriteSet? GL_TRUE : GL_FALSE);
+                    depthWriteSet = true;
+                    glState().depthMask(dwInOut->value<float>() > 0);
                 }
                 shared_ptr<InOut> drIO = material->propertyInlet(ShaderMaterial::depthRangeName());
                 if (!!drIO) {
@@ -324,7 +452,7 @@ namespace lab {
                 if (!!dfIO) {
                     depthFuncSet = true;
                     int dfunc = GL_LESS;
-                    string df = dfIO->value<string>();
+                    const string & df = dfIO->value<string>();
                     if      (df == "less")     dfunc = GL_LESS;
                     else if (df == "lequal")   dfunc = GL_LEQUAL;
                     else if (df == "never")    dfunc = GL_NEVER;
@@ -333,31 +461,69 @@ namespace lab {
                     else if (df == "notequal") dfunc = GL_NOTEQUAL;
                     else if (df == "gequal")   dfunc = GL_GEQUAL;
                     else if (df == "always")   dfunc = GL_ALWAYS;
-                    glDepthFunc(dfunc);
+                    glState().depthFunc(dfunc);
                 }
             }
-            glDisable(GL_CULL_FACE);
+            glState().disable(GL_CULL_FACE);
             
             // Draw the model
             //
             _verts->draw();
+            rl.context.drawCount++;
+            rl.context.triangleCount += _verts->triangleCount();
             
-            if (!depthWriteSet) {
-                glDepthMask(GL_TRUE);
+            if (depthWriteSet) {
+                glState().depthMask(passDepthWrite);
             }
-            if (!depthRangeSet) {
+            if (depthRangeSet) {
                 glDepthRange(0, 1);
             }
-            if (!depthFuncSet) {
-                glDepthFunc(GL_LESS);
+            if (depthFuncSet) {
+                glState().depthFunc(passDepthFunc);
             }
-            _shader->unbind();
         }
     }
 
+    void ModelPart::drawDepth(FrameBuffer& fbo, Renderer::RenderLock& rl) {
+        LR_PROFILE_ZONE("ModelPart::drawDepth");
+        if (drawsDepthAsColor()) {
+            draw(fbo, rl);
+            return;
+        }
+
+        requestDepthShader(fbo);
+        if (!ShaderBuilder::asyncCompile()) {
+            if (_depthShader)
+                _depthShader->finish();
+            if (_shader)
+                _shader->finish();
+        }
+        if (!_verts || !_depthShader || !_depthShader->ready())
+            return;
+
+        // depth drawn here that draw() can't fill in yet would leave a hole
+        // under an equal depth test
+        if (_shader ? !_shader->ready() : ShaderBuilder::asyncCompile())
+            return;
+
+        _depthShader->bind(rl);
+        if (_depthLocations.program != _depthShader->id) {
+            _depthLocations.program = _depthShader->id;
+            _depthLocations.modelViewProj = _depthShader->uniform("u_modelViewProj");
+        }
+        _depthShader->uniform(_depthLocations.modelViewProj, rl.context.viewMatrices.mvp);
+
+        // as draw does, so that the same fragments are produced
+        glState().disable(GL_CULL_FACE);
+        _verts->draw();
+        rl.context.drawCount++;
+        rl.context.triangleCount += _verts->triangleCount();
+    }
+
     void ModelPart::setVAO(std::unique_ptr<VAO> vao, Bounds localBounds) {
         _verts = std::move(vao);
         _localBounds = localBounds;
+        _shaderRequested = _depthShaderRequested = false;
     }
 
 
@@ -376,6 +542,26 @@ namespace lab {
             p->draw(fbo, rl);
     }
 
+    void Model::drawDepth(FrameBuffer& fbo, Renderer::RenderLock & rl) {
+        for (auto p : _parts)
+            p->drawDepth(fbo, rl);
+    }
+
+    void Model::prepareShaders(FrameBuffer& fbo, bool depth) {
+        for (auto p : _parts)
+            p->prepareShaders(fbo, depth);
+    }
+
+    void Model::shaderFiles(std::vector<std::string> & files) const {
+        for (auto & p : _parts)
+            p->shaderFiles(files);
+    }
+
+    void Model::reloadShaders(const std::vector<std::string> & changed) {
+        for (auto & p : _parts)
+            p->reloadShaders(changed);
+    }
+
     Bounds Model::localBounds() const {
         Bounds bounds;
         bounds.first = {FLT_MAX, FLT_MAX, FLT_MAX};
@@ -0,0 +1,461 @@
+//
+//  OcclusionCuller.cpp
+//  LabRender
+//
+//
+
+#include "LabRender/OcclusionCuller.h"
+
+#include "LabRender/gl4.h"
+#include "LabRender/DrawList.h"
+#include "LabRender/FrameProfiler.h"
+#include "LabRender/GLState.h"
+#include "LabRender/ModelBase.h"
+#include "LabRender/Profiler.h"
+#include "LabRender/Shader.h"
+#include "LabRender/ShaderBuilder.h"
+#include "LabRender/Texture.h"
+#include "LabRender/UtilityModel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace lab {
+
+    namespace {
+
+        // true if every corner is in front of the eye
+        bool inFront(const m44f & mvp, const Bounds & b)
+        {
+            for (int i = 0; i < 8; ++i)
+                if (matrix_multiply(mvp, v4f(boundsCorner(b, i), 1.f)).w <= 1e-4f)
+                    return false;
+            return true;
+        }
+
+        // a box that can be rasterized; a line or a point can't pass a query
+        bool hasArea(const Bounds & b)
+        {
+            int flat = 0;
+            flat += !(b.second.x > b.first.x);
+            flat += !(b.second.y > b.first.y);
+            flat += !(b.second.z > b.first.z);
+            return b.first.x <= b.second.x && b.first.y <= b.second.y && b.first.z <= b.second.z && flat < 2;
+        }
+
+        int reducedSize(int s)
+        {
+            return std::max(1, s / 2);
+        }
+
+    } // anon
+
+    OcclusionCuller::OcclusionCuller()
+    : _readbacks(3)
+    {
+    }
+
+    OcclusionCuller::~OcclusionCuller()
+    {
+        for (auto & l : _gpuLevels)
+            if (l.fbo)
+                glState().deleteFramebuffer(l.fbo);
+        for (auto & r : _readbacks) {
+            if (r.fence)
+                glDeleteSync((GLsync) r.fence);
+            if (r.pbo)
+                glDeleteBuffers(1, &r.pbo);
+        }
+        for (unsigned int q : _queries)
+            if (q)
+                glDeleteQueries(1, &q);
+    }
+
+    void OcclusionCuller::setSettings(const Settings & s)
+    {
+        _settings.readbackSize = std::max(1, s.readbackSize);
+        _settings.maxAgeFrames = std::max(1, s.maxAgeFrames);
+        _gpuWidth = _gpuHeight = 0;     // the readback level may change
+    }
+
+    void OcclusionCuller::buildCpuPyramid(const float * depth, int width, int height,
+                                          float texelsX, float texelsY, const m44f & viewProj, uint64_t frame)
+    {
+        int count = 1;
+        for (int w = width, h = height; w > 1 || h > 1; w = reducedSize(w), h = reducedSize(h))
+            ++count;
+        _levels.resize(count);
+
+        _levels[0].width = width;
+        _levels[0].height = height;
+        _levels[0].depth.assign(depth, depth + size_t(width) * height);
+
+        // as the GPU reduces: each texel takes the two by two below it, and
+        // the last row and column also take an odd one out
+        for (int l = 1; l < count; ++l) {
+            const Level & src = _levels[l - 1];
+            Level & dst = _levels[l];
+            dst.width = reducedSize(src.width);
+            dst.height = reducedSize(src.height);
+            dst.depth.assign(size_t(dst.width) * dst.height, 0.f);
+            for (int y = 0; y < src.height; ++y) {
+                int dy = std::min(dst.height - 1, y >> 1);
+                for (int x = 0; x < src.width; ++x) {
+                    float & d = dst.depth[size_t(dy) * dst.width + std::min(dst.width - 1, x >> 1)];
+                    d = std::max(d, src.depth[size_t(y) * src.width + x]);
+                }
+            }
+        }
+
+        _texelsX = texelsX;
+        _texelsY = texelsY;
+        _viewProj = viewProj;
+        _pyramidFrame = frame;
+        _hasPyramid = true;
+    }
+
+    void OcclusionCuller::setDepth(const float * depth, int width, int height, const m44f & viewProj)
+    {
+        if (!depth || width < 1 || height < 1)
+            return;
+        buildCpuPyramid(depth, width, height, float(width), float(height), viewProj, _frame);
+    }
+
+    bool OcclusionCuller::occluded(const m44f & model, const Bounds & local) const
+    {
+        if (!_hasPyramid)
+            return false;
+
+        const m44f mvp = matrix_multiply(_viewProj, model);
+        float x0 = 1e30f, y0 = 1e30f, x1 = -1e30f, y1 = -1e30f;
+        float nearest = 1e30f;
+        for (int i = 0; i < 8; ++i) {
+            v4f p = matrix_multiply(mvp, v4f(boundsCorner(local, i), 1.f));
+            if (p.w <= 1e-4f)
+                return false;
+            float inv = 1.f / p.w;
+            x0 = std::min(x0, p.x * inv);
+            x1 = std::max(x1, p.x * inv);
+            y0 = std::min(y0, p.y * inv);
+            y1 = std::max(y1, p.y * inv);
+            nearest = std::min(nearest, p.z * inv);
+        }
+        // what was off screen then can't be judged; the rest can, as the
+        // retest catches anything that has come into view since
+        if (x1 < -1.f || x0 > 1.f || y1 < -1.f || y0 > 1.f)
+            return false;
+        x0 = std::max(x0, -1.f);
+        y0 = std::max(y0, -1.f);
+        x1 = std::min(x1, 1.f);
+        y1 = std::min(y1, 1.f);
+
+        // window depth, and the rectangle in level 0 texels
+        nearest = nearest * 0.5f + 0.5f;
+        const Level & base = _levels[0];
+        int tx0 = std::min(base.width - 1,  int((x0 * 0.5f + 0.5f) * _texelsX));
+        int tx1 = std::min(base.width - 1,  int((x1 * 0.5f + 0.5f) * _texelsX));
+        int ty0 = std::min(base.height - 1, int((y0 * 0.5f + 0.5f) * _texelsY));
+        int ty1 = std::min(base.height - 1, int((y1 * 0.5f + 0.5f) * _texelsY));
+
+        // the finest level where the rectangle spans at most two by two
+        int l = 0;
+        while (l + 1 < int(_levels.size()) && ((tx1 >> l) - (tx0 >> l) > 1 || (ty1 >> l) - (ty0 >> l) > 1))
+            ++l;
+
+        const Level & level = _levels[l];
+        float farthest = 0;
+        for (int y = std::min(level.height - 1, ty0 >> l); y <= std::min(level.height - 1, ty1 >> l); ++y)
+            for (int x = std::min(level.width - 1, tx0 >> l); x <= std::min(level.width - 1, tx1 >> l); ++x)
+                farthest = std::max(farthest, level.depth[size_t(y) * level.width + x]);
+        return nearest > farthest;
+    }
+
+    void OcclusionCuller::collectReadbacks()
+    {
+        // the newest finished readback wins; older finished ones are dropped
+        Readback * newest = nullptr;
+        for (Readback & r : _readbacks) {
+            if (!r.fence)
+                continue;
+            GLenum result = glClientWaitSync((GLsync) r.fence, 0, 0);
+            if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED && result != GL_WAIT_FAILED)
+                continue;
+            glDeleteSync((GLsync) r.fence);
+            r.fence = nullptr;
+            if (result != GL_WAIT_FAILED && (!newest || r.frame > newest->frame))
+                newest = &r;
+        }
+        if (!newest || (_hasPyramid && newest->frame <= _pyramidFrame))
+            return;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, newest->pbo);
+        size_t bytes = size_t(newest->width) * newest->height * sizeof(float);
+        const float * data = (const float *) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+        if (data) {
+            buildCpuPyramid(data, newest->width, newest->height,
+                            newest->texelsX, newest->texelsY, newest->viewProj, newest->frame);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    void OcclusionCuller::update(const DrawList & drawList)
+    {
+        LR_PROFILE_ZONE("OcclusionCuller::update");
+        ++_frame;
+        _stats = Stats();
+        _retested = false;
+
+        collectReadbacks();
+
+        const size_t count = drawList.deferredMeshes.size();
+        _culled.assign(count, 0);
+        if (!_hasPyramid)
+            return;
+
+        _stats.pyramidAge = int(_frame - _pyramidFrame);
+        if (_stats.pyramidAge > _settings.maxAgeFrames)
+            return;
+
+        // a culled model's box is queried from the current view, where it
+        // has to be wholly in front of the eye to be rasterized
+        _currentViewProj = matrix_multiply(drawList.proj, drawList.view);
+        for (size_t i = 0; i < count; ++i) {
+            const ModelBase & model = *drawList.deferredMeshes[i];
+            const Bounds local = model.localBounds();
+            if (!hasArea(local))
+                continue;
+            const m44f & t = model.transform.transform();
+            ++_stats.tested;
+            if (occluded(t, local) && inFront(matrix_multiply(_currentViewProj, t), local)) {
+                _culled[i] = 1;
+                ++_stats.culled;
+            }
+        }
+    }
+
+    void OcclusionCuller::prepareShaders()
+    {
+        if (!_boxShader) {
+            _boxShader = ShaderBuilder::makeProgram("occlusion-box", glsl(
+                layout(location = 0) in vec3 a_position;
+                uniform mat4 u_modelViewProj;
+                void main() { gl_Position = u_modelViewProj * vec4(a_position, 1.0); }
+            ), glsl(
+                void main() {}
+            ));
+        }
+        if (!_reduceShader) {
+            _reduceShader = ShaderBuilder::makeProgram("depth-pyramid", glsl(
+                layout(location = 0) in vec3 a_position;
+                void main() { gl_Position = vec4(a_position.xy, 0.0, 1.0); }
+            ), glsl(
+                uniform sampler2D u_source;
+                uniform vec2 u_sourceSize;
+                uniform vec2 u_destSize;
+                layout(location = 0) out float o_depth;
+                void main() {
+                    // two by two, and the odd row or column out at the far edges
+                    ivec2 dst = ivec2(gl_FragCoord.xy);
+                    ivec2 src = ivec2(u_sourceSize);
+                    ivec2 begin = dst * 2;
+                    ivec2 end = begin + ivec2(2);
+                    if (dst.x == int(u_destSize.x) - 1) end.x = src.x;
+                    if (dst.y == int(u_destSize.y) - 1) end.y = src.y;
+                    float d = 0.0;
+                    for (int y = begin.y; y < end.y; ++y)
+                        for (int x = begin.x; x < end.x; ++x)
+                            d = max(d, texelFetch(u_source, min(ivec2(x, y), src - 1), 0).r);
+                    o_depth = d;
+                }
+            ));
+        }
+    }
+
+    void OcclusionCuller::retest(Renderer::RenderLock & rl)
+    {
+        if (_retested || !_stats.culled)
+            return;
+        _retested = true;
+        LR_PROFILE_ZONE("OcclusionCuller::retest");
+
+        prepareShaders();
+        if (_boxMvpLocation < 0) {
+            _boxShader->finish();
+            _boxMvpLocation = int(_boxShader->uniform("u_modelViewProj"));
+        }
+        if (!_box) {
+            UtilityModel * box = new UtilityModel();
+            box->createBox(0.5f, 0.5f, 0.5f, 1, 1, 1, false, false);
+            _box.reset(box);
+        }
+        if (_queries.size() < _culled.size())
+            _queries.resize(_culled.size(), 0);
+
+        // the boxes touch neither color nor depth, nor the profiler's count
+        FrameProfiler * profiler = rl.context.profiler;
+        if (profiler)
+            profiler->pauseSamples();
+        bool depthWrite = glState().depthMask();
+        unsigned int depthFunc = glState().depthFunc();
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glState().depthMask(false);
+        glState().enable(GL_DEPTH_TEST);
+        glState().depthFunc(GL_LEQUAL);
+        glState().disable(GL_CULL_FACE);
+        _boxShader->bind(rl);
+
+        const auto & meshes = rl.context.drawList->deferredMeshes;
+        for (size_t i = 0; i < _culled.size(); ++i) {
+            if (!_culled[i])
+                continue;
+            if (!_queries[i])
+                glGenQueries(1, &_queries[i]);
+
+            // the unit box, scaled and moved onto the local bounds
+            const ModelBase & model = *meshes[i];
+            const Bounds b = model.localBounds();
+            m44f fit = m44f_identity;
+            fit.m[0] = b.second.x - b.first.x;
+            fit.m[5] = b.second.y - b.first.y;
+            fit.m[10] = b.second.z - b.first.z;
+            fit.m[12] = (b.first.x + b.second.x) * 0.5f;
+            fit.m[13] = (b.first.y + b.second.y) * 0.5f;
+            fit.m[14] = (b.first.z + b.second.z) * 0.5f;
+            m44f mvp = matrix_multiply(_currentViewProj, matrix_multiply(model.transform.transform(), fit));
+            _boxShader->uniform(_boxMvpLocation, mvp);
+
+            glBeginQuery(GL_ANY_SAMPLES_PASSED, _queries[i]);
+            _box->draw();
+            glEndQuery(GL_ANY_SAMPLES_PASSED);
+            ++rl.context.drawCount;
+            ++_stats.retested;
+        }
+
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glState().depthMask(depthWrite);
+        glState().depthFunc(depthFunc);
+        if (profiler)
+            profiler->resumeSamples();
+    }
+
+    void OcclusionCuller::beginConditional(size_t meshIndex)
+    {
+        // the GPU waits on the query, the CPU doesn't
+        if (meshIndex < _queries.size() && _queries[meshIndex])
+            glBeginConditionalRender(_queries[meshIndex], GL_QUERY_WAIT);
+    }
+
+    void OcclusionCuller::endConditional()
+    {
+        glEndConditionalRender();
+    }
+
+    void OcclusionCuller::buildPyramid(Renderer::RenderLock & rl, const Texture & depth, v2i size, const m44f & viewProj)
+    {
+        LR_PROFILE_ZONE("OcclusionCuller::buildPyramid");
+        if (size.x < 1 || size.y < 1)
+            return;
+
+        // levels are made for the whole texture, and the drawn part of each
+        // is used, so that dynamic resolution doesn't reallocate
+        if (_gpuWidth != depth.width || _gpuHeight != depth.height) {
+            for (auto & l : _gpuLevels)
+                if (l.fbo)
+                    glState().deleteFramebuffer(l.fbo);
+            _gpuLevels.clear();
+            _gpuWidth = depth.width;
+            _gpuHeight = depth.height;
+            int w = reducedSize(depth.width), h = reducedSize(depth.height);
+            while (true) {
+                GpuLevel level;
+                level.texture = std::make_shared<Texture>();
+                level.texture->create(w, h, TextureType::f32x1, GL_NEAREST, GL_CLAMP_TO_EDGE);
+                glGenFramebuffers(1, &level.fbo);
+                glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, level.fbo);
+                glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, level.texture->id, 0);
+                _gpuLevels.push_back(level);
+                if (std::max(w, h) <= _settings.readbackSize || (w == 1 && h == 1))
+                    break;
+                w = reducedSize(w);
+                h = reducedSize(h);
+            }
+        }
+
+        prepareShaders();
+        if (_sourceLocation < 0) {
+            _reduceShader->finish();
+            _sourceLocation = int(_reduceShader->uniform("u_source"));
+            _sourceSizeLocation = int(_reduceShader->uniform("u_sourceSize"));
+            _destSizeLocation = int(_reduceShader->uniform("u_destSize"));
+        }
+        if (!_quad) {
+            UtilityModel * quad = new UtilityModel();
+            quad->createFullScreenQuad();
+            _quad.reset(quad);
+        }
+
+        glState().disable(GL_DEPTH_TEST);
+        glState().disable(GL_BLEND);
+        glState().disable(GL_CULL_FACE);
+        glState().disable(GL_SCISSOR_TEST);
+        _reduceShader->bind(rl);
+        int unit = rl.context.activeTextureUnit;
+
+        const Texture * source = &depth;
+        int w = std::min(size.x, depth.width), h = std::min(size.y, depth.height);
+        int levels = 0;
+        for (GpuLevel & level : _gpuLevels) {
+            int dw = reducedSize(w), dh = reducedSize(h);
+            glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, level.fbo);
+            unsigned int attachment = GL_COLOR_ATTACHMENT0;
+            glState().drawBuffers(1, &attachment);
+            glState().viewport(0, 0, dw, dh);
+            source->bind(unit);
+            _reduceShader->uniformInt(_sourceLocation, unit);
+            _reduceShader->uniform(_sourceSizeLocation, v2f(float(w), float(h)));
+            _reduceShader->uniform(_destSizeLocation, v2f(float(dw), float(dh)));
+            _quad->draw();
+            ++rl.context.drawCount;
+
+            source = level.texture.get();
+            w = dw;
+            h = dh;
+            ++levels;
+            if (std::max(w, h) <= _settings.readbackSize)
+                break;
+        }
+
+        // read the last level back, unless the slot is still in flight
+        Readback & r = _readbacks[_nextReadback];
+        if (r.fence)
+            return;
+        _nextReadback = (_nextReadback + 1) % int(_readbacks.size());
+
+        size_t bytes = size_t(w) * h * sizeof(float);
+        if (!r.pbo)
+            glGenBuffers(1, &r.pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, r.pbo);
+        if (r.bytes < bytes) {
+            glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+            r.bytes = bytes;
+        }
+        glState().bindFramebuffer(GL_READ_FRAMEBUFFER, _gpuLevels[levels - 1].fbo);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glReadPixels(0, 0, w, h, GL_RED, GL_FLOAT, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        // level 0 texels across the viewport; the reductions floor, so the
+        // last texel of a level may cover more than its share
+        r.width = w;
+        r.height = h;
+        r.texelsX = float(size.x) / float(1 << levels);
+        r.texelsY = float(size.y) / float(1 << levels);
+        r.viewProj = viewProj;
+        r.frame = _frame;
+    }
+
+} // lab
@@ -9,8 +9,11 @@
 #include "LabRender/PassRenderer.h"
 
 #include "LabRender/Camera.h"
+#include "LabRender/DynamicResolution.h"
 #include "LabRender/FrameBuffer.h"
+#include "LabRender/LightClusters.h"
 #include "LabRender/Model.h"
+#include "LabRender/Profiler.h"
 #include "LabRender/SemanticType.h"
 #include "LabRender/ShaderBuilder.h"
 #include "LabRender/Texture.h"
@@ -19,7 +22,9 @@
 #include "LabRender/gl4.h"
 #include "json/json.h"
 
+#include <algorithm>
 #include <fstream>
+#include <set>
 
 using namespace lab;
 using namespace std;
@@ -35,23 +40,24 @@ PassRenderer::Pass::Pass(const std::string& name, int passNumber)
 {
 }
 
-void PassRenderer::Pass::bindInputTextures(RenderLock & rl, const FramebufferSet & fbos)
+void PassRenderer::Pass::bindInputTextures(RenderLock & rl)
 {
-    for (const pair<string, vector<string>>& readBuffer : readAttachments) {
-        std::shared_ptr<FrameBuffer> gbufferAOVs = fbos.fbo(readBuffer.first);
-        int bindBase = rl.context.activeTextureUnit;
-        for (const string& a : readBuffer.second) {
-            for (int i = 0; i < gbufferAOVs->drawBuffers.size(); ++i) {
-                if (gbufferAOVs->baseNames[i] == a) {
-                    gbufferAOVs->textures[i]->bind(bindBase);
-                    if (_shader)
-                        _shader->uniformInt(gbufferAOVs->uniformNames[i].c_str(), bindBase);
-                    ++bindBase;
-                }
-            }
-        }
-        rl.context.activeTextureUnit = bindBase;
+    if (_shader && inputProgram != _shader->id) {
+        for (InputTexture & input : inputTextures)
+            input.location = _shader->uniform(input.uniformName.c_str());
+        inputProgram = _shader->id;
+    }
+
+    int bindBase = rl.context.activeTextureUnit;
+    for (const InputTexture & input : inputTextures) {
+        if (input.attachment >= int(input.fbo->textures.size()))
+            continue;
+        input.fbo->textures[input.attachment]->bind(bindBase);
+        if (_shader)
+            _shader->uniformInt(input.location, bindBase);
+        ++bindBase;
     }
+    rl.context.activeTextureUnit = bindBase;
 }
 
 void PassRenderer::Pass::prepareFullScreenQuadAndShader(const FramebufferSet & fbos)
@@ -59,74 +65,500 @@ void PassRenderer::Pass::prepareFullScreenQuadAndShader(const FramebufferSet & f
     if (!isQuadPass)
         return;
 
+    if (!_shader)
+        setShader(makeShader(fbos));
+}
+
+std::shared_ptr<Shader> PassRenderer::Pass::makeShader(const FramebufferSet & fbos)
+{
     if (!_fullScreenQuadMesh) {
         UtilityModel* quad = new UtilityModel();
         quad->createFullScreenQuad();
         _fullScreenQuadMesh.reset(quad);
     }
 
-    if (!_shader) {
-        std::shared_ptr<FrameBuffer> gbufferAOVs = fbos.fbo(writeBuffer);
+    std::shared_ptr<FrameBuffer> gbufferAOVs = fbos.fbo(writeBuffer);
+
+    ShaderBuilder sb;
+    if (gbufferAOVs)
+        sb.setGbuffer(*gbufferAOVs);
 
-        ShaderBuilder sb;
-        if (gbufferAOVs)
-            sb.setGbuffer(*gbufferAOVs);
+    _fullScreenQuadMesh->verts()->uploadVerts();
+    sb.setAttributes(* _fullScreenQuadMesh.get());
+    sb.setVaryings(shaderSpec);
+    sb.setUniforms(shaderSpec);
 
-        _fullScreenQuadMesh->verts()->uploadVerts();
-        sb.setAttributes(* _fullScreenQuadMesh.get());
-        sb.setVaryings(shaderSpec);
-        sb.setUniforms(shaderSpec);
+    shaderSpec.name = name();
+    const bool printShader = false;
 
-        shaderSpec.name = name();
-        const bool printShader = false;
+    return sb.makeShader(shaderSpec, * _fullScreenQuadMesh->verts(), printShader);
+}
 
-        _shader = sb.makeShader(shaderSpec, * _fullScreenQuadMesh->verts(), printShader);
+void PassRenderer::Pass::setShader(std::shared_ptr<Shader> shader)
+{
+    _shader = shader;
+    inputProgram = 0;
+    if (_fullScreenQuadMesh)
         _fullScreenQuadMesh->setShader(_shader);
-    }
 }
 
+void PassRenderer::Pass::adoptShader(const Pass & pass)
+{
+    if (!_fullScreenQuadMesh)
+        _fullScreenQuadMesh = pass._fullScreenQuadMesh;
+    setShader(pass._shader);
+}
 
-void PassRenderer::Pass::run(RenderLock& rl, const FramebufferSet& fbos)
+
+void PassRenderer::Pass::run(RenderLock& rl)
 {
+    LR_PROFILE_ZONE("Pass::run");
+
 	checkError(ErrorPolicy::onErrorThrow,
 		TestConditions::exhaustive, "Pass::run");
 
 	checkError(ErrorPolicy::onErrorThrow,
 		TestConditions::exhaustive, "Pass::run bind input textures");
 
-	if (isQuadPass) 
+    // a shader warmed up async is waited for, unless draws may be skipped
+    if (isQuadPass && !ShaderBuilder::asyncCompile())
+        _shader->finish();
+
+	if (isQuadPass && _shader->ready())
 	{
-        glViewport(0, 0, rl.context.framebufferSize.x, rl.context.framebufferSize.y);
+        // the viewport was set when the pass's buffer was bound
         _shader->bind(rl);
-		bindInputTextures(rl, fbos);	// binds the textures and the shader uniforms
+		bindInputTextures(rl);	// binds the textures and the shader uniforms
 		_fullScreenQuadMesh->verts()->draw();
+        rl.context.drawCount++;
+        rl.context.triangleCount += _fullScreenQuadMesh->verts()->triangleCount();
+    }
+    if (drawShadowCasters && rl.context.shadowAtlas)
+        rl.context.shadowAtlas->render(rl);
+
+    if (buildDepthPyramid && rl.context.occlusion && !inputTextures.empty())
+    {
+        // the drawn part of the depth buffer, and the matrix it was drawn with
+        const InputTexture & input = inputTextures[0];
+        if (input.attachment < int(input.fbo->textures.size())) {
+            const FrameBuffer & fbo = *input.fbo;
+            v2i size = { std::max(1, int(fbo.newViewport[2] * fbo.viewportScale + 0.5f)),
+                         std::max(1, int(fbo.newViewport[3] * fbo.viewportScale + 0.5f)) };
+            m44f viewProj = matrix_multiply(rl.context.drawList->proj, rl.context.drawList->view);
+            rl.context.occlusion->buildPyramid(rl, *fbo.textures[input.attachment], size, viewProj);
+        }
     }
-    if (drawOpaqueGeometry) 
+
+    if (drawOpaqueGeometry || drawDepthPrepass) 
 	{
-        std::shared_ptr<FrameBuffer> gbufferAOVs = fbos.fbo(writeBuffer);
+        FrameBuffer* gbufferAOVs = writeFbo.get();
+        OcclusionCuller* occlusion = rl.context.occlusion;
+        const SoftwareOcclusion* software = rl.context.softwareOcclusion;
+        const auto & meshes = rl.context.drawList->deferredMeshes;
 
-        for (auto model : rl.context.drawList->deferredMeshes) 
-		{
-            rl.context.viewMatrices.model = model->transform.transform();
+        auto drawModel = [&](ModelBase & model)
+        {
+            rl.context.viewMatrices.model = model.transform.transform();
             rl.context.viewMatrices.mv = matrix_multiply(rl.context.drawList->view, rl.context.viewMatrices.model);
             rl.context.viewMatrices.mvp = matrix_multiply(rl.context.drawList->proj, rl.context.viewMatrices.mv);
             rl.context.viewMatrices.view = rl.context.drawList->view;
             rl.context.viewMatrices.projection = rl.context.drawList->proj;
-            model->draw(*gbufferAOVs.get(), rl);
+            if (drawDepthPrepass)
+                model.drawDepth(*gbufferAOVs, rl);
+            else
+                model.draw(*gbufferAOVs, rl);
+        };
+
+        // each model is a draw bucket for profiling
+        FrameProfiler* profiler = rl.context.profiler;
+        char bucketName[64];
+        int bucket = 0;
+
+        for (size_t i = 0; i < meshes.size(); ++i)
+		{
+            if ((software && software->culled(i)) || (occlusion && occlusion->culled(i)))
+                continue;
+
+            int zone = -1;
+            int draws = rl.context.drawCount;
+            int64_t triangles = rl.context.triangleCount;
+            if (profiler) {
+                snprintf(bucketName, sizeof(bucketName), "%s/%d", _name.c_str(), bucket);
+                zone = profiler->beginZone(bucketName, 1);
+            }
+
+            drawModel(*meshes[i]);
+
+            if (profiler)
+                profiler->endZone(zone, rl.context.drawCount - draws, rl.context.triangleCount - triangles);
+            ++bucket;
+        }
+
+        // models hidden in an earlier frame are drawn if their bounds aren't
+        // hidden behind what has been drawn now
+        if (occlusion && occlusion->stats().culled)
+        {
+            occlusion->retest(rl);
+            for (size_t i = 0; i < meshes.size(); ++i)
+            {
+                if (!occlusion->culled(i) || (software && software->culled(i)))
+                    continue;
+                occlusion->beginConditional(i);
+                drawModel(*meshes[i]);
+                occlusion->endConditional();
+            }
         }
     }
 }
 
 class PassRenderer::Detail {
 public:
-    Detail() {}
+    Detail()
+    {
+        textures.add_texture("light_data", lightClusters.lightTexture());
+        textures.add_texture("light_grid", lightClusters.gridTexture());
+        textures.add_texture("light_indices", lightClusters.indexTexture());
+        textures.add_texture("shadow_atlas", shadowAtlas.texture());
+    }
 
     FramebufferSet fbos;
     TextureSet textures;
+    FrameProfiler profiler;
 
     vector<shared_ptr<Pass>> passes;
+
+    // the passes that survive compilation, in order
+    vector<shared_ptr<Pass>> schedule;
+    bool compiled = false;
+    RenderGraphStats stats;
+
+    // Dynamic resolution draws every pass into a fraction of its buffer,
+    // the passes that write the visible buffer into the upscale buffer, and
+    // then stretches the upscale buffer over the visible one. Only pipelines
+    // that declare "dynamic_resolution" scale their texture coordinates by
+    // u_renderScale, so only they are scaled.
+    bool scalable = false;
+    bool dynamicEnabled = false;
+    DynamicResolution dynamicResolution;
+    uint64_t dynamicMeasuredFrame = 0;
+    shared_ptr<FrameBuffer> upscale;
+
+    // the point and spot lights of the draw list, binned only when the
+    // schedule has a pass that samples light_data, light_grid or
+    // light_indices, or reads the light cluster uniforms
+    LightClusters lightClusters;
+    bool hasLightClusterPass = false;
+
+    // only updated when the schedule has a pass to render it
+    ShadowAtlas shadowAtlas;
+    bool hasShadowPass = false;
+
+    // culls opaque geometry when the schedule builds a depth pyramid
+    OcclusionCuller occlusion;
+    bool hasPyramidPass = false;
+
+    // culls opaque geometry behind the draw list's occluders, when on
+    std::unique_ptr<SoftwareOcclusion> softwareOcclusion;
+
+    TextureStreamer textureStreamer;
+
+    // the pipeline as configured, and the watcher of it and its shader
+    // files while hot reload is on
+    string configPath;
+    Json::Value config;
+    bool configStale = false;   // a changed pipeline that couldn't be applied yet
+    std::unique_ptr<FileWatcher> watcher;
+
+    void compile();
+    void watchFiles();
+    void reload(const vector<string> & changed);
+    bool updateDynamicResolution(v2i fbSize);
 };
 
+bool PassRenderer::Detail::updateDynamicResolution(v2i fbSize)
+{
+    if (!dynamicEnabled || !scalable) {
+        fbos.setViewportScale(1.f);
+        return false;
+    }
+
+    const FrameProfile & p = profiler.lastFrameProfile();
+    if (p.passes.size() && p.frameNumber != dynamicMeasuredFrame) {
+        dynamicMeasuredFrame = p.frameNumber;
+        dynamicResolution.update(p.frameNumber, p.gpuMs, profiler.frameNumber());
+    }
+
+    float scale = dynamicResolution.scale();
+    fbos.setViewportScale(scale);
+    if (scale == 1.f)
+        return false;
+
+    if (!upscale)
+        upscale = make_shared<FrameBuffer>();
+    if (upscale->textures.empty() || upscale->textures[0]->width != fbSize.x || upscale->textures[0]->height != fbSize.y) {
+        FrameBuffer::FrameBufferSpec spec;
+        spec.attachments.push_back(FrameBuffer::FrameBufferSpec::AttachmentSpec("color", "o_color", "u_colorTexture", TextureType::u8x4));
+        upscale->create(spec, fbSize.x, fbSize.y);
+    }
+    upscale->viewportScale = scale;
+    return true;
+}
+
+namespace {
+
+    // a render texture, named by its buffer and attachment; "_depth" is the
+    // depth attachment
+    typedef pair<string, string> Resource;
+
+    bool isExternalBuffer(const string & buffer)
+    {
+        return buffer == "" || buffer == "visible";
+    }
+
+    struct Lifetime
+    {
+        int first = -1;
+        int last = -1;
+        bool readFirst = false;     // contents are carried over from the previous frame
+    };
+
+    bool samplesLightClusters(const PassRenderer::Pass & pass)
+    {
+        for (const Uniform & u : pass.shaderSpec.uniforms)
+            if (u.texture == "light_data" || u.texture == "light_grid" || u.texture == "light_indices" ||
+                u.automatic == AutomaticUniform::lightClusterGrid ||
+                u.automatic == AutomaticUniform::lightClusterSlicing)
+                return true;
+        return false;
+    }
+
+}
+
+void PassRenderer::Detail::compile()
+{
+    compiled = true;
+    schedule.clear();
+    hasShadowPass = false;
+    hasPyramidPass = false;
+    hasLightClusterPass = false;
+    fbos.clearAllocation();
+
+    // resolve buffer and attachment names to framebuffers and tables
+    for (auto & pass : passes)
+    {
+        pass->writesVisible = isExternalBuffer(pass->writeBuffer);
+        pass->writeFbo = fbos.fbo(pass->writeBuffer);
+
+        pass->drawBufferTable.clear();
+        const FrameBuffer::FrameBufferSpec * spec = fbos.spec(pass->writeBuffer);
+        if (spec && !pass->writesVisible)
+        {
+            for (int i = 0; i < int(spec->attachments.size()); ++i)
+            {
+                const string & name = spec->attachments[i].base_name;
+                bool written = !pass->drawDepthPrepass && (pass->writeAttachments.empty() ||
+                    find(pass->writeAttachments.begin(), pass->writeAttachments.end(), name) != pass->writeAttachments.end());
+                pass->drawBufferTable.push_back(written ? GL_COLOR_ATTACHMENT0 + i : GL_NONE);
+            }
+        }
+
+        pass->inputTextures.clear();
+        pass->inputProgram = 0;
+        for (auto & r : pass->readAttachments)
+        {
+            shared_ptr<FrameBuffer> fbo = fbos.fbo(r.first);
+            const FrameBuffer::FrameBufferSpec * readSpec = fbos.spec(r.first);
+            if (!fbo || !readSpec)
+                continue;
+            for (const string & a : r.second) {
+                // the depth texture follows the color attachments
+                if (a == "_depth" && readSpec->hasDepth)
+                    pass->inputTextures.push_back(Pass::InputTexture{ fbo, int(readSpec->attachments.size()), "u_depthTexture", -1 });
+                for (int i = 0; i < int(readSpec->attachments.size()); ++i)
+                    if (readSpec->attachments[i].base_name == a)
+                        pass->inputTextures.push_back(Pass::InputTexture{ fbo, i, readSpec->attachments[i].uniform_name, -1 });
+            }
+        }
+    }
+
+    const int n = int(passes.size());
+    vector<vector<Resource>> reads(n), writes(n);
+    vector<bool> root(n, false);
+    bool anyRoot = false;
+
+    for (int i = 0; i < n; ++i)
+    {
+        const Pass & pass = *passes[i];
+        const FrameBuffer::FrameBufferSpec * spec = fbos.spec(pass.writeBuffer);
+        root[i] = isExternalBuffer(pass.writeBuffer) || !spec || spec->persistent;
+        anyRoot = anyRoot || root[i];
+
+        if (spec && !root[i])
+        {
+            // a depth prepass writes depth alone
+            if (!pass.drawDepthPrepass) {
+                if (pass.writeAttachments.empty())
+                    for (auto & a : spec->attachments)
+                        writes[i].push_back(Resource(pass.writeBuffer, a.base_name));
+                else
+                    for (auto & a : pass.writeAttachments)
+                        writes[i].push_back(Resource(pass.writeBuffer, a));
+            }
+
+            if (pass.depthTest != DepthTest::never && pass.depthTest != DepthTest::always)
+                reads[i].push_back(Resource(pass.writeBuffer, "_depth"));
+            if (pass.writeDepth || pass.clearDepthBuffer)
+                writes[i].push_back(Resource(pass.writeBuffer, "_depth"));
+        }
+        for (auto & r : pass.readAttachments)
+            for (auto & a : r.second)
+                reads[i].push_back(Resource(r.first, a));
+    }
+
+    // a pipeline that never writes the visible buffer is read back by the
+    // application, so its last pass is the output
+    if (!anyRoot && n > 0)
+        root[n - 1] = true;
+
+    // walk backwards from the outputs, keeping passes that produce something
+    // a live pass consumes
+    set<Resource> needed;
+    vector<bool> live(n, false);
+    for (int i = n - 1; i >= 0; --i)
+    {
+        bool l = root[i];
+        for (auto & w : writes[i])
+            l = l || needed.count(w) > 0;
+        if (!l)
+            continue;
+
+        live[i] = true;
+        for (auto & r : reads[i])
+            needed.insert(r);
+    }
+
+    map<Resource, Lifetime> lifetimes;
+    set<string> usedBuffers;
+    for (int i = 0; i < n; ++i)
+    {
+        if (!live[i])
+            continue;
+
+        schedule.push_back(passes[i]);
+        usedBuffers.insert(passes[i]->writeBuffer);
+        hasShadowPass = hasShadowPass || passes[i]->drawShadowCasters;
+        hasPyramidPass = hasPyramidPass || passes[i]->buildDepthPyramid;
+        hasLightClusterPass = hasLightClusterPass || samplesLightClusters(*passes[i]);
+        for (auto & r : reads[i]) {
+            Lifetime & lt = lifetimes[r];
+            if (lt.first < 0) {
+                lt.first = i;
+                lt.readFirst = true;
+            }
+            lt.last = i;
+            usedBuffers.insert(r.first);
+        }
+        for (auto & w : writes[i]) {
+            Lifetime & lt = lifetimes[w];
+            if (lt.first < 0)
+                lt.first = i;
+            lt.last = i;
+        }
+    }
+
+    // Assign transient attachments to pool slots in order of first use. A
+    // slot can be reused by an attachment of the same type once its previous
+    // occupant is dead, as long as both don't belong to the same buffer.
+    vector<pair<Resource, Lifetime>> transients;
+    for (auto & l : lifetimes)
+    {
+        const FrameBuffer::FrameBufferSpec * spec = fbos.spec(l.first.first);
+        if (!spec || spec->persistent || l.second.readFirst || l.first.second == "_depth")
+            continue;
+        transients.push_back(l);
+    }
+    sort(transients.begin(), transients.end(),
+         [](const pair<Resource, Lifetime> & a, const pair<Resource, Lifetime> & b)
+         {
+             return a.second.first < b.second.first;
+         });
+
+    struct Slot
+    {
+        TextureType type;
+        float scale;
+        int lastUse;
+        set<string> buffers;
+        int users;
+    };
+    vector<Slot> pool;
+    map<string, vector<int>> slots;
+    for (auto & name : fbos.names())
+        slots[name] = vector<int>(fbos.spec(name)->attachments.size(), -1);
+
+    for (auto & t : transients)
+    {
+        const string & buffer = t.first.first;
+        const FrameBuffer::FrameBufferSpec * spec = fbos.spec(buffer);
+        int attachment = -1;
+        for (int i = 0; i < int(spec->attachments.size()); ++i)
+            if (spec->attachments[i].base_name == t.first.second)
+                attachment = i;
+        if (attachment < 0)
+            continue;
+
+        TextureType type = spec->attachments[attachment].type;
+        float scale = spec->scale();
+        int slot = -1;
+        for (int s = 0; s < int(pool.size()) && slot < 0; ++s)
+            if (pool[s].type == type && pool[s].scale == scale &&
+                pool[s].lastUse < t.second.first && !pool[s].buffers.count(buffer))
+                slot = s;
+        if (slot < 0) {
+            slot = int(pool.size());
+            pool.push_back(Slot{ type, scale, -1, set<string>(), 0 });
+        }
+        pool[slot].lastUse = t.second.last;
+        pool[slot].buffers.insert(buffer);
+        pool[slot].users++;
+        slots[buffer][attachment] = slot;
+    }
+
+    // slots with a single user are just private textures
+    vector<int> remap(pool.size(), -1);
+    vector<FramebufferSet::PoolSlot> poolTypes;
+    stats.aliasedTextures = 0;
+    for (int s = 0; s < int(pool.size()); ++s)
+        if (pool[s].users > 1) {
+            remap[s] = int(poolTypes.size());
+            poolTypes.push_back(FramebufferSet::PoolSlot{ pool[s].type, pool[s].scale });
+            stats.aliasedTextures += pool[s].users - 1;
+        }
+
+    fbos.setPool(poolTypes);
+    for (auto & b : slots)
+    {
+        for (int & s : b.second)
+            s = s >= 0 ? remap[s] : -1;
+        const FrameBuffer::FrameBufferSpec * spec = fbos.spec(b.first);
+        bool used = spec->persistent || usedBuffers.count(b.first) > 0;
+        fbos.setAllocation(b.first, used, b.second);
+    }
+
+    stats.passes = n;
+    stats.culledPasses = n - int(schedule.size());
+    stats.requestedBytesPerPixel = fbos.requestedBytesPerPixel();
+    stats.allocatedBytesPerPixel = fbos.allocatedBytesPerPixel();
+
+    printf("\nRender graph:\n");
+    for (int i = 0; i < n; ++i)
+        if (!live[i])
+            printf(" culled %s\n", passes[i]->name().c_str());
+    printf(" %d of %d passes, %d textures aliased\n", int(schedule.size()), n, stats.aliasedTextures);
+    printf(" render targets %g bytes/pixel, %g requested\n",
+           stats.allocatedBytesPerPixel, stats.requestedBytesPerPixel);
+}
+
 PassRenderer::PassRenderer() : _detail(new Detail()) {
 }
 
@@ -139,70 +571,178 @@ std::shared_ptr<Texture> PassRenderer::texture(const std::string & name)
     return _detail->textures.texture(name);
 }
 
+uint64_t PassRenderer::textureGeneration() const
+{
+    return _detail->textures.generation();
+}
+
 std::shared_ptr<FrameBuffer> PassRenderer::framebuffer(const std::string & name)
 {
     return _detail->fbos.fbo(name);
 }
 
+const PassRenderer::RenderGraphStats & PassRenderer::renderGraphStats() const
+{
+    return _detail->stats;
+}
 
-void PassRenderer::configure(const char *const path)
+void PassRenderer::setRenderScale(float scale)
 {
-    string p = expandPath(path);
-    std::ifstream in(p);
-    Json::Value conf;
-    in >> conf;
+    _detail->fbos.setRenderScale(scale);
+}
 
-    printf("\nTextures:\n");
-    for (Json::Value::iterator it = conf["textures"].begin(); it != conf["textures"].end(); ++it)
-	{
-        // { "id": "tex16", "path": "$(ASSET_ROOT)/textures/shadertoy/tex16.png" }
-        string id = (*it)["id"].asString();
-        string path = (*it)["path"].asString();
-        FileTextureProvider provider(path);
-        _detail->textures.add_texture(id, provider.texture());
+float PassRenderer::renderScale() const
+{
+    return _detail->fbos.renderScale();
+}
+
+void PassRenderer::setDynamicResolution(double targetGpuMs, float minScale)
+{
+    DynamicResolution::Settings settings = _detail->dynamicResolution.settings();
+    settings.targetMs = targetGpuMs;
+    settings.minScale = minScale;
+    _detail->dynamicResolution.setSettings(settings);
+    _detail->dynamicResolution.reset();
+    _detail->dynamicEnabled = targetGpuMs > 0;
+    if (_detail->dynamicEnabled) {
+        _detail->profiler.setEnabled(true);
+        if (!_detail->scalable)
+            printf("Dynamic resolution: the pipeline does not declare \"dynamic_resolution\", it will not be scaled\n");
     }
+}
 
-    printf("\nBuffers:\n");
-    for (Json::Value::iterator it = conf["buffers"].begin(); it != conf["buffers"].end(); ++it)
-	{
-        string bufferName = (*it)["name"].asString();
-        printf(" %s\n", bufferName.c_str());
+DynamicResolution & PassRenderer::dynamicResolution()
+{
+    return _detail->dynamicResolution;
+}
 
-        FrameBuffer::FrameBufferSpec spec;
-        spec.hasDepth = (*it)["depth"].asString() == "yes";
+float PassRenderer::dynamicResolutionScale() const
+{
+    return _detail->fbos.viewportScale();
+}
 
-        for (Json::Value::iterator it2 = (*it)["render_textures"].begin(); it2 != (*it)["render_textures"].end(); ++it2) {
+LightClusters & PassRenderer::lightClusters()
+{
+    return _detail->lightClusters;
+}
 
-            string name = (*it2)["name"].asString();
-            string typeStr = (*it2)["type"].asString();
+ShadowAtlas & PassRenderer::shadowAtlas()
+{
+    return _detail->shadowAtlas;
+}
 
-            printf("  %s %s\n", name.c_str(), typeStr.c_str());
+OcclusionCuller & PassRenderer::occlusionCuller()
+{
+    return _detail->occlusion;
+}
 
-            string outputName = "o_" + name + "Texture";
-            string uniformName = "u_" + name + "Texture";
+void PassRenderer::setSoftwareOcclusion(bool enabled)
+{
+    if (!enabled)
+        _detail->softwareOcclusion.reset();
+    else if (!_detail->softwareOcclusion)
+        _detail->softwareOcclusion.reset(new SoftwareOcclusion());
+}
 
-			TextureType textureType = TextureType::u8x4;	// default to RGBA8
-            if (typeStr == "u8x4") textureType = TextureType::u8x4;
-            else if (typeStr == "f16x4") textureType = TextureType::f16x4;
-            else if (typeStr == "f32x4") textureType = TextureType::f32x4;
+void PassRenderer::setHotReload(bool enabled)
+{
+    if (!enabled)
+        _detail->watcher.reset();
+    else if (!_detail->watcher) {
+        _detail->watcher.reset(new FileWatcher());
+        _detail->watchFiles();
+    }
+}
 
-            spec.attachments.push_back(FrameBuffer::FrameBufferSpec::AttachmentSpec(name, outputName, uniformName, textureType));
-        }
+bool PassRenderer::hotReload() const
+{
+    return !!_detail->watcher;
+}
 
-        _detail->fbos.add_fbo(bufferName, spec);
+TextureStreamer & PassRenderer::textureStreamer()
+{
+    return _detail->textureStreamer;
+}
+
+SoftwareOcclusion * PassRenderer::softwareOcclusion()
+{
+    return _detail->softwareOcclusion.get();
+}
+
+void PassRenderer::warmUpShaders(v2i fbSize)
+{
+    warmUpShaders(fbSize, nullptr);
+}
+
+void PassRenderer::warmUpShaders(v2i fbSize, const DrawList & drawList)
+{
+    warmUpShaders(fbSize, &drawList);
+}
+
+void PassRenderer::warmUpShaders(v2i fbSize, const DrawList * drawList)
+{
+    LR_PROFILE_ZONE("PassRenderer::warmUpShaders");
+    if (fbSize.x <= 0 || fbSize.y <= 0)
+        return;
+    if (!_detail->compiled)
+        _detail->compile();
+
+    // the shaders declare the outputs of their buffers, known once allocated
+    _detail->fbos.setSize(fbSize.x, fbSize.y);
+
+    bool async = ShaderBuilder::asyncCompile();
+    ShaderBuilder::setAsyncCompile(true);
+    for (const auto & pass : _detail->schedule) {
+        pass->prepareFullScreenQuadAndShader(_detail->fbos);
+
+        // the variants the pass's draws will ask for, as Pass::run draws them
+        if (drawList && pass->writeFbo && (pass->drawOpaqueGeometry || pass->drawDepthPrepass)) {
+            for (const auto & model : drawList->deferredMeshes)
+                model->prepareShaders(*pass->writeFbo, pass->drawDepthPrepass);
+        }
     }
 
-    printf("\nPasses:\n");
-    int passNumber = 0;
-    for (Json::Value::iterator it = conf["passes"].begin(); it != conf["passes"].end(); ++it)
-	{
-        Json::Value passVal = (*it)["type"];
+    // the programs the shadow and pyramid passes would make on first use
+    if (_detail->hasShadowPass)
+        _detail->shadowAtlas.prepareShaders();
+    if (_detail->hasPyramidPass)
+        _detail->occlusion.prepareShaders();
+    ShaderBuilder::setAsyncCompile(async);
+}
+
+const FrameProfile & PassRenderer::lastFrameProfile() const
+{
+    return _detail->profiler.lastFrameProfile();
+}
+
+void PassRenderer::setProfilingEnabled(bool enabled)
+{
+    _detail->profiler.setEnabled(enabled);
+}
+
+bool PassRenderer::saveFrameProfile(char const*const path) const
+{
+    std::ofstream out(expandPath(path));
+    if (!out)
+        return false;
+
+    writeChromeTrace(out, _detail->profiler.lastFrameProfile());
+    return true;
+}
+
+
+namespace {
+
+    // a pass as the pipeline describes it
+    shared_ptr<PassRenderer::Pass> parsePass(const Json::Value & passConf, int passNumber)
+    {
+        Json::Value passVal = passConf["type"];
         string passType = passVal["run"].asString();
-        string passName = (*it)["name"].asCString();
+        string passName = passConf["name"].asCString();
         printf(" %s %s\n", passName.c_str(), passType.c_str());
 
-        std::shared_ptr<Pass> pass = addPass(std::make_shared<Pass>(passName, passNumber++));
-        Json::Value shader = (*it)["shader"];
+        shared_ptr<PassRenderer::Pass> pass = make_shared<PassRenderer::Pass>(passName, passNumber);
+        Json::Value shader = passConf["shader"];
         if (shader.type() != Json::nullValue) {
             Json::Value vertex_shader_path = shader["vertex_shader_path"];
             if (vertex_shader_path.type() != Json::nullValue)
@@ -237,6 +777,16 @@ void PassRenderer::configure(const char *const path)
                             automatic = AutomaticUniform::renderTime;
                         else if (!strcmp(s, "mouse_position"))
                             automatic = AutomaticUniform::mousePosition;
+                        else if (!strcmp(s, "render_scale"))
+                            automatic = AutomaticUniform::renderScale;
+                        else if (!strcmp(s, "inverse_projection"))
+                            automatic = AutomaticUniform::inverseProjection;
+                        else if (!strcmp(s, "inverse_view"))
+                            automatic = AutomaticUniform::inverseView;
+                        else if (!strcmp(s, "light_cluster_grid"))
+                            automatic = AutomaticUniform::lightClusterGrid;
+                        else if (!strcmp(s, "light_cluster_slicing"))
+                            automatic = AutomaticUniform::lightClusterSlicing;
                     }
 
                     Json::Value v = (*uniform)["texture"];
@@ -261,6 +811,9 @@ void PassRenderer::configure(const char *const path)
         string drawType = passVal["draw"].asString();
         pass->isQuadPass = drawType == "quad";
         pass->drawOpaqueGeometry = drawType == "opaque-geometry";
+        pass->drawDepthPrepass = drawType == "depth-prepass";
+        pass->drawShadowCasters = drawType == "shadow-casters";
+        pass->buildDepthPyramid = drawType == "depth-pyramid";
 
         bool writeDepth = pass->writeDepth;
         DepthTest dfunc = pass->depthTest;
@@ -268,7 +821,7 @@ void PassRenderer::configure(const char *const path)
         bool clearDepthBuffer = pass->clearDepthBuffer;
         bool clearGbuffer = pass->clearGbuffer;
 
-        Json::Value depth = (*it)["depth"];
+        Json::Value depth = passConf["depth"];
         if (depth.type() != Json::nullValue)
 		{
             Json::Value val = depth["write"];
@@ -287,7 +840,7 @@ void PassRenderer::configure(const char *const path)
         pass->depthTest = dfunc;
         pass->clearDepthBuffer = clearDepthBuffer;
 
-        Json::Value writeBuffer = (*it)["outputs"];
+        Json::Value writeBuffer = passConf["outputs"];
         if (writeBuffer.type() != Json::nullValue)
 		{
             string writeBufferName = writeBuffer["buffer"].asString();
@@ -303,7 +856,22 @@ void PassRenderer::configure(const char *const path)
         }
         pass->clearGbuffer = clearGbuffer;
 
-        Json::Value readBuffers = (*it)["inputs"];
+        // the atlas clears the tiles it renders, and nothing else
+        if (pass->drawShadowCasters)
+            pass->clearDepthBuffer = pass->clearGbuffer = false;
+
+        // a prepass has no color to clear
+        if (pass->drawDepthPrepass)
+            pass->clearGbuffer = false;
+
+        // the pyramid reads depth, and writes only its own textures
+        if (pass->buildDepthPyramid) {
+            pass->clearDepthBuffer = pass->clearGbuffer = false;
+            pass->writeDepth = false;
+            pass->depthTest = DepthTest::never;
+        }
+
+        Json::Value readBuffers = passConf["inputs"];
         if (readBuffers.type() != Json::nullValue)
 		{
             for (Json::Value::iterator buffer = readBuffers.begin(); buffer != readBuffers.end(); ++buffer)
@@ -318,12 +886,189 @@ void PassRenderer::configure(const char *const path)
                 pass->readAttachments.push_back(make_pair(name, buffers));
             }
         }
+        return pass;
+    }
+
+}
+
+void PassRenderer::configure(const char *const path)
+{
+    string p = expandPath(path);
+    std::ifstream in(p);
+    Json::Value conf;
+    in >> conf;
+
+    _detail->scalable = conf["dynamic_resolution"].asString() == "yes";
+
+    printf("\nTextures:\n");
+    for (Json::Value::iterator it = conf["textures"].begin(); it != conf["textures"].end(); ++it)
+	{
+        // { "id": "tex16", "path": "$(ASSET_ROOT)/textures/shadertoy/tex16.png" }
+        string id = (*it)["id"].asString();
+        string path = (*it)["path"].asString();
+        _detail->textures.add_texture(id, _detail->textureStreamer.load(path));
+    }
+
+    printf("\nBuffers:\n");
+    for (Json::Value::iterator it = conf["buffers"].begin(); it != conf["buffers"].end(); ++it)
+	{
+        string bufferName = (*it)["name"].asString();
+        printf(" %s\n", bufferName.c_str());
+
+        FrameBuffer::FrameBufferSpec spec;
+        spec.hasDepth = (*it)["depth"].asString() == "yes";
+        spec.persistent = (*it)["persistent"].asString() == "yes";
+
+        for (Json::Value::iterator it2 = (*it)["render_textures"].begin(); it2 != (*it)["render_textures"].end(); ++it2) {
+
+            string name = (*it2)["name"].asString();
+            string typeStr = (*it2)["type"].asString();
+
+            printf("  %s %s\n", name.c_str(), typeStr.c_str());
+
+            string outputName = "o_" + name + "Texture";
+            string uniformName = "u_" + name + "Texture";
+
+			TextureType textureType = TextureType::u8x4;	// default to RGBA8
+            if (typeStr.length())
+                textureType = stringToTextureType(typeStr);
+
+            float scale = 1.f;
+            Json::Value scaleVal = (*it2)["scale"];
+            if (scaleVal.type() != Json::nullValue && scaleVal.asFloat() > 0)
+                scale = scaleVal.asFloat();
+
+            spec.attachments.push_back(FrameBuffer::FrameBufferSpec::AttachmentSpec(name, outputName, uniformName, textureType, scale));
+        }
+
+        _detail->fbos.add_fbo(bufferName, spec);
+    }
+
+    printf("\nPasses:\n");
+    int passNumber = 0;
+    for (Json::Value::iterator it = conf["passes"].begin(); it != conf["passes"].end(); ++it)
+        addPass(parsePass(*it, passNumber++));
+
+    _detail->configPath = p;
+    _detail->config = conf;
+    _detail->watchFiles();
+}
+
+void PassRenderer::Detail::watchFiles()
+{
+    if (!watcher)
+        return;
+
+    watcher->watch(configPath);
+    for (auto & pass : passes) {
+        watcher->watch(expandPath(pass->shaderSpec.vertexShaderPath.c_str()));
+        watcher->watch(expandPath(pass->shaderSpec.fragmentShaderPath.c_str()));
+        watcher->watch(expandPath(pass->shaderSpec.fragmentShaderPostamblePath.c_str()));
     }
 }
 
+void PassRenderer::Detail::reload(const vector<string> & changed)
+{
+    LR_PROFILE_ZONE("PassRenderer::reload");
+    set<string> files(changed.begin(), changed.end());
+
+    // the passes of the changed pipeline, if it parses and its textures and
+    // buffers are as they were
+    vector<shared_ptr<Pass>> next = passes;
+    Json::Value conf;
+    bool repassed = false;
+    if (files.count(configPath) || configStale) {
+        std::ifstream in(configPath);
+        Json::CharReaderBuilder builder;
+        string errors;
+        configStale = true;
+        if (!Json::parseFromStream(builder, in, &conf, &errors))
+            printf("Reload: %s doesn't parse, keeping the pipeline\n%s\n", configPath.c_str(), errors.c_str());
+        else if (conf["textures"] != config["textures"] || conf["buffers"] != config["buffers"] ||
+                 conf["dynamic_resolution"] != config["dynamic_resolution"])
+            printf("Reload: textures and buffers of %s change on a restart, keeping the pipeline\n", configPath.c_str());
+        else {
+            printf("\nReloading passes:\n");
+            next.clear();
+            int passNumber = 0;
+            for (Json::Value::iterator it = conf["passes"].begin(); it != conf["passes"].end(); ++it)
+                next.push_back(parsePass(*it, passNumber++));
+            repassed = true;
+        }
+    }
+
+    // a pass defined as it was keeps its program, unless its files changed
+    map<string, shared_ptr<Pass>> previous;
+    map<string, Json::Value> previousConf;
+    for (auto & pass : passes)
+        previous[pass->name()] = pass;
+    for (Json::Value::iterator it = config["passes"].begin(); it != config["passes"].end(); ++it)
+        previousConf[(*it)["name"].asString()] = *it;
+    map<string, Json::Value> nextConf;
+    if (repassed)
+        for (Json::Value::iterator it = conf["passes"].begin(); it != conf["passes"].end(); ++it)
+            nextConf[(*it)["name"].asString()] = *it;
+
+    // made synchronously, so that a failed compile is seen here
+    vector<pair<shared_ptr<Pass>, shared_ptr<Shader>>> built;
+    bool rejected = false;
+    bool async = ShaderBuilder::asyncCompile();
+    ShaderBuilder::setAsyncCompile(false);
+    for (auto & pass : next)
+    {
+        if (!pass->isQuadPass)
+            continue;
+
+        auto found = previous.find(pass->name());
+        shared_ptr<Pass> old = found == previous.end() ? shared_ptr<Pass>() : found->second;
+        bool same = old == pass ||
+            (old && old->shader() && previousConf[pass->name()] == nextConf[pass->name()]);
+        if (same && old != pass)
+            pass->adoptShader(*old);
+
+        const ShaderBuilder::ShaderSpec & spec = pass->shaderSpec;
+        bool edited = files.count(expandPath(spec.vertexShaderPath.c_str())) ||
+                      files.count(expandPath(spec.fragmentShaderPath.c_str())) ||
+                      files.count(expandPath(spec.fragmentShaderPostamblePath.c_str()));
+        if (same && !edited)
+            continue;
+
+        try {
+            built.push_back(make_pair(pass, pass->makeShader(fbos)));
+            printf("Reload: rebuilt %s\n", pass->name().c_str());
+        }
+        catch (std::exception & e) {
+            // the pass's old program stays; a new pass without one holds
+            // back the whole pipeline until it compiles
+            printf("Reload: %s failed to compile, keeping its program\n%s\n", pass->name().c_str(), e.what());
+            if (!pass->shader() && old && old->shader())
+                pass->adoptShader(*old);
+            else if (!pass->shader())
+                rejected = true;
+        }
+    }
+    ShaderBuilder::setAsyncCompile(async);
+
+    if (rejected) {
+        printf("Reload: keeping the pipeline\n");
+        return;
+    }
+
+    for (auto & b : built)
+        b.first->setShader(b.second);
+    if (repassed) {
+        passes = next;
+        config = conf;
+        configStale = false;
+        compiled = false;
+    }
+    watchFiles();
+}
+
 std::shared_ptr<PassRenderer::Pass> PassRenderer::addPass(std::shared_ptr<Pass> pass)
 {
     _detail->passes.push_back(pass);
+    _detail->compiled = false;
     sort(_detail->passes.begin(), _detail->passes.end(),
          [](const shared_ptr<Pass>& a, const shared_ptr<Pass>& b)
          {
@@ -342,9 +1087,29 @@ PassRenderer::Pass* PassRenderer::_findPass(const std::string& name) const
 
 void PassRenderer::render(RenderLock& rl, v2i fbSize, DrawList& drawList)
 {
+    LR_PROFILE_ZONE("PassRenderer::render");
+
     if (!rl.valid())
         return;
 
+    // files written since the last frame are reloaded before the next one,
+    // the pipeline's and those the drawn models read their shaders from
+    if (_detail->watcher) {
+        AllowAllocations allow;
+        vector<string> shaderFiles;
+        for (const auto & model : drawList.deferredMeshes)
+            model->shaderFiles(shaderFiles);
+        for (const auto & file : shaderFiles)
+            _detail->watcher->watch(file);
+
+        vector<string> changed = _detail->watcher->poll();
+        if (!changed.empty()) {
+            for (const auto & model : drawList.deferredMeshes)
+                model->reloadShaders(changed);
+            enqueCommand([this, changed]() { _detail->reload(changed); });
+        }
+    }
+
 	GLenum framebuffer_status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
 	if (framebuffer_status != GL_FRAMEBUFFER_COMPLETE)
 		return;
@@ -352,74 +1117,154 @@ void PassRenderer::render(RenderLock& rl, v2i fbSize, DrawList& drawList)
     checkError(ErrorPolicy::onErrorThrow,
                TestConditions::exhaustive, "runPasses");
 
+    // the application may have changed any GL state since the last frame
+    glState().invalidate();
+    glState().beginFrame();
+
     CaptureFrameBuffer current_frame_buffer;
 
+    if (!_detail->compiled)
+        _detail->compile();
+
+    bool upscaling = _detail->updateDynamicResolution(fbSize);
     _detail->fbos.setSize(fbSize.x, fbSize.y);
 
     rl.context.drawList = &drawList;
     rl.context.framebufferSize = fbSize;
     rl.context.rootFramebuffer = current_frame_buffer.currFramebuffer;
+    rl.context.profiler = &_detail->profiler;
+    rl.context.drawCount = 0;
+    rl.context.triangleCount = 0;
+    rl.context.renderScale = _detail->fbos.viewportScale();
+
+    const ShadowAtlas * shadows = nullptr;
+    if (_detail->hasShadowPass) {
+        _detail->shadowAtlas.update(drawList, fbSize, *rl.context.arena);
+        rl.context.shadowAtlas = &_detail->shadowAtlas;
+        shadows = &_detail->shadowAtlas;
+    }
+    if (_detail->hasLightClusterPass) {
+        LR_PROFILE_ZONE("LightClusters");
+        _detail->lightClusters.build(drawList, *rl.context.arena, shadows);
+        _detail->lightClusters.upload();
+        rl.context.lightClusters = &_detail->lightClusters;
+    }
 
-    string bound_frame_buffer = "*";
+    if (_detail->hasPyramidPass) {
+        _detail->occlusion.update(drawList);
+        rl.context.occlusion = &_detail->occlusion;
+    }
+    if (_detail->softwareOcclusion) {
+        _detail->softwareOcclusion->update(drawList);
+        rl.context.softwareOcclusion = _detail->softwareOcclusion.get();
+    }
+
+    // the levels last frame's draws asked for
+    _detail->textureStreamer.update();
+    rl.context.textureStreamer = &_detail->textureStreamer;
+
+    _detail->profiler.beginFrame();
 
     glClearColor(0, 0, 0, 0);
     glClearDepthf(1.0f);
 
-	glDisable(GL_SCISSOR_TEST);
-	glDisable(GL_STENCIL_TEST);
-	glEnable(GL_DEPTH_TEST);
-	glDepthFunc(GL_LESS);
-	glEnable(GL_CULL_FACE);
-	glDisable(GL_BLEND);
-	glDepthMask(GL_TRUE);
+	glState().disable(GL_SCISSOR_TEST);
+	glState().disable(GL_STENCIL_TEST);
+	glState().enable(GL_DEPTH_TEST);
+	glState().depthFunc(GL_LESS);
+	glState().enable(GL_CULL_FACE);
+	glState().disable(GL_BLEND);
+	glState().depthMask(true);
 	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 
-    for (auto pass : _detail->passes)
+    for (const auto & pass : _detail->schedule)
 	{
         checkError(ErrorPolicy::onErrorThrow, TestConditions::exhaustive, "render, before pass");
 
-        if (true || (bound_frame_buffer != pass->writeBuffer))
-        {
-			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0); // unbind previous framebuffer
+        // the zone covers the state changes and clears as well as the draws
+        int zone = _detail->profiler.beginZone(pass->name().c_str(), 0);
+        int draws = rl.context.drawCount;
+        int64_t triangles = rl.context.triangleCount;
 
-			if (pass->writeBuffer == "" || pass->writeBuffer == "visible")
-                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, rl.context.rootFramebuffer);
-            else
-                _detail->fbos.fbo(pass->writeBuffer)->bindForWrite(pass->writeAttachments);
-
-            // because I need to take into account active writebuffers, I've
-            // commented out to force rebinding: 
-			bound_frame_buffer = pass->writeBuffer;
+        // Bind every pass; the state cache drops the framebuffer and draw
+        // buffer calls when consecutive passes write the same attachments.
+        if (pass->drawShadowCasters || pass->buildDepthPyramid) {
+            // the shadow atlas and the depth pyramid bind their own
+            // framebuffers and viewports
+        }
+        else if (upscaling && (pass->writesVisible || !pass->writeFbo)) {
+            _detail->upscale->bindForWrite(_detail->upscale->drawBuffers);
+            rl.context.renderTargetSize = fbSize;
+        }
+        else if (pass->writesVisible || !pass->writeFbo) {
+            glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, rl.context.rootFramebuffer);
+            glState().viewport(0, 0, fbSize.x, fbSize.y);
+            rl.context.renderTargetSize = fbSize;
         }
+        else {
+            pass->writeFbo->bindForWrite(pass->drawBufferTable);
+            rl.context.renderTargetSize.x = pass->writeFbo->newViewport[2];
+            rl.context.renderTargetSize.y = pass->writeFbo->newViewport[3];
+        }
+
 		checkError(ErrorPolicy::onErrorThrow, TestConditions::exhaustive, "render, bind for write");
 
 		if (pass->isQuadPass)
 	        pass->prepareFullScreenQuadAndShader(_detail->fbos);
 
         if (pass->depthTest == DepthTest::never)
-            glDisable(GL_DEPTH_TEST);
+            glState().disable(GL_DEPTH_TEST);
         else
         {
-            glEnable(GL_DEPTH_TEST);
+            glState().enable(GL_DEPTH_TEST);
             int itype = static_cast< typename std::underlying_type<DepthTest>::type >(pass->depthTest);
-            glDepthFunc(depthTestToGL[itype]);
+            glState().depthFunc(depthTestToGL[itype]);
         }
 
         uint32_t clearbits = pass->clearDepthBuffer? GL_DEPTH_BUFFER_BIT : 0;
         clearbits |= pass->clearGbuffer? GL_COLOR_BUFFER_BIT : 0;
         if (clearbits) 
 		{
-            glDepthMask(GL_TRUE);
+            glState().depthMask(true);
             glClear(clearbits);
         }
 
-        glDepthMask(pass->writeDepth? GL_TRUE:GL_FALSE);
-        glDisable(GL_BLEND);
+        glState().depthMask(pass->writeDepth);
+        glState().disable(GL_BLEND);
+
+        // fragments per pixel, to see what a depth prepass saves
+        if (pass->drawOpaqueGeometry || pass->drawDepthPrepass) {
+            float scale = pass->writesVisible ? 1.f : rl.context.renderScale;
+            _detail->profiler.countSamples(zone, int64_t(rl.context.renderTargetSize.x * scale) *
+                                                 int64_t(rl.context.renderTargetSize.y * scale));
+        }
+
+        pass->run(rl);
 
-        pass->run(rl, _detail->fbos);
+        _detail->profiler.endZone(zone, rl.context.drawCount - draws, rl.context.triangleCount - triangles);
 
         checkError(ErrorPolicy::onErrorThrow, TestConditions::exhaustive, "render, after pass");
     }
 
-    glUseProgram(0);
+    if (upscaling) {
+        int zone = _detail->profiler.beginZone("upscale", 0);
+        int w = std::max(1, int(fbSize.x * rl.context.renderScale + 0.5f));
+        int h = std::max(1, int(fbSize.y * rl.context.renderScale + 0.5f));
+        glState().bindFramebuffer(GL_READ_FRAMEBUFFER, _detail->upscale->id);
+        glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, rl.context.rootFramebuffer);
+        glBlitFramebuffer(0, 0, w, h, 0, 0, fbSize.x, fbSize.y, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glState().viewport(0, 0, fbSize.x, fbSize.y);
+        _detail->profiler.endZone(zone, 0, 0);
+        checkError(ErrorPolicy::onErrorThrow, TestConditions::exhaustive, "render, upscale");
+    }
+
+    glState().useProgram(0);
+
+    _detail->profiler.endFrame();
+    rl.context.profiler = nullptr;
+    rl.context.lightClusters = nullptr;
+    rl.context.shadowAtlas = nullptr;
+    rl.context.occlusion = nullptr;
+    rl.context.softwareOcclusion = nullptr;
+    rl.context.textureStreamer = nullptr;
 }
@@ -0,0 +1,248 @@
+//
+//  Profiler.cpp
+//  LabRender
+//
+//
+
+#include "LabRender/Profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+#if LABRENDER_PROFILING_RDTSC && (defined(_M_X64) || defined(__x86_64__))
+# define LR_USE_RDTSC 1
+# ifdef _MSC_VER
+#  include <intrin.h>
+# else
+#  include <x86intrin.h>
+# endif
+#else
+# define LR_USE_RDTSC 0
+#endif
+
+namespace lab {
+namespace profiler {
+
+    namespace {
+
+        struct Event
+        {
+            const char * name;
+            uint64_t begin;
+            uint64_t end;
+        };
+
+        const uint64_t kCapacity = 1 << 14;     // events per thread between frame marks
+        const int kMaxDepth = 64;
+
+        // Written only by its owning thread. The collector reads up to head,
+        // which the owner publishes with release semantics after each event.
+        // A thread that records more than kCapacity events between marks
+        // loses the oldest ones. The owner keeps recording while the
+        // collector drains, so an event is only kept if head shows, after
+        // it was copied, that the owner hadn't yet come round to its slot.
+        struct ThreadBuffer
+        {
+            Event events[kCapacity];
+            std::atomic<uint64_t> head{0};
+            uint64_t tail = 0;                  // collector only
+            Event open[kMaxDepth];              // owner only
+            int depth = 0;
+            int tid = 0;
+        };
+
+        struct CapturedEvent
+        {
+            const char * name;
+            uint64_t begin;
+            uint64_t end;
+            int tid;
+        };
+
+        struct Registry
+        {
+            std::mutex lock;
+            std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+            std::vector<ZoneSummary> summary;
+            bool capturing = false;
+            uint64_t captureStart = 0;
+            std::vector<CapturedEvent> captured;
+        };
+
+        Registry & registry()
+        {
+            static Registry r;
+            return r;
+        }
+
+        thread_local ThreadBuffer * t_buffer = nullptr;
+
+        ThreadBuffer * threadBuffer()
+        {
+            if (!t_buffer) {
+                // buffers outlive their threads so the collector never races a thread exit
+                Registry & r = registry();
+                std::lock_guard<std::mutex> lock(r.lock);
+                r.buffers.emplace_back(new ThreadBuffer());
+                t_buffer = r.buffers.back().get();
+                t_buffer->tid = int(r.buffers.size()) - 1;
+            }
+            return t_buffer;
+        }
+    }
+
+    uint64_t ticks()
+    {
+#if LR_USE_RDTSC
+        return __rdtsc();
+#else
+        return uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+    double ticksPerMs()
+    {
+#if LR_USE_RDTSC
+        static double rate = []() {
+            using namespace std::chrono;
+            auto t0 = steady_clock::now();
+            uint64_t c0 = __rdtsc();
+            while (steady_clock::now() - t0 < milliseconds(10)) {}
+            uint64_t c1 = __rdtsc();
+            double ms = duration<double, std::milli>(steady_clock::now() - t0).count();
+            return double(c1 - c0) / ms;
+        }();
+        return rate;
+#else
+        typedef std::chrono::steady_clock::period period;
+        return double(period::den) / (double(period::num) * 1000.0);
+#endif
+    }
+
+    void beginZone(const char * name)
+    {
+        ThreadBuffer * b = threadBuffer();
+        if (b->depth < kMaxDepth) {
+            Event & e = b->open[b->depth];
+            e.name = name;
+            e.begin = ticks();
+        }
+        ++b->depth;
+    }
+
+    void endZone()
+    {
+        ThreadBuffer * b = t_buffer;
+        if (!b || b->depth == 0)
+            return;
+
+        --b->depth;
+        if (b->depth >= kMaxDepth)
+            return;
+
+        Event e = b->open[b->depth];
+        e.end = ticks();
+        uint64_t head = b->head.load(std::memory_order_relaxed);
+        b->events[head % kCapacity] = e;
+        b->head.store(head + 1, std::memory_order_release);
+    }
+
+    void frameMark()
+    {
+        Registry & r = registry();
+        std::lock_guard<std::mutex> lock(r.lock);
+
+        r.summary.clear();
+        double toMs = 1.0 / ticksPerMs();
+
+        for (auto & b : r.buffers) {
+            uint64_t head = b->head.load(std::memory_order_acquire);
+            if (head - b->tail > kCapacity)
+                b->tail = head - kCapacity;
+
+            for (; b->tail < head; ++b->tail) {
+                Event e = b->events[b->tail % kCapacity];
+
+                // Event head, which may be being written now, goes in the
+                // slot of event head - kCapacity. Once lapped, the collector
+                // skips to half a buffer behind the owner, to stay ahead of
+                // it while it catches up.
+                std::atomic_thread_fence(std::memory_order_acquire);
+                uint64_t written = b->head.load(std::memory_order_relaxed);
+                if (written - b->tail >= kCapacity) {
+                    b->tail = written - kCapacity / 2 - 1;
+                    continue;
+                }
+
+                double ms = double(e.end - e.begin) * toMs;
+
+                // A frame has tens of distinct zones, so a linear search
+                // beats a map, and reuses the summary's storage every frame.
+                auto i = std::find_if(r.summary.begin(), r.summary.end(),
+                                      [&e](const ZoneSummary & s) { return s.name == e.name; });
+                if (i == r.summary.end()) {
+                    r.summary.emplace_back();
+                    r.summary.back().name = e.name;
+                    i = r.summary.end() - 1;
+                }
+                ZoneSummary & s = *i;
+                ++s.calls;
+                s.totalMs += ms;
+                s.maxMs = std::max(s.maxMs, ms);
+
+                if (r.capturing)
+                    r.captured.push_back({ e.name, e.begin, e.end, b->tid });
+            }
+        }
+
+        std::sort(r.summary.begin(), r.summary.end(),
+                  [](const ZoneSummary & a, const ZoneSummary & b) { return a.totalMs > b.totalMs; });
+    }
+
+    std::vector<ZoneSummary> lastFrameSummary()
+    {
+        Registry & r = registry();
+        std::lock_guard<std::mutex> lock(r.lock);
+        return r.summary;
+    }
+
+    void beginCapture()
+    {
+        Registry & r = registry();
+        std::lock_guard<std::mutex> lock(r.lock);
+        r.captured.clear();
+        r.captureStart = ticks();
+        r.capturing = true;
+    }
+
+    void endCapture(std::ostream & out)
+    {
+        Registry & r = registry();
+        std::lock_guard<std::mutex> lock(r.lock);
+        r.capturing = false;
+
+        double toUs = 1000.0 / ticksPerMs();
+        out << "{\"traceEvents\":[\n";
+        bool first = true;
+        for (const CapturedEvent & e : r.captured) {
+            // events that straddle the start of the capture are clamped to it
+            if (e.end < r.captureStart)
+                continue;
+            uint64_t begin = e.begin > r.captureStart ? e.begin : r.captureStart;
+            if (!first)
+                out << ",\n";
+            first = false;
+            out << "{\"name\":\"" << e.name
+                << "\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.tid
+                << ",\"ts\":" << double(begin - r.captureStart) * toUs
+                << ",\"dur\":" << double(e.end - begin) * toUs << "}";
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        r.captured.clear();
+    }
+
+} // profiler
+} // lab
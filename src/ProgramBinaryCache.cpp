@@ -0,0 +1,216 @@
+//
+//  ProgramBinaryCache.cpp
+//  LabRender
+//
+//
+
+#include "LabRender/ProgramBinaryCache.h"
+
+#include "LabRender/gl4.h"
+#include "LabRender/Profiler.h"
+#include "LabRender/Shader.h"
+
+#include <LabText/TextScanner.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <vector>
+
+namespace lab {
+
+    namespace {
+
+        // leads every file, followed by the binary
+        struct Header
+        {
+            char magic[4];
+            uint32_t version;
+            uint64_t key;
+            uint64_t sourceBytes;   // guards against a colliding key
+            uint32_t format;
+            uint32_t bytes;
+        };
+
+        const char Magic[4] = { 'L', 'R', 'P', 'B' };
+        const uint32_t Version = 1;
+
+        std::string glString(GLenum name)
+        {
+            const GLubyte * s = glGetString(name);
+            return s ? std::string((const char *) s) : std::string();
+        }
+
+        double msSince(uint64_t start)
+        {
+            return double(profiler::ticks() - start) / profiler::ticksPerMs();
+        }
+
+        void writeJsonString(std::ostream & out, const std::string & s)
+        {
+            out << '"';
+            for (char c : s) {
+                if (c == '"' || c == '\\')
+                    out << '\\' << c;
+                else if (c == '\n')
+                    out << "\\n";
+                else if ((unsigned char) c >= ' ')
+                    out << c;
+            }
+            out << '"';
+        }
+
+    } // anon
+
+    void ProgramBinaryCache::setDirectory(const std::string & directory)
+    {
+        _directory = directory;
+        while (!_directory.empty() && (_directory.back() == '/' || _directory.back() == '\\'))
+            _directory.pop_back();
+    }
+
+    bool ProgramBinaryCache::available()
+    {
+        if (_directory.empty())
+            return false;
+        if (_formats < 0) {
+            GLint formats = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+            _formats = formats;
+            _driver = glString(GL_VENDOR) + "\n" + glString(GL_RENDERER) + "\n" + glString(GL_VERSION);
+        }
+        return _formats > 0;
+    }
+
+    uint64_t ProgramBinaryCache::key(const std::string & vertex, const std::string & fragment) const
+    {
+        std::string all;
+        all.reserve(_driver.size() + vertex.size() + fragment.size() + 2);
+        all += _driver;
+        all += '\0';
+        all += vertex;
+        all += '\0';
+        all += fragment;
+        return TextScanner::Hash(all.c_str(), all.size());
+    }
+
+    std::string ProgramBinaryCache::path(uint64_t key) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long) key);
+        return _directory + name;
+    }
+
+    std::shared_ptr<Shader> ProgramBinaryCache::load(uint64_t key, uint64_t sourceBytes)
+    {
+        std::ifstream file(path(key), std::ios::binary);
+        if (!file)
+            return std::shared_ptr<Shader>();
+
+        Header header;
+        if (!file.read((char *) &header, sizeof(header)) ||
+            memcmp(header.magic, Magic, sizeof(Magic)) || header.version != Version ||
+            header.key != key || header.sourceBytes != sourceBytes)
+            return std::shared_ptr<Shader>();
+
+        std::vector<uint8_t> data(header.bytes);
+        if (!file.read((char *) data.data(), data.size()))
+            return std::shared_ptr<Shader>();
+
+        auto shader = std::make_shared<Shader>();
+        if (!shader->loadBinary(header.format, data.data(), data.size())) {
+            ++_stats.rejected;
+            file.close();
+            std::remove(path(key).c_str());
+            return std::shared_ptr<Shader>();
+        }
+        return shader;
+    }
+
+    void ProgramBinaryCache::save(uint64_t key, uint64_t sourceBytes, const Shader & shader) const
+    {
+        Header header;
+        memcpy(header.magic, Magic, sizeof(Magic));
+        header.version = Version;
+        header.key = key;
+        header.sourceBytes = sourceBytes;
+        std::vector<uint8_t> data;
+        if (!shader.binary(header.format, data))
+            return;
+        header.bytes = uint32_t(data.size());
+
+        // written aside and renamed, so a reader never sees half a file
+        const std::string target = path(key);
+        const std::string temp = target + ".tmp";
+        {
+            std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+            if (!file)
+                return;
+            file.write((const char *) &header, sizeof(header));
+            file.write((const char *) data.data(), data.size());
+            if (!file)
+                return;
+        }
+        std::remove(target.c_str());
+        std::rename(temp.c_str(), target.c_str());
+    }
+
+    std::shared_ptr<Shader> ProgramBinaryCache::program(const std::string & name,
+                                                        const std::string & vertex, const std::string & fragment,
+                                                        bool async)
+    {
+        LR_PROFILE_ZONE("ProgramBinaryCache::program");
+        uint64_t start = profiler::ticks();
+        const bool cached = available();
+        const uint64_t k = cached ? key(vertex, fragment) : 0;
+        const uint64_t sourceBytes = vertex.size() + fragment.size();
+
+        Program made;
+        made.name = name;
+        made.key = k;
+
+        if (cached) {
+            if (std::shared_ptr<Shader> shader = load(k, sourceBytes)) {
+                ++_stats.loaded;
+                _stats.loadMs += msSince(start);
+                made.loaded = true;
+                _programs.push_back(made);
+                return shader;
+            }
+        }
+
+        auto shader = std::make_shared<Shader>();
+        shader->retrievable = cached;
+        shader->async = async;
+        if (cached)
+            shader->onLinked = [this, k, sourceBytes](Shader & linked) { save(k, sourceBytes, linked); };
+        shader->shader(name, Shader::ProgramType::Vertex, false, vertex.c_str()).
+                shader(name, Shader::ProgramType::Fragment, false, fragment.c_str()).link();
+
+        ++_stats.compiled;
+        _stats.compileMs += msSince(start);
+        _programs.push_back(made);
+        return shader;
+    }
+
+    void ProgramBinaryCache::writeManifest(std::ostream & out) const
+    {
+        out << "{\n\"driver\":";
+        writeJsonString(out, _driver);
+        out << ",\n\"directory\":";
+        writeJsonString(out, _directory);
+        out << ",\n\"programs\":[\n";
+        for (size_t i = 0; i < _programs.size(); ++i) {
+            const Program & p = _programs[i];
+            out << "{\"name\":";
+            writeJsonString(out, p.name);
+            out << ",\"file\":";
+            writeJsonString(out, p.key ? path(p.key).substr(_directory.size() + 1) : std::string());
+            out << ",\"loaded\":" << (p.loaded ? "true" : "false") << "}"
+                << (i + 1 < _programs.size() ? ",\n" : "\n");
+        }
+        out << "]}\n";
+    }
+
+} // lab
@@ -15,6 +15,7 @@ namespace lab {
 		filepath.clear();
 		name.clear();
 		version.clear();
+		dynamic_resolution = false;
 		textures.clear();
 		buffers.clear();
 		passes.clear();
@@ -31,6 +32,7 @@ namespace lab {
 
 		name = conf["name"].asString();
 		version = conf["version"].asString();
+		dynamic_resolution = conf["dynamic_resolution"].asString() == "yes";
 
 		printf("\nTextures:\n");
 		for (Json::Value::iterator it = conf["textures"].begin(); it != conf["textures"].end(); ++it)
@@ -136,6 +138,12 @@ namespace lab {
 				pass.draw = Pass::Draw::Quad;
 			else if (drawType == "opaque-geometry")
 				pass.draw = Pass::Draw::OpaqueGeometry;
+			else if (drawType == "depth-prepass")
+				pass.draw = Pass::Draw::DepthPrepass;
+			else if (drawType == "shadow-casters")
+				pass.draw = Pass::Draw::ShadowCasters;
+			else if (drawType == "depth-pyramid")
+				pass.draw = Pass::Draw::DepthPyramid;
 
 			bool writeDepth = pass.depth_write;
 			DepthTest dfunc = pass.depth_test;
@@ -192,6 +192,10 @@ namespace lab {
 		if (s == "s8x2") return TextureType::s8x2;
 		if (s == "s8x3") return TextureType::s8x3;
 		if (s == "s8x4") return TextureType::s8x4;
+		if (s == "bc1") return TextureType::bc1;
+		if (s == "bc3") return TextureType::bc3;
+		if (s == "bc5") return TextureType::bc5;
+		if (s == "bc7") return TextureType::bc7;
 		return TextureType::s8x4;
 	}
 
@@ -205,6 +209,16 @@ namespace lab {
 			return AutomaticUniform::renderTime;
 		else if (s == "mouse_position")
 			return AutomaticUniform::mousePosition;
+		else if (s == "render_scale")
+			return AutomaticUniform::renderScale;
+		else if (s == "inverse_projection")
+			return AutomaticUniform::inverseProjection;
+		else if (s == "inverse_view")
+			return AutomaticUniform::inverseView;
+		else if (s == "light_cluster_grid")
+			return AutomaticUniform::lightClusterGrid;
+		else if (s == "light_cluster_slicing")
+			return AutomaticUniform::lightClusterSlicing;
 		return AutomaticUniform::none;
 	}
 
@@ -226,6 +240,10 @@ namespace lab {
 		case TextureType::s8x1:  return SemanticType::float_st;
 		case TextureType::s8x2:  return SemanticType::vec2_st;
 		case TextureType::s8x3:  return SemanticType::vec3_st;
+		case TextureType::bc5:   return SemanticType::vec2_st;
+		case TextureType::bc1:
+		case TextureType::bc3:
+		case TextureType::bc7:
 		case TextureType::none:
 		case TextureType::s8x4:  return SemanticType::vec4_st;
 		default: return SemanticType::unknown_st;
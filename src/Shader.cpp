@@ -8,14 +8,19 @@
 
 #include "LabRender/Shader.h"
 #include "LabRender/DrawList.h"
+#include "LabRender/LightClusters.h"
+#include "LabRender/TextureStreamer.h"
 #include "LabRender/gl4.h"
 
+#include <algorithm>
+#include <cstring>
+
 namespace lab {
     
     Shader::~Shader() 
 	{
 		if (id)
-	        glDeleteProgram(id);
+	        glState().deleteProgram(id);
         for (size_t i = 0; i < stages.size(); i++) {
             glDeleteShader(stages[i]);
         }
@@ -26,8 +31,38 @@ namespace lab {
             GL_VERTEX_SHADER, GL_FRAGMENT_SHADER,
             GL_GEOMETRY_SHADER, GL_TESS_CONTROL_SHADER, GL_TESS_EVALUATION_SHADER
         };
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+        // whether GL_COMPLETION_STATUS_KHR can be asked without waiting
+        bool parallelCompile()
+        {
+            static int supported = -1;
+            if (supported < 0) {
+                supported = 0;
+                GLint count = 0;
+                glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+                for (GLint i = 0; i < count && !supported; ++i) {
+                    const char * name = (const char *) glGetStringi(GL_EXTENSIONS, i);
+                    if (name && (!strcmp(name, "GL_KHR_parallel_shader_compile") ||
+                                 !strcmp(name, "GL_ARB_parallel_shader_compile")))
+                        supported = 1;
+                }
+            }
+            return supported == 1;
+        }
     }
     
+    std::string Shader::preamble(const std::string & name)
+    {
+        return "//" + name + "\n\n\
+#version 410\n\
+#extension GL_ARB_explicit_attrib_location : enable\n\
+#define texture2D texture\n";
+    }
+
     Shader & Shader::shader(const std::string & name, ProgramType type, bool autoPreamble, char const*const source) 
 	{
         // Compile shader
@@ -35,19 +70,21 @@ namespace lab {
         unsigned int shader = glCreateShader(programTypeToGL[itype]);
         
         std::string src;
-        if (autoPreamble) {
-            src = "//" + name + "\n\n\
-#version 410\n\
-#extension GL_ARB_explicit_attrib_location : enable\n\
-#define texture2D texture\n";
-        }
+        if (autoPreamble)
+            src = preamble(name);
         src += source;
         const char* pStr = src.c_str();
         
         glShaderSource(shader, 1, &pStr, NULL);
         glCompileShader(shader);
         stages.push_back(shader);
-        
+
+        // asking for the log would wait for the compile
+        if (async) {
+            _sources.push_back(source);
+            return *this;
+        }
+
         // Check for errors
         char buffer[512];
         int length;
@@ -63,11 +100,18 @@ namespace lab {
 	{
         // Create and link program
         if (!id) id = glCreateProgram();
+        if (retrievable)
+            glProgramParameteri(id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         for (size_t i = 0; i < stages.size(); i++) {
             glAttachShader(id, stages[i]);
         }
         glLinkProgram(id);
-        
+
+        if (async) {
+            _pending = true;
+            return;
+        }
+
         // Check for errors
         char buffer[512];
         int length;
@@ -79,6 +123,76 @@ namespace lab {
         GLenum glErr = glGetError();
         if (glErr)
             handleGLError(errorPolicy, glErr, buffer);
+
+        if (onLinked)
+            onLinked(*this);
+    }
+
+    bool Shader::ready()
+    {
+        if (_pending) {
+            GLint complete = GL_TRUE;
+            if (parallelCompile())
+                glGetProgramiv(id, GL_COMPLETION_STATUS_KHR, &complete);
+            if (complete == GL_TRUE)
+                finish();
+        }
+        return !_pending && id != 0;
+    }
+
+    void Shader::finish()
+    {
+        if (!_pending)
+            return;
+        _pending = false;
+
+        // the checks shader() and link() skipped
+        char buffer[512];
+        int length;
+        for (size_t i = 0; i < stages.size(); ++i) {
+            glGetShaderInfoLog(stages[i], sizeof(buffer), &length, buffer);
+            if (length)
+                handleGLError(errorPolicy, GL_INVALID_VALUE, buffer, i < _sources.size() ? _sources[i].c_str() : nullptr);
+        }
+        _sources.clear();
+
+        GLint linked = GL_FALSE;
+        glGetProgramiv(id, GL_LINK_STATUS, &linked);
+        glGetProgramInfoLog(id, sizeof(buffer), &length, buffer);
+        if (length != 0 || linked != GL_TRUE)
+            handleGLError(errorPolicy, GL_INVALID_OPERATION, buffer);
+
+        if (linked == GL_TRUE && onLinked)
+            onLinked(*this);
+    }
+
+    bool Shader::binary(unsigned int & format, std::vector<uint8_t> & data) const
+    {
+        GLint length = 0;
+        if (id)
+            glGetProgramiv(id, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return false;
+
+        data.resize(length);
+        GLsizei written = 0;
+        GLenum binaryFormat = 0;
+        glGetProgramBinary(id, length, &written, &binaryFormat, data.data());
+        data.resize(written);
+        format = binaryFormat;
+        return written > 0;
+    }
+
+    bool Shader::loadBinary(unsigned int format, const void * data, size_t bytes)
+    {
+        if (!id) id = glCreateProgram();
+        glProgramBinary(id, format, data, GLsizei(bytes));
+
+        // an unknown format is an error, not just a failed link
+        GLint linked = GL_FALSE;
+        glGetProgramiv(id, GL_LINK_STATUS, &linked);
+        glGetError();
+        return linked == GL_TRUE;
     }
 
     void Shader::bind(Renderer::RenderLock & rl) const 
@@ -86,37 +200,69 @@ namespace lab {
 		checkError(ErrorPolicy::onErrorThrow,
 			TestConditions::exhaustive, "Shader::bind");
 
-		glUseProgram(id);
+		glState().useProgram(id);
 
         checkError(ErrorPolicy::onErrorThrow,
                    TestConditions::exhaustive, "Shader::bind useProgram");
 
+        if (!_resolved)
+            resolve();
+        uint64_t generation = rl.textureGeneration();
+        if (generation != _textureGeneration || _samplerTextures.size() != sampledTextures.size()) {
+            resolveTextures(rl);
+            _textureGeneration = generation;
+        }
+
         int activeTextureUnit = rl.context.activeTextureUnit;
-        for (auto t : sampledTextures) 
+        for (size_t i = 0; i < _samplerTextures.size(); ++i)
 		{
-            if (rl.hasTexture(t.texture)) {
-                glActiveTexture(GL_TEXTURE0 + activeTextureUnit);
-                rl.bindTexture(t.texture);
-                uniformInt(t.name.c_str(), activeTextureUnit);
+            if (_samplerTextures[i]) {
+                // a pass's texture spans its render target
+                const Texture & texture = *_samplerTextures[i];
+                if (rl.context.textureStreamer && rl.context.renderTargetSize.x > 0 && rl.context.renderTargetSize.y > 0)
+                    rl.context.textureStreamer->request(texture,
+                        std::max(float(texture.width) / float(rl.context.renderTargetSize.x),
+                                 float(texture.height) / float(rl.context.renderTargetSize.y)));
+                _samplerTextures[i]->bind(activeTextureUnit);
+                uniformInt(_samplerLocations[i], activeTextureUnit);
                 ++activeTextureUnit;
             }
         }
         rl.context.activeTextureUnit = activeTextureUnit;
         
-        for (auto a : automatics) {
+        for (size_t i = 0; i < automatics.size(); ++i) {
+            const Uniform & a = automatics[i];
+            int location = _automaticLocations[i];
             if (a.automatic == AutomaticUniform::frameBufferResolution) {
-                uniform(a.name.c_str(), V2F(rl.context.framebufferSize.x, rl.context.framebufferSize.y));
+                uniform(location, V2F(rl.context.renderTargetSize.x, rl.context.renderTargetSize.y));
             }
             else if (a.automatic == AutomaticUniform::skyMatrix) {
                 m44f projection = rl.context.drawList->proj;
                 m44f skyMatrix = matrix_invert(matrix_multiply(projection, rl.context.drawList->jacobian));
-                uniform(a.name.c_str(), skyMatrix);
+                uniform(location, skyMatrix);
             }
             else if (a.automatic == AutomaticUniform::renderTime) {
-                uniformFloat(a.name.c_str(), (float) rl.context.renderTime);
+                uniformFloat(location, (float) rl.context.renderTime);
             }
             else if (a.automatic == AutomaticUniform::mousePosition) {
-                uniform(a.name.c_str(), rl.context.mousePosition);
+                uniform(location, rl.context.mousePosition);
+            }
+            else if (a.automatic == AutomaticUniform::renderScale) {
+                uniform(location, V2F(rl.context.renderScale, rl.context.renderScale));
+            }
+            else if (a.automatic == AutomaticUniform::inverseProjection) {
+                uniform(location, matrix_invert(rl.context.drawList->proj));
+            }
+            else if (a.automatic == AutomaticUniform::inverseView) {
+                uniform(location, matrix_invert(rl.context.drawList->view));
+            }
+            else if (a.automatic == AutomaticUniform::lightClusterGrid) {
+                if (rl.context.lightClusters)
+                    uniform(location, rl.context.lightClusters->gridUniform());
+            }
+            else if (a.automatic == AutomaticUniform::lightClusterSlicing) {
+                if (rl.context.lightClusters)
+                    uniform(location, rl.context.lightClusters->slicingUniform());
             }
         }
 
@@ -124,7 +270,26 @@ namespace lab {
                    TestConditions::exhaustive, "Shader::bind set uniforms");
     }
     
-    void Shader::unbind() const { glUseProgram(0); }
+    void Shader::unbind() const { glState().useProgram(0); }
+
+    void Shader::resolve() const
+    {
+        _automaticLocations.clear();
+        for (const Uniform & a : automatics)
+            _automaticLocations.push_back(glGetUniformLocation(id, a.name.c_str()));
+
+        _samplerLocations.clear();
+        for (const Uniform & t : sampledTextures)
+            _samplerLocations.push_back(glGetUniformLocation(id, t.name.c_str()));
+        _resolved = true;
+    }
+
+    void Shader::resolveTextures(Renderer::RenderLock & rl) const
+    {
+        _samplerTextures.clear();
+        for (const Uniform & t : sampledTextures)
+            _samplerTextures.push_back(rl.texture(t.texture));
+    }
 
 
     unsigned int Shader::attribute(const char *name) const { return glGetAttribLocation(id, name); }
@@ -139,5 +304,13 @@ namespace lab {
     void Shader::uniform(const char *name, const m44f &m, bool transpose) const {
         glUniformMatrix4fv(uniform(name), 1, transpose, (float*)&m); }
 
+    void Shader::uniformInt(int location, int i) const { if (location >= 0) glUniform1i(location, i); }
+    void Shader::uniformFloat(int location, float f) const { if (location >= 0) glUniform1f(location, f); }
+    void Shader::uniform(int location, const v2f &v) const { if (location >= 0) glUniform2fv(location, 1, (float*)&v); }
+    void Shader::uniform(int location, const v4f &v) const { if (location >= 0) glUniform4fv(location, 1, (float*)&v); }
+
+    void Shader::uniform(int location, const m44f &m, bool transpose) const {
+        if (location >= 0) glUniformMatrix4fv(location, 1, transpose, (float*)&m); }
+
 
 }
@@ -9,11 +9,14 @@
 #include "LabRender/ShaderBuilder.h"
 #include "LabRender/Model.h"
 #include "LabRender/FrameBuffer.h"
+#include "LabRender/Profiler.h"
 
 #include <set>
 #include <map>
+#include <mutex>
 #include <string>
 #include <sstream>
+#include <unordered_map>
 #include "LabRender/gl4.h"
 #include "LabRender/Utils.h"
 
@@ -21,46 +24,78 @@ namespace lab {
     
     using namespace std;
 
-    ShaderBuilder::Cache* _cache() 
-	{
-        static std::once_flag once;
-        static ShaderBuilder::Cache* _shaderCache = 0;
-        std::call_once(once, []() { _shaderCache = new ShaderBuilder::Cache(); });
-        return _shaderCache;
-    }
-    
     class ShaderBuilder::Cache::Detail 
 	{
     public:
-        Detail() { }
-        std::map<std::string, std::shared_ptr<Shader>> shaders;
+        enum { ShardBits = 4, Shards = 1 << ShardBits };
+
+        struct Shard
+        {
+            std::mutex mutex;
+            std::unordered_map<VariantKey, std::shared_ptr<Shader>> shaders;
+        };
+
+        // the feature bits alone would crowd a few shards
+        Shard & shard(VariantKey key) {
+            return shards[(key * 0x9E3779B97F4A7C15ull) >> (64 - ShardBits)]; }
+
+        Shard shards[Shards];
     };
     
     ShaderBuilder::Cache::Cache() : _detail(new Detail()) { }
     ShaderBuilder::Cache::~Cache() { delete _detail; }
     
-    bool ShaderBuilder::Cache::hasShader(const std::string& shader) const {
-        Cache *cache = _cache();
-        return cache->_detail->shaders.find(shader) != _detail->shaders.end();
+    std::shared_ptr<Shader> ShaderBuilder::Cache::find(VariantKey key) const {
+        Detail::Shard & shard = _detail->shard(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto i = shard.shaders.find(key);
+        return i != shard.shaders.end() ? i->second : std::shared_ptr<Shader>();
     }
     
-    void ShaderBuilder::Cache::add(const std::string& name, std::shared_ptr<Shader> shader) {
-        Cache *cache = _cache();
-        cache->_detail->shaders[name] = shader;
+    std::shared_ptr<Shader> ShaderBuilder::Cache::add(VariantKey key, std::shared_ptr<Shader> shader) {
+        Detail::Shard & shard = _detail->shard(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return shard.shaders.emplace(key, shader).first->second;
     }
-    
-    std::shared_ptr<Shader> ShaderBuilder::Cache::shader(const std::string& name) const {
-        if (!hasShader(name))
-            return std::shared_ptr<Shader>();
-        
-        Cache *cache = _cache();
-        return cache->_detail->shaders.find(name)->second;
+
+    size_t ShaderBuilder::Cache::size() const {
+        size_t count = 0;
+        for (Detail::Shard & shard : _detail->shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            count += shard.shaders.size();
+        }
+        return count;
     }
     
     ShaderBuilder::Cache* ShaderBuilder::cache() {
-        return _cache();
+        // never destroyed, as the GL context may be gone by then
+        static Cache* shaders = new Cache();
+        return shaders;
+    }
+
+    ProgramBinaryCache* ShaderBuilder::binaryCache() {
+        static ProgramBinaryCache binaries;
+        return &binaries;
+    }
+
+    namespace {
+        bool _asyncCompile = false;
+    }
+
+    void ShaderBuilder::setAsyncCompile(bool async) {
+        _asyncCompile = async;
+    }
+
+    bool ShaderBuilder::asyncCompile() {
+        return _asyncCompile;
     }
     
+    std::shared_ptr<Shader> ShaderBuilder::makeProgram(const std::string & name,
+                                                       const char* vtxCode, const char* fgmtCode) {
+        return binaryCache()->program(name, Shader::preamble(name) + vtxCode,
+                                      Shader::preamble(name) + fgmtCode, _asyncCompile);
+    }
+
     const char* preamble() {
         return "\
 #version 410\n\
@@ -70,6 +105,30 @@ namespace lab {
     }
     
     
+    // Helpers for gbuffers that pack their contents. Normals are stored
+    // octahedrally encoded in two signed channels, and positions are not
+    // stored at all, but reconstructed from the depth buffer.
+    const char* gbufferFunctions() {
+        return "\
+vec2 octWrap(vec2 v) {\n\
+    return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);\n\
+}\n\
+vec2 octEncode(vec3 n) {\n\
+    n /= max(abs(n.x) + abs(n.y) + abs(n.z), 1e-6);\n\
+    return n.z >= 0.0 ? n.xy : octWrap(n.xy);\n\
+}\n\
+vec3 octDecode(vec2 e) {\n\
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n\
+    float t = clamp(-n.z, 0.0, 1.0);\n\
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);\n\
+    return normalize(n);\n\
+}\n\
+vec3 positionFromDepth(vec2 screenUV, float depth, mat4 inverseProjection) {\n\
+    vec4 p = inverseProjection * vec4(vec3(screenUV, depth) * 2.0 - 1.0, 1.0);\n\
+    return p.xyz / p.w;\n\
+}\n";
+    }
+
     std::string generateFragment() {
         std::stringstream s;
         s << preamble();
@@ -173,12 +232,14 @@ namespace lab {
             }
             s << "} vert;" << std::endl;
         }
+        s << gbufferFunctions();
         s << body << std::endl;
         
         return s.str();
     }
     
     std::shared_ptr<Shader> ShaderBuilder::makeShader(const ShaderSpec & spec, const VAO & vao, bool printShader) {
+        LR_PROFILE_ZONE("ShaderBuilder::makeShader");
         string vrtx = loadFile(spec.vertexShaderPath.c_str());
         string fgmt = loadFile(spec.fragmentShaderPath.c_str());
         string fgmt_postAmble = loadFile(spec.fragmentShaderPostamblePath.c_str(), false);
@@ -207,9 +268,7 @@ namespace lab {
         }
         
         vao.bindVAO();
-        std::shared_ptr<Shader>shader = std::make_shared<Shader>();
-        shader->shader(name, Shader::ProgramType::Vertex, false, vtx.c_str()).
-                shader(name, Shader::ProgramType::Fragment, false, fgm.c_str()).link();
+        std::shared_ptr<Shader> shader = binaryCache()->program(name, vtx, fgm, _asyncCompile);
         vao.unbindVAO();
 
         return shader;
@@ -0,0 +1,364 @@
+//
+//  ShadowAtlas.cpp
+//  LabRender
+//
+//
+
+#include "LabRender/ShadowAtlas.h"
+
+#include "LabRender/gl4.h"
+#include "LabRender/DrawList.h"
+#include "LabRender/FrameArena.h"
+#include "LabRender/GLState.h"
+#include "LabRender/Light.h"
+#include "LabRender/ModelBase.h"
+#include "LabRender/Profiler.h"
+#include "LabRender/Shader.h"
+#include "LabRender/ShaderBuilder.h"
+#include "LabRender/Texture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace lab {
+
+    namespace {
+
+        // false if the box is entirely outside one of the clip planes
+        bool intersects(const m44f & viewProj, const Bounds & b)
+        {
+            int outside[6] = { 0, 0, 0, 0, 0, 0 };
+            for (int i = 0; i < 8; ++i) {
+                v4f p = matrix_multiply(viewProj, v4f(boundsCorner(b, i), 1.f));
+                outside[0] += p.x < -p.w;
+                outside[1] += p.x > p.w;
+                outside[2] += p.y < -p.w;
+                outside[3] += p.y > p.w;
+                outside[4] += p.z < -p.w;
+                outside[5] += p.z > p.w;
+            }
+            for (int i = 0; i < 6; ++i)
+                if (outside[i] == 8)
+                    return false;
+            return true;
+        }
+
+        // a GL perspective projection looking down -z of the light
+        m44f spotViewProj(const v3f & eye, const v3f & dir, float outerAngle, float radius)
+        {
+            v3f up = fabsf(dir.y) < 0.99f ? v3f(0, 1, 0) : v3f(1, 0, 0);
+            v3f s = normalized(cross(dir, up));
+            v3f u = cross(s, dir);
+            m44f view(s.x, u.x, -dir.x, 0,
+                      s.y, u.y, -dir.y, 0,
+                      s.z, u.z, -dir.z, 0,
+                      -dot(s, eye), -dot(u, eye), dot(dir, eye), 1);
+
+            float n = std::max(0.05f, radius * 0.01f);
+            float f = radius;
+            float t = 1.f / tanf(degToRad(std::min(89.f, outerAngle)));
+            m44f proj(t, 0, 0, 0,
+                      0, t, 0, 0,
+                      0, 0, -(f + n) / (f - n), -1,
+                      0, 0, -2.f * f * n / (f - n), 0);
+            return matrix_multiply(proj, view);
+        }
+
+        int tileSize(float pixels, const ShadowAtlas::Settings & s)
+        {
+            int size = s.minTile;
+            while (size < s.maxTile && float(size) < pixels)
+                size <<= 1;
+            return size;
+        }
+
+        struct Candidate
+        {
+            int light;
+            int size;
+            float importance;
+            m44f viewProj;
+        };
+
+    } // anon
+
+    ShadowAtlas::ShadowAtlas()
+    : _texture(std::make_shared<Texture>())
+    , _fbo(ErrorPolicy::onErrorLogThrow, false)
+    {
+    }
+
+    ShadowAtlas::~ShadowAtlas()
+    {
+    }
+
+    void ShadowAtlas::setSettings(const Settings & s)
+    {
+        Settings n = s;
+        n.minTile = std::max(16, s.minTile);
+        n.maxTile = std::max(n.minTile, s.maxTile);
+        n.size = std::max(n.maxTile, s.size);
+        n.maxUpdatesPerFrame = std::max(1, s.maxUpdatesPerFrame);
+        if (n.size != _settings.size || n.minTile != _settings.minTile || n.maxTile != _settings.maxTile)
+            _invalidated = true;
+        _settings = n;
+    }
+
+    void ShadowAtlas::invalidate()
+    {
+        _invalidated = true;
+    }
+
+    const ShadowAtlas::Shadow * ShadowAtlas::shadow(size_t lightIndex) const
+    {
+        if (lightIndex >= _lightShadow.size() || _lightShadow[lightIndex] < 0)
+            return nullptr;
+        const Shadow & s = _shadows[_lightShadow[lightIndex]];
+        return s.rendered || s.renderThisFrame ? &s : nullptr;
+    }
+
+    bool ShadowAtlas::isFree(int x, int y, int size) const
+    {
+        int c = size / _settings.minTile;
+        int cx = x / _settings.minTile;
+        int cy = y / _settings.minTile;
+        for (int j = cy; j < cy + c; ++j)
+            for (int i = cx; i < cx + c; ++i)
+                if (_cells[j * _cellsPerRow + i])
+                    return false;
+        return true;
+    }
+
+    void ShadowAtlas::occupy(int x, int y, int size)
+    {
+        int c = size / _settings.minTile;
+        int cx = x / _settings.minTile;
+        int cy = y / _settings.minTile;
+        for (int j = cy; j < cy + c; ++j)
+            for (int i = cx; i < cx + c; ++i)
+                _cells[j * _cellsPerRow + i] = 1;
+    }
+
+    bool ShadowAtlas::place(int size, int & x, int & y)
+    {
+        for (y = 0; y + size <= _settings.size; y += size)
+            for (x = 0; x + size <= _settings.size; x += size)
+                if (isFree(x, y, size)) {
+                    occupy(x, y, size);
+                    return true;
+                }
+        return false;
+    }
+
+    void ShadowAtlas::update(const DrawList & drawList, v2i viewport, FrameArena & arena)
+    {
+        LR_PROFILE_ZONE("ShadowAtlas::update");
+        _stats = Stats();
+
+        if (_invalidated) {
+            _shadows.clear();
+            _invalidated = false;
+        }
+        std::swap(_previous, _shadows);
+        _shadows.clear();
+        _lightShadow.assign(drawList.lights.size(), -1);
+
+        // snapshot the casters, and find the bounds of any that moved
+        std::swap(_previousCasters, _casters);
+        _casters.clear();
+        for (const auto & model : drawList.deferredMeshes) {
+            const m44f & t = model->transform.transform();
+            _casters.push_back(Caster{ model.get(), t, transformBounds(t, model->localBounds()) });
+        }
+        std::sort(_casters.begin(), _casters.end(),
+                  [](const Caster & a, const Caster & b) { return a.model < b.model; });
+
+        FrameVector<Bounds> moved { ArenaAllocator<Bounds>(arena) };
+        size_t p = 0, c = 0;
+        while (p < _previousCasters.size() || c < _casters.size()) {
+            if (c == _casters.size() || (p < _previousCasters.size() && _previousCasters[p].model < _casters[c].model))
+                moved.push_back(_previousCasters[p++].bounds);      // removed
+            else if (p == _previousCasters.size() || _casters[c].model < _previousCasters[p].model)
+                moved.push_back(_casters[c++].bounds);              // added
+            else {
+                if (memcmp(&_previousCasters[p].transform, &_casters[c].transform, sizeof(m44f))) {
+                    moved.push_back(_previousCasters[p].bounds);
+                    moved.push_back(_casters[c].bounds);
+                }
+                ++p, ++c;
+            }
+        }
+
+        // the shadow casting spot lights whose light reaches the screen
+        const m44f cameraViewProj = matrix_multiply(drawList.proj, drawList.view);
+        const float pixelsPerUnit = 0.5f * viewport.y * drawList.proj.m[5];
+        FrameVector<Candidate> candidates { ArenaAllocator<Candidate>(arena) };
+        for (size_t i = 0; i < drawList.lights.size(); ++i) {
+            const Illuminant & illuminant = *drawList.lights[i];
+            const SpotLight * spot = dynamic_cast<const SpotLight *>(illuminant.light.get());
+            if (!spot || !spot->castsShadow || spot->radius <= 0)
+                continue;
+
+            m44f t = illuminant.transform ? illuminant.transform->transform() : m44f_identity;
+            v3f position(t.m[12], t.m[13], t.m[14]);
+            v3f direction(-t.m[8], -t.m[9], -t.m[10]);
+            float len = length(direction);
+            direction = len > 0 ? direction / len : v3f(0, 0, -1);
+
+            float r = spot->radius;
+            if (!intersects(cameraViewProj, Bounds(position - r, position + r)))
+                continue;
+
+            // the diameter of the light's sphere on screen; a camera inside
+            // it gets the largest tile
+            v4f view = matrix_multiply(drawList.view, v4f(position, 1.f));
+            float depth = -view.z - r;
+            float pixels = depth > 0 ? 2.f * r * pixelsPerUnit / depth : 1e30f;
+            pixels *= _settings.resolutionScale;
+
+            candidates.push_back(Candidate{ int(i), tileSize(pixels, _settings), pixels,
+                                            spotViewProj(position, direction, spot->outerAngle, r) });
+        }
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const Candidate & a, const Candidate & b) {
+                      return a.size != b.size ? a.size > b.size : a.importance > b.importance; });
+
+        _cellsPerRow = _settings.size / _settings.minTile;
+        _cells.assign(size_t(_cellsPerRow) * _cellsPerRow, 0);
+
+        // first keep the tiles of lights that want the same size as before,
+        // then place the rest, shrinking them if the atlas is full
+        FrameVector<int> unplaced { ArenaAllocator<int>(arena) };
+        for (size_t k = 0; k < candidates.size(); ++k) {
+            const Candidate & cand = candidates[k];
+            const Illuminant * key = drawList.lights[cand.light].get();
+            auto prev = std::find_if(_previous.begin(), _previous.end(),
+                                     [key](const Shadow & s) { return s.light == key; });
+            if (prev == _previous.end() || prev->size != cand.size) {
+                unplaced.push_back(int(k));
+                continue;
+            }
+
+            Shadow s = *prev;
+            s.importance = cand.importance;
+            if (memcmp(&s.viewProj, &cand.viewProj, sizeof(m44f)))
+                s.dirty = true;
+            s.viewProj = cand.viewProj;
+            for (size_t m = 0; m < moved.size() && !s.dirty; ++m)
+                if (intersects(s.viewProj, moved[m]) || intersects(s.renderedViewProj, moved[m]))
+                    s.dirty = true;
+            occupy(s.x, s.y, s.size);
+            _lightShadow[cand.light] = int(_shadows.size());
+            _shadows.push_back(s);
+        }
+        for (int k : unplaced) {
+            const Candidate & cand = candidates[k];
+            Shadow s;
+            s.light = drawList.lights[cand.light].get();
+            s.importance = cand.importance;
+            s.viewProj = cand.viewProj;
+            int size = cand.size;
+            while (size >= _settings.minTile && !place(size, s.x, s.y))
+                size >>= 1;
+            if (size < _settings.minTile)
+                continue;
+            s.size = size;
+            _lightShadow[cand.light] = int(_shadows.size());
+            _shadows.push_back(s);
+        }
+
+        // render the most important out of date tiles, within the budget
+        FrameVector<int> dirty { ArenaAllocator<int>(arena) };
+        for (size_t i = 0; i < _shadows.size(); ++i) {
+            _shadows[i].renderThisFrame = false;
+            if (_shadows[i].dirty)
+                dirty.push_back(int(i));
+            else
+                ++_stats.cached;
+        }
+        std::sort(dirty.begin(), dirty.end(),
+                  [this](int a, int b) { return _shadows[a].importance > _shadows[b].importance; });
+        for (size_t i = 0; i < dirty.size(); ++i) {
+            if (int(i) < _settings.maxUpdatesPerFrame)
+                _shadows[dirty[i]].renderThisFrame = true;
+            else
+                ++_stats.postponed;
+        }
+        _stats.shadowed = int(_shadows.size());
+    }
+
+    void ShadowAtlas::prepareShaders()
+    {
+        if (_shader)
+            return;
+        _shader = ShaderBuilder::makeProgram("shadow-caster", glsl(
+            layout(location = 0) in vec3 a_position;
+            uniform mat4 u_modelViewProj;
+            void main() { gl_Position = u_modelViewProj * vec4(a_position, 1.0); }
+        ), glsl(
+            void main() {}
+        ));
+    }
+
+    void ShadowAtlas::render(Renderer::RenderLock & rl)
+    {
+        LR_PROFILE_ZONE("ShadowAtlas::render");
+
+        bool any = false;
+        for (const Shadow & s : _shadows)
+            any = any || s.renderThisFrame;
+        if (!any)
+            return;
+
+        if (_fboSize != _settings.size) {
+            _fbo.createDepth(_settings.size, _settings.size, _texture);
+            _fboSize = _settings.size;
+        }
+
+        prepareShaders();
+        if (_mvpLocation < 0) {
+            _shader->finish();
+            _mvpLocation = int(_shader->uniform("u_modelViewProj"));
+        }
+
+        _fbo.bindForWrite();
+        unsigned int none = GL_NONE;
+        glState().drawBuffers(1, &none);
+        glState().enable(GL_DEPTH_TEST);
+        glState().depthFunc(GL_LESS);
+        glState().depthMask(true);
+        glState().enable(GL_SCISSOR_TEST);
+        glState().enable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(1.5f, 4.f);
+        _shader->bind(rl);
+
+        for (Shadow & s : _shadows) {
+            if (!s.renderThisFrame)
+                continue;
+
+            glState().viewport(s.x, s.y, s.size, s.size);
+            glState().scissor(s.x, s.y, s.size, s.size);
+            glClear(GL_DEPTH_BUFFER_BIT);
+
+            for (const auto & model : rl.context.drawList->deferredMeshes) {
+                const m44f & t = model->transform.transform();
+                if (!intersects(s.viewProj, transformBounds(t, model->localBounds())))
+                    continue;
+                _shader->uniform(_mvpLocation, matrix_multiply(s.viewProj, t));
+                model->draw();
+                ++rl.context.drawCount;
+                ++_stats.casterDraws;
+            }
+
+            s.renderedViewProj = s.viewProj;
+            s.rendered = true;
+            s.dirty = false;
+            ++_stats.rendered;
+        }
+
+        glState().disable(GL_POLYGON_OFFSET_FILL);
+        glState().disable(GL_SCISSOR_TEST);
+    }
+
+} // lab
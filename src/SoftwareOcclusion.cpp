@@ -0,0 +1,343 @@
+//
+//  SoftwareOcclusion.cpp
+//  LabRender
+//
+//
+
+#include "LabRender/SoftwareOcclusion.h"
+
+#include "LabRender/DrawList.h"
+#include "LabRender/Model.h"
+#include "LabRender/ModelBase.h"
+#include "LabRender/Profiler.h"
+#include "LabRender/Vertex.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LR_SOFTWARE_OCCLUSION_SSE2 1
+#endif
+
+namespace lab {
+
+    namespace {
+
+        const int TilePixels = SoftwareOcclusion::TileWidth * SoftwareOcclusion::TileHeight;
+        const int TileCount = SoftwareOcclusion::TilesX * SoftwareOcclusion::TilesY;
+
+    } // anon
+
+    std::shared_ptr<OccluderMesh> OccluderMesh::fromModelPart(const ModelPart & part)
+    {
+        auto mesh = std::make_shared<OccluderMesh>();
+        const VAO * vao = part.verts();
+        const BufferBase * vertices = vao ? vao->vertices() : nullptr;
+        if (!vertices || vertices->layout.empty() || vertices->layout[0].semanticType != SemanticType::vec3_st)
+            return mesh;
+
+        // every Vert struct starts with float pos[3]
+        const uint8_t * data = (const uint8_t *) vertices->buffer();
+        const size_t count = vertices->count();
+        const int stride = vertices->stride();
+        mesh->positions.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            const float * p = (const float *) (data + i * stride);
+            mesh->positions.push_back(v3f(p[0], p[1], p[2]));
+        }
+
+        if (const IndexBuffer * indices = vao->indices()) {
+            const IntEl * el = (const IntEl *) indices->buffer();
+            mesh->indices.reserve(indices->count());
+            for (size_t i = 0; i < indices->count(); ++i)
+                mesh->indices.push_back(uint32_t(el[i].x));
+        }
+        else {
+            mesh->indices.resize(count);
+            for (size_t i = 0; i < count; ++i)
+                mesh->indices[i] = uint32_t(i);
+        }
+        mesh->indices.resize(mesh->indices.size() / 3 * 3);
+        return mesh;
+    }
+
+    SoftwareOcclusion::SoftwareOcclusion(int workers)
+    : _depth(size_t(Width) * Height, 1.f)
+    , _pool(workers)
+    {
+        std::fill(_tileMax, _tileMax + TileCount, 1.f);
+    }
+
+    void SoftwareOcclusion::begin(const m44f & viewProj)
+    {
+        _viewProj = viewProj;
+        _stats = Stats();
+        _rasterized = false;
+        _triangles.clear();
+        for (auto & bin : _bins)
+            bin.clear();
+    }
+
+    void SoftwareOcclusion::addOccluder(const OccluderMesh & mesh, const m44f & model)
+    {
+        const m44f mvp = matrix_multiply(_viewProj, model);
+        _clip.resize(mesh.positions.size());
+        for (size_t i = 0; i < mesh.positions.size(); ++i)
+            _clip[i] = matrix_multiply(mvp, v4f(mesh.positions[i], 1.f));
+        ++_stats.occluders;
+
+        const uint32_t count = uint32_t(_clip.size());
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+            const uint32_t a = mesh.indices[i], b = mesh.indices[i + 1], c = mesh.indices[i + 2];
+            if (a >= count || b >= count || c >= count)
+                continue;
+            const v4f in[3] = { _clip[a], _clip[b], _clip[c] };
+
+            // clip against the near plane, z = -w
+            float d[3];
+            int front = 0;
+            for (int j = 0; j < 3; ++j) {
+                d[j] = in[j].z + in[j].w;
+                front += d[j] >= 0;
+            }
+            if (front == 3) {
+                setup(in);
+                continue;
+            }
+            if (front == 0)
+                continue;
+
+            v4f out[4];
+            int n = 0;
+            for (int j = 0; j < 3; ++j) {
+                int k = (j + 1) % 3;
+                if (d[j] >= 0)
+                    out[n++] = in[j];
+                if ((d[j] >= 0) != (d[k] >= 0))
+                    out[n++] = in[j] + (in[k] - in[j]) * (d[j] / (d[j] - d[k]));
+            }
+            setup(out);
+            if (n == 4) {
+                const v4f second[3] = { out[0], out[2], out[3] };
+                setup(second);
+            }
+        }
+    }
+
+    void SoftwareOcclusion::setup(const v4f * clip)
+    {
+        float sx[3], sy[3], sz[3];
+        for (int i = 0; i < 3; ++i) {
+            if (!(clip[i].w > 1e-6f))
+                return;
+            float inv = 1.f / clip[i].w;
+            sx[i] = (clip[i].x * inv * 0.5f + 0.5f) * Width;
+            sy[i] = (clip[i].y * inv * 0.5f + 0.5f) * Height;
+            sz[i] = clip[i].z * inv * 0.5f + 0.5f;
+        }
+
+        float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sy[1] - sy[0]) * (sx[2] - sx[0]);
+        if (!(std::fabs(area) > 1e-8f))
+            return;
+
+        // the pixels whose centers are within the bounds of the triangle,
+        // clamped first as vertices near the eye can be far off screen
+        auto clampTo = [](float v, int size) { return std::min(std::max(v, -1.f), float(size) + 1.f); };
+        Triangle t;
+        t.x0 = std::max(0, int(std::ceil(clampTo(std::min(sx[0], std::min(sx[1], sx[2])), Width) - 0.5f)));
+        t.x1 = std::min(Width - 1, int(std::floor(clampTo(std::max(sx[0], std::max(sx[1], sx[2])), Width) - 0.5f)));
+        t.y0 = std::max(0, int(std::ceil(clampTo(std::min(sy[0], std::min(sy[1], sy[2])), Height) - 0.5f)));
+        t.y1 = std::min(Height - 1, int(std::floor(clampTo(std::max(sy[0], std::max(sy[1], sy[2])), Height) - 0.5f)));
+        if (t.x0 > t.x1 || t.y0 > t.y1)
+            return;
+
+        // edges evaluated at pixel x, y sample x + 0.5, y + 0.5
+        const float sign = area > 0 ? 1.f : -1.f;
+        for (int i = 0; i < 3; ++i) {
+            int j = (i + 1) % 3;
+            float a = (sy[i] - sy[j]) * sign;
+            float b = (sx[j] - sx[i]) * sign;
+            float c = (sx[i] * sy[j] - sy[i] * sx[j]) * sign;
+            t.edge[i][0] = a;
+            t.edge[i][1] = b;
+            t.edge[i][2] = c + 0.5f * (a + b);
+        }
+
+        // window depth is affine in screen space; a pixel keeps the farthest
+        // depth of the plane over it, but never past the triangle's
+        t.dzdx = ((sz[1] - sz[0]) * (sy[2] - sy[0]) - (sz[2] - sz[0]) * (sy[1] - sy[0])) / area;
+        t.dzdy = ((sz[2] - sz[0]) * (sx[1] - sx[0]) - (sz[1] - sz[0]) * (sx[2] - sx[0])) / area;
+        t.z0 = sz[0] + t.dzdx * (0.5f - sx[0]) + t.dzdy * (0.5f - sy[0])
+             + 0.5f * (std::fabs(t.dzdx) + std::fabs(t.dzdy));
+        t.zmax = std::max(sz[0], std::max(sz[1], sz[2]));
+
+        const uint32_t index = uint32_t(_triangles.size());
+        _triangles.push_back(t);
+        ++_stats.triangles;
+        for (int ty = t.y0 / TileHeight; ty <= t.y1 / TileHeight; ++ty)
+            for (int tx = t.x0 / TileWidth; tx <= t.x1 / TileWidth; ++tx)
+                _bins[ty * TilesX + tx].push_back(index);
+    }
+
+    void SoftwareOcclusion::rasterize()
+    {
+        LR_PROFILE_ZONE("SoftwareOcclusion::rasterize");
+        _pool.run(TileCount, [this](int tile) { rasterizeTile(tile); });
+        _rasterized = true;
+    }
+
+    void SoftwareOcclusion::rasterizeTile(int tile)
+    {
+        const int tileX = (tile % TilesX) * TileWidth;
+        const int tileY = (tile / TilesX) * TileHeight;
+        float * depth = _depth.data() + size_t(tile) * TilePixels;
+        std::fill(depth, depth + TilePixels, 1.f);
+
+        for (uint32_t index : _bins[tile]) {
+            const Triangle & t = _triangles[index];
+            const int x0 = (std::max(t.x0, tileX) - tileX) & ~3;     // whole groups of four
+            const int x1 = std::min(t.x1, tileX + TileWidth - 1) - tileX;
+            const int y0 = std::max(t.y0, tileY) - tileY;
+            const int y1 = std::min(t.y1, tileY + TileHeight - 1) - tileY;
+
+            for (int y = y0; y <= y1; ++y) {
+                const float fy = float(tileY + y);
+                float * row = depth + y * TileWidth;
+
+#ifdef LR_SOFTWARE_OCCLUSION_SSE2
+                const __m128 step = _mm_setr_ps(0.f, 1.f, 2.f, 3.f);
+                const __m128 zero = _mm_setzero_ps();
+                const __m128 zmax = _mm_set1_ps(t.zmax);
+                __m128 rowEdge[3], dx[3];
+                for (int e = 0; e < 3; ++e) {
+                    rowEdge[e] = _mm_set1_ps(t.edge[e][1] * fy + t.edge[e][2]);
+                    dx[e] = _mm_set1_ps(t.edge[e][0]);
+                }
+                const __m128 rowZ = _mm_set1_ps(t.z0 + t.dzdy * fy);
+                const __m128 dzdx = _mm_set1_ps(t.dzdx);
+
+                for (int x = x0; x <= x1; x += 4) {
+                    const __m128 fx = _mm_add_ps(_mm_set1_ps(float(tileX + x)), step);
+                    __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(dx[0], fx), rowEdge[0]), zero);
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(dx[1], fx), rowEdge[1]), zero));
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(dx[2], fx), rowEdge[2]), zero));
+                    if (!_mm_movemask_ps(inside))
+                        continue;
+                    const __m128 z = _mm_min_ps(_mm_add_ps(_mm_mul_ps(dzdx, fx), rowZ), zmax);
+                    const __m128 old = _mm_loadu_ps(row + x);
+                    const __m128 nearer = _mm_min_ps(old, z);
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+                }
+#else
+                // summed in the same order as above, for the same result
+                float rowEdge[3];
+                for (int e = 0; e < 3; ++e)
+                    rowEdge[e] = t.edge[e][1] * fy + t.edge[e][2];
+                const float rowZ = t.z0 + t.dzdy * fy;
+
+                for (int x = x0; x <= x1; ++x) {
+                    const float fx = float(tileX + x);
+                    if (t.edge[0][0] * fx + rowEdge[0] >= 0 &&
+                        t.edge[1][0] * fx + rowEdge[1] >= 0 &&
+                        t.edge[2][0] * fx + rowEdge[2] >= 0)
+                    {
+                        const float z = std::min(t.dzdx * fx + rowZ, t.zmax);
+                        row[x] = std::min(row[x], z);
+                    }
+                }
+#endif
+            }
+        }
+
+        _tileMax[tile] = *std::max_element(depth, depth + TilePixels);
+    }
+
+    void SoftwareOcclusion::update(const DrawList & drawList)
+    {
+        LR_PROFILE_ZONE("SoftwareOcclusion::update");
+        begin(matrix_multiply(drawList.proj, drawList.view));
+
+        const size_t count = drawList.deferredMeshes.size();
+        _culled.assign(count, 0);
+        for (size_t i = 0; i < count; ++i) {
+            const ModelBase & model = *drawList.deferredMeshes[i];
+            if (model.occluder)
+                addOccluder(*model.occluder, model.transform.transform());
+        }
+        if (_triangles.empty())
+            return;
+
+        rasterize();
+
+        for (size_t i = 0; i < count; ++i) {
+            const ModelBase & model = *drawList.deferredMeshes[i];
+            const Bounds local = model.localBounds();
+            if (!(local.first.x <= local.second.x && local.first.y <= local.second.y && local.first.z <= local.second.z))
+                continue;
+            ++_stats.tested;
+            if (occluded(model.transform.transform(), local)) {
+                _culled[i] = 1;
+                ++_stats.culled;
+            }
+        }
+    }
+
+    bool SoftwareOcclusion::occluded(const m44f & model, const Bounds & local) const
+    {
+        if (!_rasterized)
+            return false;
+
+        const m44f mvp = matrix_multiply(_viewProj, model);
+        float x0 = 1e30f, y0 = 1e30f, x1 = -1e30f, y1 = -1e30f;
+        float nearest = 1e30f;
+        for (int i = 0; i < 8; ++i) {
+            v4f p = matrix_multiply(mvp, v4f(boundsCorner(local, i), 1.f));
+            if (p.w <= 1e-4f)
+                return false;
+            float inv = 1.f / p.w;
+            x0 = std::min(x0, p.x * inv);
+            x1 = std::max(x1, p.x * inv);
+            y0 = std::min(y0, p.y * inv);
+            y1 = std::max(y1, p.y * inv);
+            nearest = std::min(nearest, p.z * inv);
+        }
+        // off screen is for frustum culling to judge
+        if (x1 < -1.f || x0 > 1.f || y1 < -1.f || y0 > 1.f)
+            return false;
+        nearest = nearest * 0.5f + 0.5f;
+
+        // the pixels the rectangle touches, and one more around them
+        const int px0 = std::max(0, int(std::floor((std::max(x0, -1.f) * 0.5f + 0.5f) * Width)) - 1);
+        const int px1 = std::min(Width - 1, int(std::floor((std::min(x1, 1.f) * 0.5f + 0.5f) * Width)) + 1);
+        const int py0 = std::max(0, int(std::floor((std::max(y0, -1.f) * 0.5f + 0.5f) * Height)) - 1);
+        const int py1 = std::min(Height - 1, int(std::floor((std::min(y1, 1.f) * 0.5f + 0.5f) * Height)) + 1);
+
+        for (int ty = py0 / TileHeight; ty <= py1 / TileHeight; ++ty)
+            for (int tx = px0 / TileWidth; tx <= px1 / TileWidth; ++tx) {
+                const int tile = ty * TilesX + tx;
+                if (nearest > _tileMax[tile])
+                    continue;
+
+                const float * depth = _depth.data() + size_t(tile) * TilePixels;
+                const int ax = std::max(px0, tx * TileWidth) - tx * TileWidth;
+                const int bx = std::min(px1, tx * TileWidth + TileWidth - 1) - tx * TileWidth;
+                const int ay = std::max(py0, ty * TileHeight) - ty * TileHeight;
+                const int by = std::min(py1, ty * TileHeight + TileHeight - 1) - ty * TileHeight;
+                for (int y = ay; y <= by; ++y)
+                    for (int x = ax; x <= bx; ++x)
+                        if (!(nearest > depth[y * TileWidth + x]))
+                            return false;
+            }
+        return true;
+    }
+
+    float SoftwareOcclusion::depth(int x, int y) const
+    {
+        if (x < 0 || y < 0 || x >= Width || y >= Height)
+            return 1.f;
+        const int tile = (y / TileHeight) * TilesX + x / TileWidth;
+        return _depth[size_t(tile) * TilePixels + (y % TileHeight) * TileWidth + x % TileWidth];
+    }
+
+} // lab
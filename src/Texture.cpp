@@ -7,6 +7,8 @@
 //
 
 #include "LabRender/Texture.h"
+#include "LabRender/TextureImage.h"
+#include "LabRender/TextureStreamer.h"
 #include "LabRender/gl4.h"
 #include "LabRender/Utils.h"
 
@@ -16,10 +18,19 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
 
+#include <algorithm>
+#include <atomic>
+
 using namespace std;
 
 namespace lab {
 
+uint64_t nextTextureSetGeneration()
+{
+    static std::atomic<uint64_t> generation(0);
+    return ++generation;
+}
+
 Texture::Texture()
 : id(0), target(GL_TEXTURE_2D), width(0), height(0), depth(1), depthTexture(false)
 , type(GL_UNSIGNED_BYTE), format(GL_RGBA8)
@@ -28,20 +39,19 @@ Texture::Texture()
 
 Texture::~Texture()
 {
-	glDeleteTextures(1,& id);
+	glState().deleteTexture(id);
 }
 
 void Texture::bind(int unit)   const {
-    glActiveTexture(GL_TEXTURE0 + unit);
-    //    if (target == GL_TEXTURE_CUBE_MAP)
-    //  glEnable(GL_TEXTURE_CUBE_MAP);
-    glBindTexture(target, id);
+    glState().bindTexture(unit, target, id);
 }
 void Texture::unbind(int unit) const {
-    glActiveTexture(GL_TEXTURE0 + unit);
-    // if (target == GL_TEXTURE_CUBE_MAP)
-    //  glDisable(GL_TEXTURE_CUBE_MAP);
-    glBindTexture(target, 0);
+    glState().bindTexture(unit, target, 0);
+}
+
+// the minification filter that also filters between mips
+static int mipmapFilter(int filter) {
+    return filter == GL_NEAREST ? GL_NEAREST_MIPMAP_NEAREST : GL_LINEAR_MIPMAP_LINEAR;
 }
 
 int glType(TextureType t) {
@@ -62,6 +72,10 @@ int glType(TextureType t) {
         case TextureType::s8x2:
         case TextureType::s8x3:
         case TextureType::s8x4: return GL_BYTE;
+        case TextureType::bc1:
+        case TextureType::bc3:
+        case TextureType::bc5:
+        case TextureType::bc7: return GL_UNSIGNED_BYTE;
         default: return 0;
     }
 }
@@ -94,6 +108,10 @@ int glInternalFormat(TextureType t) {
         case TextureType::s8x2:  return GL_RG8_SNORM;
         case TextureType::s8x3:  return GL_RGB8_SNORM;
         case TextureType::s8x4:  return GL_RGBA8_SNORM;
+        case TextureType::bc1:   return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+        case TextureType::bc3:   return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case TextureType::bc5:   return GL_COMPRESSED_RG_RGTC2;
+        case TextureType::bc7:   return GL_COMPRESSED_RGBA_BPTC_UNORM;
         default: return 0;
     }
 }
@@ -144,12 +162,12 @@ SemanticType glFormatToSemanticType(int f) {
 
 int glFormat(TextureType t) {
     switch (t) {
-        case TextureType::f32x1: return GL_RED;
-        case TextureType::f32x2: return GL_RG;
+        case TextureType::f32x1: return GL_R32F;
+        case TextureType::f32x2: return GL_RG32F;
         case TextureType::f32x3: return GL_RGB32F;
         case TextureType::f32x4: return GL_RGBA32F;
-        case TextureType::f16x1: return GL_RED;
-        case TextureType::f16x2: return GL_RG;
+        case TextureType::f16x1: return GL_R16F;
+        case TextureType::f16x2: return GL_RG16F;
         case TextureType::f16x3: return GL_RGB16F;
         case TextureType::f16x4: return GL_RGBA16F;
         case TextureType::u8x1: return GL_RED;
@@ -159,6 +177,10 @@ int glFormat(TextureType t) {
         case TextureType::s8x1: return GL_RED;
         case TextureType::s8x2: return GL_RG;
         case TextureType::s8x3: return GL_RGB;
+        case TextureType::bc1:
+        case TextureType::bc3:
+        case TextureType::bc5:
+        case TextureType::bc7: return glInternalFormat(t);
         case TextureType::none:
         case TextureType::s8x4: return GL_RGBA;
 		default: return GL_NONE;
@@ -182,6 +204,10 @@ int glColorChannels(TextureType t) {
 	case TextureType::s8x1: return GL_RED;
 	case TextureType::s8x2: return GL_RG;
 	case TextureType::s8x3: return GL_RGB;
+	case TextureType::bc5: return GL_RG;
+	case TextureType::bc1:
+	case TextureType::bc3:
+	case TextureType::bc7:
 	case TextureType::none:
 	case TextureType::s8x4: return GL_RGBA;
 	default: return GL_NONE;
@@ -214,6 +240,40 @@ size_t Texture::pixelByteSize(TextureType t) {
     }
 }
 
+bool Texture::isCompressed(TextureType t) {
+    switch (t) {
+        case TextureType::bc1:
+        case TextureType::bc3:
+        case TextureType::bc5:
+        case TextureType::bc7: return true;
+        default: return false;
+    }
+}
+
+bool Texture::isSupported(TextureType t) {
+    switch (t) {
+#if defined(PLATFORM_WINDOWS)
+        case TextureType::bc1:
+        case TextureType::bc3: return GLEW_EXT_texture_compression_s3tc != 0;
+        case TextureType::bc7: return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+#elif defined(__APPLE__)
+        // macOS stops at GL 4.1, which has S3TC but not BPTC
+        case TextureType::bc7: return false;
+#endif
+        default: return true;
+    }
+}
+
+size_t Texture::imageByteSize(TextureType t, int w, int h) {
+    switch (t) {
+        case TextureType::bc1: return size_t((w + 3) / 4) * size_t((h + 3) / 4) * 8;
+        case TextureType::bc3:
+        case TextureType::bc5:
+        case TextureType::bc7: return size_t((w + 3) / 4) * size_t((h + 3) / 4) * 16;
+        default: return size_t(w) * size_t(h) * pixelByteSize(t);
+    }
+}
+
 Texture& Texture::createDepth(int w, int h)
 {
     target = GL_TEXTURE_2D;
@@ -231,6 +291,13 @@ Texture& Texture::createDepth(int w, int h)
     //You can also try GL_DEPTH_COMPONENT16, GL_DEPTH_COMPONENT24 for the internal format.
     //If GL_DEPTH24_STENCIL8_EXT, go ahead and use it (GL_EXT_packed_depth_stencil)
     glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, w, h, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+
+    // the default min filter uses mips, which would leave the texture
+    // incomplete when a later pass samples it
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     unbind();
     return *this;
 }
@@ -260,7 +327,12 @@ Texture& Texture::create(int w, int h, int d, TextureType type_, int filter, int
     glTexParameteri(target, GL_TEXTURE_WRAP_R, wrap);
     glTexParameteri(target, GL_TEXTURE_WRAP_S, wrap);
     glTexParameteri(target, GL_TEXTURE_WRAP_T, wrap);
-    if (target == GL_TEXTURE_2D) 
+    if (isCompressed(type_))
+    {
+        glCompressedTexImage2D(target, 0, glInternalFormat(type_), w, h, 0,
+                               GLsizei(imageByteSize(type_, w, h)), data);
+    }
+    else if (target == GL_TEXTURE_2D) 
 	{
         // NULL means don't load data
 		glTexImage2D(target, 0, glFormat(type_), w, h, 0, format, glType(datatype), NULL);
@@ -277,22 +349,46 @@ Texture& Texture::create(int w, int h, int d, TextureType type_, int filter, int
 
 
 
-Texture& Texture::createCube(int w, int h, TextureType type_, int filter, int wrap, TextureType datatype,
-                                CubeImageDataType cubeType, void* image)
+Texture& Texture::create(const TextureImage & image, int filter, int wrap)
 {
-    target = GL_TEXTURE_CUBE_MAP;
-    width = w;
-    height = h;
+    target = GL_TEXTURE_2D;
+    width = image.width;
+    height = image.height;
     depth = 1;
     depthTexture = false;
-    type = glType(datatype);
-    format = glFormat(type_);
+    type = glType(image.type);
+    format = glInternalFormat(image.type);
     if (!id)
         glGenTextures(1, &id);
     bind();
 
-    void *px, *nx, *py, *ny, *pz, *nz;
-    switch (cubeType) {
+    const int levels = int(image.levels.size());
+    const int minFilter = levels > 1 ? mipmapFilter(filter) : filter;
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, minFilter);
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, wrap);
+    glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, std::max(0, levels - 1));
+    for (int level = 0; level < levels; ++level) {
+        int w = std::max(1, width >> level);
+        int h = std::max(1, height >> level);
+        const std::vector<uint8_t> & data = image.levels[level];
+        if (isCompressed(image.type))
+            glCompressedTexImage2D(target, level, format, w, h, 0, GLsizei(data.size()), data.data());
+        else
+            glTexImage2D(target, level, format, w, h, 0, glColorChannels(image.type), type, data.data());
+    }
+    unbind();
+    return *this;
+}
+
+Texture& Texture::createCube(int w, int h, TextureType type_, int filter, int wrap, TextureType datatype,
+                                CubeImageDataType cubeType, void* image, bool srgb)
+{
+    void *px = nullptr, *nx = nullptr, *py = nullptr, *ny = nullptr, *pz = nullptr, *nz = nullptr;
+    if (image) switch (cubeType) {
         case CubeImageDataType::vstrip: {
             size_t faceStride = pixelByteSize(datatype) * w * h;
             uint8_t* img = (uint8_t*)image;
@@ -305,27 +401,11 @@ Texture& Texture::createCube(int w, int h, TextureType type_, int filter, int wr
             break;
         }
     }
-
-	int internalFormat = glInternalFormat(type_);
-
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, filter);
-    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, filter);
-    glTexParameteri(target, GL_TEXTURE_WRAP_R, wrap);
-    glTexParameteri(target, GL_TEXTURE_WRAP_S, wrap);
-    glTexParameteri(target, GL_TEXTURE_WRAP_T, wrap);
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, internalFormat, w, h, 0, format, type, px);
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, 0, internalFormat, w, h, 0, format, type, nx);
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Y, 0, internalFormat, w, h, 0, format, type, py);
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, 0, internalFormat, w, h, 0, format, type, ny);
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, 0, internalFormat, w, h, 0, format, type, pz);
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, 0, internalFormat, w, h, 0, format, type, nz);
-    unbind();
-    return *this;
+    return createCube(w, h, type_, filter, wrap, datatype, px, nx, py, ny, pz, nz, srgb);
 }
 
     Texture& Texture::createCube(int w, int h, TextureType type_, int filter, int wrap, TextureType datatype,
-                                 void* px, void* nx, void* py, void* ny, void* pz, void* nz)
+                                 void* px, void* nx, void* py, void* ny, void* pz, void* nz, bool srgb)
 	{
         target = GL_TEXTURE_CUBE_MAP;
         width = w;
@@ -339,20 +419,38 @@ Texture& Texture::createCube(int w, int h, TextureType type_, int filter, int wr
         bind();
 
 		int internalFormat = glInternalFormat(type_);
-
+        int pixelFormat = glColorChannels(datatype);
+
+        // Faces already in the texture's type get their mips built on the
+        // CPU; GL builds them for faces it converts.
+        void* faces[6] = { px, nx, py, ny, pz, nz };
+        const bool hasData = px && nx && py && ny && pz && nz;
+        TextureImage images[6];
+        bool cpuMips = hasData && type_ == datatype;
+        for (int i = 0; i < 6 && cpuMips; ++i) {
+            const uint8_t* bytes = static_cast<const uint8_t*>(faces[i]);
+            images[i].type = datatype;
+            images[i].width = w;
+            images[i].height = h;
+            images[i].levels.emplace_back(bytes, bytes + imageByteSize(datatype, w, h));
+            cpuMips = buildMipChain(images[i], srgb, -1);
+        }
+        const bool gpuMips = hasData && !cpuMips && !isCompressed(type_);
+        const int levels = cpuMips ? int(images[0].levels.size()) : 1;
 
         glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
         glTexParameteri(target, GL_TEXTURE_MAG_FILTER, filter);
-        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, cpuMips || gpuMips ? mipmapFilter(filter) : filter);
         glTexParameteri(target, GL_TEXTURE_WRAP_R, wrap);
         glTexParameteri(target, GL_TEXTURE_WRAP_S, wrap);
         glTexParameteri(target, GL_TEXTURE_WRAP_T, wrap);
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, internalFormat, w, h, 0, format, type, px);
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, 0, internalFormat, w, h, 0, format, type, nx);
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Y, 0, internalFormat, w, h, 0, format, type, py);
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, 0, internalFormat, w, h, 0, format, type, ny);
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, 0, internalFormat, w, h, 0, format, type, pz);
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, 0, internalFormat, w, h, 0, format, type, nz);
+        for (int face = 0; face < 6; ++face)
+            for (int level = 0; level < levels; ++level)
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, internalFormat,
+                             std::max(1, w >> level), std::max(1, h >> level), 0, pixelFormat, type,
+                             cpuMips ? images[face].levels[level].data() : faces[face]);
+        if (gpuMips)
+            glGenerateMipmap(target);
         unbind();
         return *this;
     }
@@ -368,6 +466,23 @@ Texture& Texture::update(int xoffset, int yoffset, int width, int height, int fo
     return *this;
 }
 
+Texture& Texture::generateMipmaps(int filter) {
+    bind();
+    glGenerateMipmap(target);
+    glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 1000);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, mipmapFilter(filter));
+    unbind();
+    return *this;
+}
+
+Texture& Texture::setFilter(int filter) {
+    bind();
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, filter);
+    unbind();
+    return *this;
+}
+
 vector<uint8_t> Texture::get()
 {
     bind();
@@ -391,22 +506,31 @@ void Texture::save(const char * path)
 }
 
 
-FileTextureProvider::FileTextureProvider(const string & path) {
+FileTextureProvider::FileTextureProvider(const string & path, bool srgb) {
 
     std::string filename = lab::expandPath(path.c_str());
 
-    int w, h, n;
-    unsigned char* img;
-    stbi_set_unpremultiply_on_load(1);
-    stbi_convert_iphone_png_to_rgb(1);
-    img = stbi_load(filename.c_str(), &w, &h, &n, 4);
+    initImageDecoding();
+    TextureImage image;
+    if (!readTextureImage(filename, image))
+        return;
+    if (!Texture::isSupported(image.type)) {
+        printf("Texture %s: its block compression isn't supported by this GL context\n", filename.c_str());
+        return;
+    }
 
-    if (img != NULL) {
-        _texture = std::make_shared<Texture>();
-        _texture->create(w, h, TextureType::u8x4, GL_LINEAR, GL_CLAMP_TO_EDGE, TextureType::u8x4, img);
+    // a container brings its mips; GL builds those of what can't be
+    // filtered here
+    bool gpuMips = image.levels.size() == 1 && !buildMipChain(image, srgb, -1) &&
+                   !Texture::isCompressed(image.type);
+    _texture = std::make_shared<Texture>();
+    _texture->create(image, GL_LINEAR, GL_CLAMP_TO_EDGE);
+    if (gpuMips)
+        _texture->generateMipmaps(GL_LINEAR);
+}
 
-        stbi_image_free(img);
-    }
+FileTextureProvider::FileTextureProvider(TextureStreamer & streamer, const string & path)
+: _texture(streamer.load(path)) {
 }
 
 
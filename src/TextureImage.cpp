@@ -0,0 +1,883 @@
+//
+//  TextureImage.cpp
+//  LabRender
+//
+//
+
+#include "LabRender/TextureImage.h"
+
+#include "LabRender/Profiler.h"
+#include "LabRender/Texture.h"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LR_MIP_SSE2 1
+#endif
+
+namespace lab {
+
+    namespace {
+
+        uint32_t read32(const uint8_t * p)
+        {
+            return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+        }
+
+        uint64_t read64(const uint8_t * p)
+        {
+            return uint64_t(read32(p)) | uint64_t(read32(p + 4)) << 32;
+        }
+
+        void write32(uint8_t * p, uint32_t v)
+        {
+            for (int i = 0; i < 4; ++i)
+                p[i] = uint8_t(v >> (8 * i));
+        }
+
+        constexpr uint32_t fourCC(char a, char b, char c, char d)
+        {
+            return uint32_t(uint8_t(a)) | uint32_t(uint8_t(b)) << 8 | uint32_t(uint8_t(c)) << 16 | uint32_t(uint8_t(d)) << 24;
+        }
+
+        // DXGI_FORMAT and VkFormat values of the block compressed types;
+        // the sRGB variants read as their linear twins
+        TextureType dxgiFormatToTextureType(uint32_t f)
+        {
+            switch (f) {
+                case 71: case 72: return TextureType::bc1;
+                case 77: case 78: return TextureType::bc3;
+                case 83: return TextureType::bc5;
+                case 98: case 99: return TextureType::bc7;
+                default: return TextureType::none;
+            }
+        }
+
+        uint32_t textureTypeToDxgiFormat(TextureType t)
+        {
+            switch (t) {
+                case TextureType::bc1: return 71;
+                case TextureType::bc3: return 77;
+                case TextureType::bc5: return 83;
+                case TextureType::bc7: return 98;
+                default: return 0;
+            }
+        }
+
+        TextureType vkFormatToTextureType(uint32_t f)
+        {
+            switch (f) {
+                case 37: case 43: return TextureType::u8x4;
+                case 131: case 132: case 133: case 134: return TextureType::bc1;
+                case 137: case 138: return TextureType::bc3;
+                case 141: return TextureType::bc5;
+                case 145: case 146: return TextureType::bc7;
+                default: return TextureType::none;
+            }
+        }
+
+        // the levels of a full mip chain, floor(log2(max(width, height))) + 1
+        uint32_t fullChainLevels(int width, int height)
+        {
+            uint32_t levels = 1;
+            for (int size = std::max(width, height); size > 1; size >>= 1)
+                ++levels;
+            return levels;
+        }
+
+        // levels laid out back to back from an offset, finest first
+        bool readLevels(const std::vector<uint8_t> & file, size_t offset, int count, TextureImage & image)
+        {
+            for (int level = 0; level < count; ++level) {
+                size_t bytes = Texture::imageByteSize(image.type, std::max(1, image.width >> level),
+                                                                  std::max(1, image.height >> level));
+                if (offset > file.size() || bytes > file.size() - offset)
+                    return false;
+                image.levels.emplace_back(file.begin() + offset, file.begin() + offset + bytes);
+                offset += bytes;
+            }
+            return true;
+        }
+
+        bool readDDS(const std::vector<uint8_t> & file, TextureImage & image)
+        {
+            const size_t headerBytes = 4 + 124;
+            if (file.size() < headerBytes)
+                return false;
+
+            const uint8_t * header = file.data() + 4;
+            const uint8_t * pixelFormat = header + 72;
+            const uint32_t caps2 = read32(header + 108);
+            if (!(read32(pixelFormat + 4) & 0x4) || (caps2 & (0x200 | 0x200000)))
+                return false;   // not a block format, or a cube map or a volume
+
+            size_t offset = headerBytes;
+            uint32_t code = read32(pixelFormat + 8);
+            if (code == fourCC('D', 'X', '1', '0')) {
+                if (file.size() < headerBytes + 20)
+                    return false;
+                const uint8_t * dx10 = file.data() + headerBytes;
+                // a single 2d texture
+                if (read32(dx10 + 4) != 3 || (read32(dx10 + 8) & 0x4) || read32(dx10 + 12) > 1)
+                    return false;
+                image.type = dxgiFormatToTextureType(read32(dx10));
+                offset += 20;
+            }
+            else if (code == fourCC('D', 'X', 'T', '1'))
+                image.type = TextureType::bc1;
+            else if (code == fourCC('D', 'X', 'T', '5'))
+                image.type = TextureType::bc3;
+            else if (code == fourCC('A', 'T', 'I', '2') || code == fourCC('B', 'C', '5', 'U'))
+                image.type = TextureType::bc5;
+
+            image.height = int(read32(header + 8));
+            image.width = int(read32(header + 12));
+            if (image.type == TextureType::none || image.width <= 0 || image.height <= 0)
+                return false;
+            uint32_t levels = std::max(1u, read32(header + 24));
+            if (levels > fullChainLevels(image.width, image.height))
+                return false;
+            return readLevels(file, offset, int(levels), image);
+        }
+
+        bool readKTX2(const std::vector<uint8_t> & file, TextureImage & image)
+        {
+            const size_t headerBytes = 80;
+            if (file.size() < headerBytes)
+                return false;
+
+            const uint8_t * header = file.data();
+            image.type = vkFormatToTextureType(read32(header + 12));
+            image.width = int(read32(header + 20));
+            image.height = int(read32(header + 24));
+            // a single 2d texture, without supercompression
+            if (image.type == TextureType::none || image.width <= 0 || image.height <= 0 ||
+                read32(header + 28) > 1 || read32(header + 32) > 1 || read32(header + 36) != 1 || read32(header + 44) != 0)
+                return false;
+
+            uint32_t levels = std::max(1u, read32(header + 40));
+            if (levels > fullChainLevels(image.width, image.height) || file.size() < headerBytes + size_t(levels) * 24)
+                return false;
+
+            // the level index is finest first, though the data is stored coarsest first
+            for (int level = 0; level < int(levels); ++level) {
+                const uint8_t * index = header + headerBytes + level * 24;
+                uint64_t offset = read64(index);
+                uint64_t length = read64(index + 8);
+                size_t bytes = Texture::imageByteSize(image.type, std::max(1, image.width >> level),
+                                                                  std::max(1, image.height >> level));
+                if (length < bytes || offset > file.size() || bytes > file.size() - offset)
+                    return false;
+                image.levels.emplace_back(file.begin() + size_t(offset), file.begin() + size_t(offset) + bytes);
+            }
+            return true;
+        }
+
+        // a level being filtered from the one above it
+        struct MipLevel
+        {
+            const uint8_t * src;
+            int srcWidth, srcHeight;
+            uint8_t * dst;
+            int width, height;
+            int channels;
+        };
+
+        // The filters are a 2x2 box; an odd edge repeats its last texel.
+
+        void filterU8(const MipLevel & l, int rowBegin, int rowEnd)
+        {
+            const int n = l.channels;
+            for (int y = rowBegin; y < rowEnd; ++y) {
+                const uint8_t * r0 = l.src + size_t(std::min(2 * y, l.srcHeight - 1)) * size_t(l.srcWidth) * n;
+                const uint8_t * r1 = l.src + size_t(std::min(2 * y + 1, l.srcHeight - 1)) * size_t(l.srcWidth) * n;
+                uint8_t * out = l.dst + size_t(y) * size_t(l.width) * n;
+                int x = 0;
+#ifdef LR_MIP_SSE2
+                // two texels at a time from four whole ones of each row,
+                // summed in 16 bits and rounded as below
+                if (n == 4) {
+                    const __m128i zero = _mm_setzero_si128();
+                    const __m128i two = _mm_set1_epi16(2);
+                    for (; 2 * x + 3 < l.srcWidth && x + 1 < l.width; x += 2) {
+                        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r0 + x * 8));
+                        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r1 + x * 8));
+                        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+                        __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+                        lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+                        hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+                        __m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+                        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + x * 4), _mm_packus_epi16(sum, zero));
+                    }
+                }
+#endif
+                for (; x < l.width; ++x) {
+                    const int x0 = std::min(2 * x, l.srcWidth - 1) * n;
+                    const int x1 = std::min(2 * x + 1, l.srcWidth - 1) * n;
+                    for (int c = 0; c < n; ++c)
+                        out[x * n + c] = uint8_t((r0[x0 + c] + r0[x1 + c] + r1[x0 + c] + r1[x1 + c] + 2) >> 2);
+                }
+            }
+        }
+
+        struct SRGBTables
+        {
+            float toLinear[256];
+            float rounding[255];    // the linear value at which encoding rounds up past each code
+            uint8_t guess[4096];    // a code near the encoding of each span of linear values
+#ifdef LR_MIP_SSE2
+            float above[256];       // rounding, past each code, and below it
+            float below[256];
+#endif
+
+            SRGBTables()
+            {
+                for (int i = 0; i < 256; ++i)
+                    toLinear[i] = decode(i / 255.f);
+                for (int i = 0; i < 255; ++i)
+                    rounding[i] = decode((i + 0.5f) / 255.f);
+                for (int i = 0; i < 4096; ++i)
+                    guess[i] = uint8_t(std::upper_bound(rounding, rounding + 255, i / 4095.f) - rounding);
+#ifdef LR_MIP_SSE2
+                for (int i = 0; i < 256; ++i) {
+                    above[i] = i < 255 ? rounding[i] : FLT_MAX;
+                    below[i] = i > 0 ? rounding[i - 1] : -FLT_MAX;
+                }
+#endif
+            }
+
+            static float decode(float v)
+            {
+                return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+            }
+
+            // the code that rounds to v, as std::upper_bound on rounding would
+            // find it; a span holds few codes, even in the dark
+            uint8_t encode(float v) const
+            {
+                v = std::min(1.f, std::max(0.f, v));
+                int code = guess[int(v * 4095.f)];
+                while (code < 255 && v >= rounding[code])
+                    ++code;
+                while (code > 0 && v < rounding[code - 1])
+                    --code;
+                return uint8_t(code);
+            }
+
+#ifdef LR_MIP_SSE2
+            // a u8x4 texel, its color in linear light and its alpha as is
+            __m128 load(const uint8_t * p) const
+            {
+                return _mm_setr_ps(toLinear[p[0]], toLinear[p[1]], toLinear[p[2]], float(p[3]));
+            }
+
+            // encodes the color of a loaded texel, and rounds its alpha.
+            // Every float from 0 to 1 is at most a code from its guess, so
+            // one step either way gives what encode does
+            void store(__m128 v, uint8_t * p) const
+            {
+                const __m128 color = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.f));
+                alignas(16) int32_t span[4];
+                _mm_store_si128(reinterpret_cast<__m128i *>(span), _mm_cvttps_epi32(_mm_mul_ps(color, _mm_set1_ps(4095.f))));
+                const int c0 = guess[span[0]], c1 = guess[span[1]], c2 = guess[span[2]];
+
+                const __m128 up = _mm_cmpge_ps(color, _mm_setr_ps(above[c0], above[c1], above[c2], FLT_MAX));
+                const __m128 down = _mm_cmplt_ps(color, _mm_setr_ps(below[c0], below[c1], below[c2], -FLT_MAX));
+                __m128i code = _mm_setr_epi32(c0, c1, c2, 0);
+                code = _mm_add_epi32(_mm_sub_epi32(code, _mm_castps_si128(up)), _mm_castps_si128(down));
+
+                // alpha, the sum of four bytes over four, rounds up at a half
+                const __m128i alpha = _mm_cvttps_epi32(_mm_add_ps(v, _mm_set1_ps(0.5f)));
+                const __m128i lane3 = _mm_setr_epi32(0, 0, 0, -1);
+                code = _mm_or_si128(_mm_andnot_si128(lane3, code), _mm_and_si128(lane3, alpha));
+
+                code = _mm_packs_epi32(code, code);
+                const int32_t bytes = _mm_cvtsi128_si32(_mm_packus_epi16(code, code));
+                memcpy(p, &bytes, 4);
+            }
+#endif
+        };
+
+        const SRGBTables & srgbTables()
+        {
+            static const SRGBTables tables;
+            return tables;
+        }
+
+        // color averaged in linear light, and any alpha as is
+        void filterSRGB(const MipLevel & l, int rowBegin, int rowEnd)
+        {
+            const SRGBTables & srgb = srgbTables();
+            const int n = l.channels;
+            for (int y = rowBegin; y < rowEnd; ++y) {
+                const uint8_t * r0 = l.src + size_t(std::min(2 * y, l.srcHeight - 1)) * size_t(l.srcWidth) * n;
+                const uint8_t * r1 = l.src + size_t(std::min(2 * y + 1, l.srcHeight - 1)) * size_t(l.srcWidth) * n;
+                uint8_t * out = l.dst + size_t(y) * size_t(l.width) * n;
+                for (int x = 0; x < l.width; ++x) {
+                    const int x0 = std::min(2 * x, l.srcWidth - 1) * n;
+                    const int x1 = std::min(2 * x + 1, l.srcWidth - 1) * n;
+#ifdef LR_MIP_SSE2
+                    // a texel at a time, summed in the same order as below
+                    if (n == 4) {
+                        __m128 top = _mm_add_ps(srgb.load(r0 + x0), srgb.load(r0 + x1));
+                        __m128 bottom = _mm_add_ps(srgb.load(r1 + x0), srgb.load(r1 + x1));
+                        srgb.store(_mm_mul_ps(_mm_add_ps(top, bottom), _mm_set1_ps(0.25f)), out + x * 4);
+                        continue;
+                    }
+#endif
+                    for (int c = 0; c < 3; ++c)
+                        out[x * n + c] = srgb.encode(((srgb.toLinear[r0[x0 + c]] + srgb.toLinear[r0[x1 + c]]) +
+                                                      (srgb.toLinear[r1[x0 + c]] + srgb.toLinear[r1[x1 + c]])) * 0.25f);
+                    for (int c = 3; c < n; ++c)
+                        out[x * n + c] = uint8_t((r0[x0 + c] + r0[x1 + c] + r1[x0 + c] + r1[x1 + c] + 2) >> 2);
+                }
+            }
+        }
+
+        void filterF32(const MipLevel & l, int rowBegin, int rowEnd)
+        {
+            const int n = l.channels;
+            const float * src = reinterpret_cast<const float *>(l.src);
+            for (int y = rowBegin; y < rowEnd; ++y) {
+                const float * r0 = src + size_t(std::min(2 * y, l.srcHeight - 1)) * size_t(l.srcWidth) * n;
+                const float * r1 = src + size_t(std::min(2 * y + 1, l.srcHeight - 1)) * size_t(l.srcWidth) * n;
+                float * out = reinterpret_cast<float *>(l.dst) + size_t(y) * size_t(l.width) * n;
+                for (int x = 0; x < l.width; ++x) {
+                    const int x0 = std::min(2 * x, l.srcWidth - 1) * n;
+                    const int x1 = std::min(2 * x + 1, l.srcWidth - 1) * n;
+#ifdef LR_MIP_SSE2
+                    // a texel at a time, summed in the same order as below
+                    if (n == 4) {
+                        __m128 top = _mm_add_ps(_mm_loadu_ps(r0 + x0), _mm_loadu_ps(r0 + x1));
+                        __m128 bottom = _mm_add_ps(_mm_loadu_ps(r1 + x0), _mm_loadu_ps(r1 + x1));
+                        _mm_storeu_ps(out + x * 4, _mm_mul_ps(_mm_add_ps(top, bottom), _mm_set1_ps(0.25f)));
+                        continue;
+                    }
+#endif
+                    for (int c = 0; c < n; ++c)
+                        out[x * n + c] = ((r0[x0 + c] + r0[x1 + c]) + (r1[x0 + c] + r1[x1 + c])) * 0.25f;
+                }
+            }
+        }
+
+        float halfToFloat(uint16_t h)
+        {
+            const uint32_t sign = uint32_t(h & 0x8000) << 16;
+            const int exponent = (h >> 10) & 0x1f;
+            const uint32_t mantissa = h & 0x3ff;
+            if (!exponent) {
+                // zero, or subnormal
+                float f = std::ldexp(float(mantissa), -24);
+                return sign ? -f : f;
+            }
+            uint32_t bits = exponent == 0x1f ? sign | 0x7f800000 | mantissa << 13
+                                             : sign | uint32_t(exponent + 112) << 23 | mantissa << 13;
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            return f;
+        }
+
+        // rounded to the nearest, ties to even
+        uint16_t floatToHalf(float f)
+        {
+            uint32_t bits;
+            memcpy(&bits, &f, sizeof(bits));
+            const uint16_t sign = uint16_t((bits >> 16) & 0x8000);
+            const uint32_t magnitude = bits & 0x7fffffff;
+            if (magnitude >= 0x7f800000)
+                return uint16_t(sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0));
+            if (magnitude >= 0x477ff000)
+                return uint16_t(sign | 0x7c00);     // past the largest half
+            if (magnitude < 0x38800000) {
+                float m;
+                memcpy(&m, &magnitude, sizeof(m));
+                return uint16_t(sign | uint16_t(std::nearbyint(m * 16777216.f)));
+            }
+            return uint16_t(sign | ((magnitude + 0xfff + ((magnitude >> 13) & 1) - 0x38000000) >> 13));
+        }
+
+        void filterF16(const MipLevel & l, int rowBegin, int rowEnd)
+        {
+            const int n = l.channels;
+            const uint16_t * src = reinterpret_cast<const uint16_t *>(l.src);
+            for (int y = rowBegin; y < rowEnd; ++y) {
+                const uint16_t * r0 = src + size_t(std::min(2 * y, l.srcHeight - 1)) * size_t(l.srcWidth) * n;
+                const uint16_t * r1 = src + size_t(std::min(2 * y + 1, l.srcHeight - 1)) * size_t(l.srcWidth) * n;
+                uint16_t * out = reinterpret_cast<uint16_t *>(l.dst) + size_t(y) * size_t(l.width) * n;
+                for (int x = 0; x < l.width; ++x) {
+                    const int x0 = std::min(2 * x, l.srcWidth - 1) * n;
+                    const int x1 = std::min(2 * x + 1, l.srcWidth - 1) * n;
+                    for (int c = 0; c < n; ++c)
+                        out[x * n + c] = floatToHalf(((halfToFloat(r0[x0 + c]) + halfToFloat(r0[x1 + c])) +
+                                                      (halfToFloat(r1[x0 + c]) + halfToFloat(r1[x1 + c]))) * 0.25f);
+                }
+            }
+        }
+
+        // Rows split into bands across threads, the calling one among them;
+        // a band too small isn't worth a thread.
+        template <typename F>
+        void forBands(int rows, int threads, const F & f)
+        {
+            const int minRows = 64;
+            const int bands = std::max(1, std::min(threads, rows / minRows));
+            std::vector<std::thread> workers;
+            for (int i = 1; i < bands; ++i)
+                workers.emplace_back([&f, rows, bands, i]() { f(rows * i / bands, rows * (i + 1) / bands); });
+            f(0, rows / bands);
+            for (auto & t : workers)
+                t.join();
+        }
+
+        // the 4x4 block at a block position; a level smaller than a block
+        // repeats its edges
+        void fetchBlock(const uint8_t * rgba, int w, int h, int bx, int by, uint8_t block[16][4])
+        {
+            for (int y = 0; y < 4; ++y)
+                for (int x = 0; x < 4; ++x) {
+                    size_t texel = size_t(std::min(by * 4 + y, h - 1)) * size_t(w) + size_t(std::min(bx * 4 + x, w - 1));
+                    memcpy(block[y * 4 + x], rgba + texel * 4, 4);
+                }
+        }
+
+        // The ends of the span of the texels in the mask along their
+        // principal axis, in the first n channels.
+        void fitLine(const uint8_t block[16][4], int n, uint16_t mask, float lo[4], float hi[4])
+        {
+            float mean[4] = {};
+            int count = 0;
+            for (int i = 0; i < 16; ++i)
+                if (mask & (1 << i)) {
+                    for (int c = 0; c < n; ++c)
+                        mean[c] += block[i][c];
+                    ++count;
+                }
+            for (int c = 0; c < 4; ++c)
+                lo[c] = hi[c] = 0;
+            if (!count)
+                return;
+            for (int c = 0; c < n; ++c)
+                mean[c] /= float(count);
+
+            float cov[4][4] = {};
+            for (int i = 0; i < 16; ++i)
+                if (mask & (1 << i))
+                    for (int a = 0; a < n; ++a)
+                        for (int b = 0; b < n; ++b)
+                            cov[a][b] += (block[i][a] - mean[a]) * (block[i][b] - mean[b]);
+
+            // power iteration, from the channel of the widest spread
+            float axis[4] = {};
+            int widest = 0;
+            for (int c = 1; c < n; ++c)
+                if (cov[c][c] > cov[widest][widest])
+                    widest = c;
+            axis[widest] = 1;
+            for (int iteration = 0; iteration < 8; ++iteration) {
+                float next[4] = {};
+                float scale = 0;
+                for (int a = 0; a < n; ++a) {
+                    for (int b = 0; b < n; ++b)
+                        next[a] += cov[a][b] * axis[b];
+                    scale = std::max(scale, std::abs(next[a]));
+                }
+                if (scale <= 0)
+                    break;
+                for (int c = 0; c < n; ++c)
+                    axis[c] = next[c] / scale;
+            }
+
+            float tMin = FLT_MAX, tMax = -FLT_MAX;
+            for (int i = 0; i < 16; ++i)
+                if (mask & (1 << i)) {
+                    float t = 0;
+                    for (int c = 0; c < n; ++c)
+                        t += (block[i][c] - mean[c]) * axis[c];
+                    tMin = std::min(tMin, t);
+                    tMax = std::max(tMax, t);
+                }
+            float length = 0;
+            for (int c = 0; c < n; ++c)
+                length += axis[c] * axis[c];
+            for (int c = 0; c < n; ++c) {
+                float a = length > 0 ? axis[c] / length : 0;
+                lo[c] = std::min(255.f, std::max(0.f, mean[c] + a * tMin));
+                hi[c] = std::min(255.f, std::max(0.f, mean[c] + a * tMax));
+            }
+        }
+
+        int distance(const uint8_t * texel, const int * color, int n)
+        {
+            int d = 0;
+            for (int c = 0; c < n; ++c)
+                d += (texel[c] - color[c]) * (texel[c] - color[c]);
+            return d;
+        }
+
+        uint16_t pack565(const float c[4])
+        {
+            int r = std::min(31, int(c[0] * 31.f / 255.f + 0.5f));
+            int g = std::min(63, int(c[1] * 63.f / 255.f + 0.5f));
+            int b = std::min(31, int(c[2] * 31.f / 255.f + 0.5f));
+            return uint16_t(r << 11 | g << 5 | b);
+        }
+
+        void unpack565(uint16_t v, int c[3])
+        {
+            int r = v >> 11, g = (v >> 5) & 63, b = v & 31;
+            c[0] = r << 3 | r >> 2;
+            c[1] = g << 2 | g >> 4;
+            c[2] = b << 3 | b >> 2;
+        }
+
+        // A BC1 color block. With a cut out, texels of alpha under a half
+        // are transparent, in the three color mode.
+        void encodeColor(const uint8_t block[16][4], bool cutout, uint8_t out[8])
+        {
+            uint16_t mask = 0;
+            bool transparent = false;
+            for (int i = 0; i < 16; ++i) {
+                if (cutout && block[i][3] < 128)
+                    transparent = true;
+                else
+                    mask |= uint16_t(1 << i);
+            }
+
+            float lo[4], hi[4];
+            fitLine(block, 3, mask, lo, hi);
+            uint16_t c0 = pack565(hi);
+            uint16_t c1 = pack565(lo);
+            // the order of the endpoints picks the mode
+            if (transparent ? c0 > c1 : c0 < c1)
+                std::swap(c0, c1);
+
+            int palette[4][3];
+            unpack565(c0, palette[0]);
+            unpack565(c1, palette[1]);
+            int colors = 4;
+            if (transparent) {
+                for (int c = 0; c < 3; ++c)
+                    palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+                colors = 3;
+            }
+            else if (c0 == c1)
+                colors = 1;
+            else
+                for (int c = 0; c < 3; ++c) {
+                    palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                    palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+                }
+
+            uint32_t indices = 0;
+            for (int i = 0; i < 16; ++i) {
+                int best = 3;
+                if (mask & (1 << i)) {
+                    best = 0;
+                    int bestDistance = distance(block[i], palette[0], 3);
+                    for (int j = 1; j < colors; ++j) {
+                        int d = distance(block[i], palette[j], 3);
+                        if (d < bestDistance) {
+                            best = j;
+                            bestDistance = d;
+                        }
+                    }
+                }
+                indices |= uint32_t(best) << (2 * i);
+            }
+
+            out[0] = uint8_t(c0);
+            out[1] = uint8_t(c0 >> 8);
+            out[2] = uint8_t(c1);
+            out[3] = uint8_t(c1 >> 8);
+            write32(out + 4, indices);
+        }
+
+        // a BC4 block of one channel, in the eight value mode
+        void encodeChannel(const uint8_t block[16][4], int channel, uint8_t out[8])
+        {
+            int lo = 255, hi = 0;
+            for (int i = 0; i < 16; ++i) {
+                lo = std::min(lo, int(block[i][channel]));
+                hi = std::max(hi, int(block[i][channel]));
+            }
+
+            int palette[8] = { hi, lo };
+            for (int j = 2; j < 8; ++j)
+                palette[j] = ((8 - j) * hi + (j - 1) * lo + 3) / 7;
+
+            uint64_t indices = 0;
+            for (int i = 0; i < 16; ++i) {
+                int best = 0;
+                int bestDistance = std::abs(block[i][channel] - palette[0]);
+                for (int j = 1; j < 8 && hi != lo; ++j) {
+                    int d = std::abs(block[i][channel] - palette[j]);
+                    if (d < bestDistance) {
+                        best = j;
+                        bestDistance = d;
+                    }
+                }
+                indices |= uint64_t(best) << (3 * i);
+            }
+
+            out[0] = uint8_t(hi);
+            out[1] = uint8_t(lo);
+            for (int k = 0; k < 6; ++k)
+                out[2 + k] = uint8_t(indices >> (8 * k));
+        }
+
+        struct BitWriter
+        {
+            uint8_t * out;
+            int position = 0;
+
+            // least significant bit first
+            void put(uint32_t v, int bits)
+            {
+                for (int i = 0; i < bits; ++i, ++position)
+                    if ((v >> i) & 1)
+                        out[position >> 3] |= uint8_t(1 << (position & 7));
+            }
+        };
+
+        // A BC7 block in mode 6: one subset of RGBA, with 7 bit endpoints,
+        // a shared low bit for each, and 4 bit indices.
+        void encodeBC7(const uint8_t block[16][4], uint8_t out[16])
+        {
+            float ends[2][4];
+            fitLine(block, 4, 0xffff, ends[0], ends[1]);
+
+            int endpoint[2][4];
+            int lowBit[2];
+            for (int k = 0; k < 2; ++k) {
+                // the low bit that the endpoint rounds closest with
+                float bestError = FLT_MAX;
+                for (int bit = 0; bit < 2; ++bit) {
+                    int q[4];
+                    float error = 0;
+                    for (int c = 0; c < 4; ++c) {
+                        q[c] = std::min(127, std::max(0, int((ends[k][c] - bit) * 0.5f + 0.5f)));
+                        float d = float(q[c] << 1 | bit) - ends[k][c];
+                        error += d * d;
+                    }
+                    if (error < bestError) {
+                        bestError = error;
+                        lowBit[k] = bit;
+                        memcpy(endpoint[k], q, sizeof(q));
+                    }
+                }
+            }
+
+            static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+            int palette[16][4];
+            for (int j = 0; j < 16; ++j)
+                for (int c = 0; c < 4; ++c) {
+                    int a = endpoint[0][c] << 1 | lowBit[0];
+                    int b = endpoint[1][c] << 1 | lowBit[1];
+                    palette[j][c] = ((64 - weights[j]) * a + weights[j] * b + 32) >> 6;
+                }
+
+            int index[16];
+            for (int i = 0; i < 16; ++i) {
+                index[i] = 0;
+                int bestDistance = distance(block[i], palette[0], 4);
+                for (int j = 1; j < 16; ++j) {
+                    int d = distance(block[i], palette[j], 4);
+                    if (d < bestDistance) {
+                        index[i] = j;
+                        bestDistance = d;
+                    }
+                }
+            }
+
+            // the first index has an implied high bit of zero
+            if (index[0] & 8) {
+                for (int c = 0; c < 4; ++c)
+                    std::swap(endpoint[0][c], endpoint[1][c]);
+                std::swap(lowBit[0], lowBit[1]);
+                for (int i = 0; i < 16; ++i)
+                    index[i] = 15 - index[i];
+            }
+
+            memset(out, 0, 16);
+            BitWriter bits = { out };
+            bits.put(1 << 6, 7);
+            for (int c = 0; c < 4; ++c)
+                for (int k = 0; k < 2; ++k)
+                    bits.put(uint32_t(endpoint[k][c]), 7);
+            bits.put(uint32_t(lowBit[0]), 1);
+            bits.put(uint32_t(lowBit[1]), 1);
+            bits.put(uint32_t(index[0]), 3);
+            for (int i = 1; i < 16; ++i)
+                bits.put(uint32_t(index[i]), 4);
+        }
+
+    } // anon
+
+    void initImageDecoding()
+    {
+        static std::once_flag once;
+        std::call_once(once, []() {
+            stbi_set_unpremultiply_on_load(1);
+            stbi_convert_iphone_png_to_rgb(1);
+        });
+    }
+
+    bool readTextureImage(const std::string & path, TextureImage & image)
+    {
+        LR_PROFILE_ZONE("readTextureImage");
+        image = TextureImage();
+
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            return false;
+        std::vector<uint8_t> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+        static const uint8_t ktx2Identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+        bool read;
+        if (file.size() >= 4 && !memcmp(file.data(), "DDS ", 4))
+            read = readDDS(file, image);
+        else if (file.size() >= sizeof(ktx2Identifier) && !memcmp(file.data(), ktx2Identifier, sizeof(ktx2Identifier)))
+            read = readKTX2(file, image);
+        else {
+            int w, h, n;
+            unsigned char * img = stbi_load_from_memory(file.data(), int(file.size()), &w, &h, &n, 4);
+            read = img != nullptr;
+            if (read) {
+                image.type = TextureType::u8x4;
+                image.width = w;
+                image.height = h;
+                image.levels.emplace_back(img, img + size_t(w) * size_t(h) * 4);
+                stbi_image_free(img);
+            }
+        }
+        if (!read)
+            image = TextureImage();
+        return read;
+    }
+
+    bool writeDDS(const std::string & path, const TextureImage & image)
+    {
+        const uint32_t dxgiFormat = textureTypeToDxgiFormat(image.type);
+        if (!dxgiFormat || image.levels.empty())
+            return false;
+
+        const uint32_t levels = uint32_t(image.levels.size());
+        uint8_t header[4 + 124 + 20] = {};
+        write32(header, fourCC('D', 'D', 'S', ' '));
+        uint8_t * dds = header + 4;
+        write32(dds, 124);
+        write32(dds + 4, 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000);    // caps, size, pixel format, mips, linear size
+        write32(dds + 8, uint32_t(image.height));
+        write32(dds + 12, uint32_t(image.width));
+        write32(dds + 16, uint32_t(image.levels[0].size()));
+        write32(dds + 24, levels);
+        write32(dds + 72, 32);
+        write32(dds + 76, 0x4);                 // four cc
+        write32(dds + 80, fourCC('D', 'X', '1', '0'));
+        write32(dds + 104, 0x1000 | (levels > 1 ? 0x400000 | 0x8 : 0));    // texture, mipmap, complex
+        uint8_t * dx10 = dds + 124;
+        write32(dx10, dxgiFormat);
+        write32(dx10 + 4, 3);                   // 2d
+        write32(dx10 + 12, 1);                  // array size
+
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<const char *>(header), sizeof(header));
+        for (auto & level : image.levels)
+            out.write(reinterpret_cast<const char *>(level.data()), std::streamsize(level.size()));
+        return bool(out);
+    }
+
+    bool buildMipChain(TextureImage & image, bool srgb, int threads)
+    {
+        LR_PROFILE_ZONE("buildMipChain");
+        void (*filter)(const MipLevel &, int, int) = nullptr;
+        int channels = 0;
+        switch (image.type) {
+            case TextureType::u8x1: case TextureType::u8x2: case TextureType::u8x3: case TextureType::u8x4:
+                channels = int(Texture::pixelByteSize(image.type));
+                filter = srgb && channels >= 3 ? filterSRGB : filterU8;
+                break;
+            case TextureType::f16x1: case TextureType::f16x2: case TextureType::f16x3: case TextureType::f16x4:
+                channels = int(Texture::pixelByteSize(image.type)) / 2;
+                filter = filterF16;
+                break;
+            case TextureType::f32x1: case TextureType::f32x2: case TextureType::f32x3: case TextureType::f32x4:
+                channels = int(Texture::pixelByteSize(image.type)) / 4;
+                filter = filterF32;
+                break;
+            default:
+                return false;
+        }
+        if (image.levels.empty())
+            return false;
+        if (threads < 0)
+            threads = std::max(1, int(std::thread::hardware_concurrency()));
+
+        image.levels.resize(1);
+        int w = image.width;
+        int h = image.height;
+        while (w > 1 || h > 1) {
+            MipLevel l = { image.levels.back().data(), w, h, nullptr, std::max(1, w / 2), std::max(1, h / 2), channels };
+            std::vector<uint8_t> level(Texture::imageByteSize(image.type, l.width, l.height));
+            l.dst = level.data();
+            forBands(l.height, threads, [&l, filter](int begin, int end) { filter(l, begin, end); });
+            image.levels.push_back(std::move(level));
+            w = l.width;
+            h = l.height;
+        }
+        return true;
+    }
+
+    TextureImage compressTextureImage(const TextureImage & image, TextureType type)
+    {
+        LR_PROFILE_ZONE("compressTextureImage");
+        TextureImage result;
+        if (image.type != TextureType::u8x4 || !Texture::isCompressed(type))
+            return result;
+
+        result.type = type;
+        result.width = image.width;
+        result.height = image.height;
+        for (size_t level = 0; level < image.levels.size(); ++level) {
+            const int w = std::max(1, image.width >> level);
+            const int h = std::max(1, image.height >> level);
+            const int blockBytes = type == TextureType::bc1 ? 8 : 16;
+            std::vector<uint8_t> encoded(Texture::imageByteSize(type, w, h));
+            uint8_t * dst = encoded.data();
+            uint8_t block[16][4];
+            for (int by = 0; by < (h + 3) / 4; ++by)
+                for (int bx = 0; bx < (w + 3) / 4; ++bx, dst += blockBytes) {
+                    fetchBlock(image.levels[level].data(), w, h, bx, by, block);
+                    switch (type) {
+                        case TextureType::bc1:
+                            encodeColor(block, true, dst);
+                            break;
+                        case TextureType::bc3:
+                            encodeChannel(block, 3, dst);
+                            encodeColor(block, false, dst + 8);
+                            break;
+                        case TextureType::bc5:
+                            encodeChannel(block, 0, dst);
+                            encodeChannel(block, 1, dst + 8);
+                            break;
+                        default:
+                            encodeBC7(block, dst);
+                            break;
+                    }
+                }
+            result.levels.push_back(std::move(encoded));
+        }
+        return result;
+    }
+
+} // lab
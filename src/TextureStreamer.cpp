@@ -0,0 +1,371 @@
+//
+//  TextureStreamer.cpp
+//  LabRender
+//
+//
+
+#include "LabRender/TextureStreamer.h"
+
+#include "LabRender/Profiler.h"
+#include "LabRender/Texture.h"
+#include "LabRender/Utils.h"
+#include "LabRender/gl4.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace lab {
+
+    TextureStreamer::TextureStreamer(int workers)
+    {
+        // stb_image's options are global, and are read by the workers
+        initImageDecoding();
+
+        if (workers < 0)
+            workers = std::max(1, int(std::thread::hardware_concurrency()) - 1);
+        for (int i = 0; i < workers; ++i)
+            _threads.emplace_back([this]() { work(); });
+    }
+
+    TextureStreamer::~TextureStreamer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _quit = true;
+        }
+        _wake.notify_all();
+        for (auto & t : _threads)
+            t.join();
+        if (_pbo)
+            glDeleteBuffers(1, &_pbo);
+    }
+
+    void TextureStreamer::setSettings(const Settings & settings)
+    {
+        _settings = settings;
+    }
+
+    int64_t TextureStreamer::levelBytes(const Entry & e, int level) const
+    {
+        return int64_t(Texture::imageByteSize(e.type, e.sizes[level].x, e.sizes[level].y));
+    }
+
+    void TextureStreamer::decode(Decode & d)
+    {
+        LR_PROFILE_ZONE("TextureStreamer::decode");
+        if (readTextureImage(d.path, d.image) && d.image.levels.size() == 1)
+            buildMipChain(d.image, d.srgb);
+    }
+
+    void TextureStreamer::work()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;) {
+            _wake.wait(lock, [this]() { return _quit || !_queue.empty(); });
+            if (_quit)
+                return;
+
+            Decode d = std::move(_queue.front());
+            _queue.pop_front();
+            lock.unlock();
+            decode(d);
+            lock.lock();
+            _decoded.push_back(std::move(d));
+        }
+    }
+
+    std::shared_ptr<Texture> TextureStreamer::load(const std::string & path)
+    {
+        LR_PROFILE_ZONE("TextureStreamer::load");
+
+        // sampling it before it's decoded reads a single black texel
+        const uint8_t placeholder[4] = { 0, 0, 0, 255 };
+        auto texture = std::make_shared<Texture>();
+        texture->target = GL_TEXTURE_2D;
+        texture->width = 1;
+        texture->height = 1;
+        texture->format = GL_RGBA8;
+        texture->type = GL_UNSIGNED_BYTE;
+        glGenTextures(1, &texture->id);
+        texture->bind();
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+        texture->unbind();
+
+        // an entry left by a dropped texture at the same address isn't
+        // pruned until the next update
+        Entry & e = _entries[texture.get()];
+        for (int level = e.resident; level < int(e.mips.size()); ++level)
+            _residentBytes -= levelBytes(e, level);
+        e = Entry();
+        e.texture = texture;
+        e.serial = ++_serial;
+        e.lastUsed = _frame;
+
+        Decode d;
+        d.key = texture.get();
+        d.serial = e.serial;
+        d.path = expandPath(path.c_str());
+        d.srgb = _settings.srgb;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _queue.push_back(std::move(d));
+            ++_decoding;
+        }
+        _wake.notify_one();
+        return texture;
+    }
+
+    void TextureStreamer::finish(Decode & d)
+    {
+        auto i = _entries.find(d.key);
+        if (i == _entries.end() || i->second.serial != d.serial)
+            return;
+
+        // a file that couldn't be read keeps the placeholder, unstreamed
+        if (d.image.levels.empty()) {
+            _entries.erase(i);
+            return;
+        }
+        if (!Texture::isSupported(d.image.type)) {
+            printf("Texture %s: its block compression isn't supported by this GL context\n", d.path.c_str());
+            _entries.erase(i);
+            return;
+        }
+
+        Entry & e = i->second;
+        std::shared_ptr<Texture> texture = e.texture.lock();
+        if (!texture)
+            return;
+
+        e.type = d.image.type;
+        e.mips = std::move(d.image.levels);
+        const int levels = int(e.mips.size());
+        e.sizes.clear();
+        for (int level = 0; level < levels; ++level)
+            e.sizes.push_back(v2i{ std::max(1, d.image.width >> level), std::max(1, d.image.height >> level) });
+        e.floor = levels - 1;
+        while (e.floor > 0 && std::max(e.sizes[e.floor - 1].x, e.sizes[e.floor - 1].y) <= _settings.residentSize)
+            --e.floor;
+
+        // the placeholder goes with the first level uploaded over it
+        texture->width = e.sizes[0].x;
+        texture->height = e.sizes[0].y;
+        texture->format = glInternalFormat(e.type);
+        texture->bind();
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        texture->unbind();
+
+        e.resident = levels;
+        e.wanted = levels;
+        for (int level = levels - 1; level >= e.floor; --level)
+            upload(e, level);
+    }
+
+    void TextureStreamer::upload(Entry & e, int level)
+    {
+        std::shared_ptr<Texture> texture = e.texture.lock();
+        if (!texture)
+            return;
+
+        // Staged in a buffer orphaned for each upload, so that the copy
+        // returns at once; the pointer is the fallback if it can't be mapped
+        const GLsizeiptr bytes = GLsizeiptr(levelBytes(e, level));
+        const void * pixels = e.mips[level].data();
+        if (!_pbo)
+            glGenBuffers(1, &_pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+        void * staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                          GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (staging) {
+            memcpy(staging, pixels, size_t(bytes));
+            pixels = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) ? nullptr : pixels;
+        }
+        if (pixels)
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        // the finer level first, then the bound that admits it
+        texture->bind();
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        if (Texture::isCompressed(e.type))
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, glInternalFormat(e.type), e.sizes[level].x, e.sizes[level].y, 0,
+                                   GLsizei(bytes), pixels);
+        else
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, e.sizes[level].x, e.sizes[level].y, 0,
+                         GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+        texture->unbind();
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        e.resident = level;
+        _residentBytes += levelBytes(e, level);
+    }
+
+    void TextureStreamer::evict(Entry & e)
+    {
+        std::shared_ptr<Texture> texture = e.texture.lock();
+        int level = e.resident;
+        if (!texture || level >= e.floor)
+            return;
+
+        // the bound moves past the level first, then a zero sized image
+        // releases its storage
+        texture->bind();
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+        if (Texture::isCompressed(e.type))
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, glInternalFormat(e.type), 0, 0, 0, 0, nullptr);
+        else
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        texture->unbind();
+
+        e.resident = level + 1;
+        _residentBytes -= levelBytes(e, level);
+    }
+
+    bool TextureStreamer::makeRoom(int64_t bytes, const Entry * requester)
+    {
+        while (_residentBytes + bytes > _settings.budgetBytes) {
+            // the least recently used texture with a level it doesn't need;
+            // when shrinking to the budget, any level will do
+            Entry * victim = nullptr;
+            for (auto & i : _entries) {
+                Entry & e = i.second;
+                if (&e == requester || e.resident >= e.floor)
+                    continue;
+                if (requester && e.resident >= e.wanted)
+                    continue;
+                if (!victim || e.lastUsed < victim->lastUsed)
+                    victim = &e;
+            }
+            if (!victim)
+                return false;
+            evict(*victim);
+            ++_stats.evictions;
+        }
+        return true;
+    }
+
+    void TextureStreamer::request(const Texture & texture, float texelsPerPixel)
+    {
+        auto i = _entries.find(&texture);
+        if (i == _entries.end())
+            return;
+
+        Entry & e = i->second;
+        if (e.mips.empty()) {
+            // still decoding
+            e.lastUsed = _frame;
+            if (e.missed != _frame) {
+                e.missed = _frame;
+                ++_misses;
+            }
+            return;
+        }
+        int level = texelsPerPixel > 1.f ? int(std::floor(std::log2(texelsPerPixel))) : 0;
+        level = std::min(level, int(e.mips.size()) - 1);
+        e.wanted = std::min(e.wanted, level);
+        e.lastUsed = _frame;
+        if (e.resident > level && e.missed != _frame) {
+            e.missed = _frame;
+            ++_misses;
+        }
+    }
+
+    float TextureStreamer::texelDensity(const Texture & texture, const Bounds & local,
+                                        const m44f & modelView, const m44f & projection, v2i renderTarget)
+    {
+        // the diameter of the bounds' sphere on screen; a camera inside it
+        // wants the finest level
+        v3f center = (local.first + local.second) * 0.5f;
+        float scale = std::max(length(v3f(modelView.m[0], modelView.m[1], modelView.m[2])),
+                      std::max(length(v3f(modelView.m[4], modelView.m[5], modelView.m[6])),
+                               length(v3f(modelView.m[8], modelView.m[9], modelView.m[10]))));
+        float r = 0.5f * length(local.second - local.first) * scale;
+        float depth = -matrix_multiply(modelView, v4f(center, 1.f)).z - r;
+        if (depth <= 0)
+            return 0;
+
+        float pixels = 2.f * r * 0.5f * float(renderTarget.y) * projection.m[5] / depth;
+        if (pixels <= 0)
+            return 0;
+        return float(std::max(texture.width, texture.height)) / pixels;
+    }
+
+    void TextureStreamer::update()
+    {
+        LR_PROFILE_ZONE("TextureStreamer::update");
+        _stats.uploads = 0;
+        _stats.evictions = 0;
+        _stats.misses = _misses;
+        _misses = 0;
+
+        // the decodes that finished since the last update
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _finishing.swap(_decoded);
+            _decoding -= int(_finishing.size());
+        }
+        for (Decode & d : _finishing)
+            finish(d);
+        _finishing.clear();
+
+        // textures no one holds any more are already deleted
+        for (auto i = _entries.begin(); i != _entries.end(); ) {
+            if (i->second.texture.expired()) {
+                for (int level = i->second.resident; level < int(i->second.mips.size()); ++level)
+                    _residentBytes -= levelBytes(i->second, level);
+                i = _entries.erase(i);
+            }
+            else
+                ++i;
+        }
+
+        // those furthest from what they want go first
+        _wanting.clear();
+        for (auto & i : _entries)
+            if (i.second.wanted < i.second.resident)
+                _wanting.push_back(&i.second);
+        std::sort(_wanting.begin(), _wanting.end(), [](const Entry * a, const Entry * b) {
+            int da = a->resident - a->wanted;
+            int db = b->resident - b->wanted;
+            return da != db ? da > db : a->lastUsed > b->lastUsed;
+        });
+
+        int64_t uploaded = 0;
+        for (Entry * e : _wanting) {
+            int level = e->resident - 1;
+            int64_t bytes = levelBytes(*e, level);
+            if (uploaded > 0 && uploaded + bytes > _settings.uploadBytesPerFrame)
+                break;
+            if (!makeRoom(bytes, e))
+                continue;
+            upload(*e, level);
+            uploaded += bytes;
+            ++_stats.uploads;
+        }
+
+        // a lowered budget frees what it must
+        makeRoom(0, nullptr);
+
+        _stats.pendingRequests = 0;
+        for (Entry * e : _wanting)
+            _stats.pendingRequests += std::max(0, e->resident - e->wanted);
+        for (auto & i : _entries)
+            i.second.wanted = int(i.second.mips.size());
+        _stats.textures = int(_entries.size());
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stats.decoding = _decoding;
+        }
+        _stats.residentBytes = _residentBytes;
+        ++_frame;
+    }
+
+} // lab
@@ -46,12 +46,7 @@ namespace lab
 
 	Bounds Transform::transformBounds(const Bounds & bounds)
 	{
-		Bounds result;
-		v4f p = {bounds.first.x, bounds.first.y, bounds.first.z, 1.f};
-		result.first = matrix_multiply(_transform, p).xyz;
-		p = {bounds.second.x, bounds.second.y, bounds.second.z, 1.f};
-		result.second = matrix_multiply(_transform, p).xyz;
-		return result;
+		return lab::transformBounds(_transform, bounds);
 	}
 
 
@@ -8,9 +8,16 @@
 
 #include "LabRender/Utils.h"
 
+#include <algorithm>
 #include <iostream>
 #include <map>
 #include <string>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
@@ -69,4 +76,127 @@ namespace lab {
         return result;
     }
     
-}
\ No newline at end of file
+
+    class FileWatcher::Detail
+    {
+    public:
+        // a watched file, and what it was when last looked at
+        struct File
+        {
+            std::string directory;
+            std::string name;
+            long long size = -1;
+            long long modified = -1;
+        };
+        std::map<std::string, File> files;
+
+#ifdef __linux__
+        int fd = -1;
+        std::map<int, std::string> directories;     // by watch descriptor
+#endif
+
+        static void stamp(const std::string & path, long long & size, long long & modified)
+        {
+            struct stat st;
+            if (stat(path.c_str(), &st) == 0) {
+                size = (long long) st.st_size;
+                modified = (long long) st.st_mtime;
+            }
+            else
+                size = modified = -1;
+        }
+    };
+
+    FileWatcher::FileWatcher()
+    : _detail(new Detail())
+    {
+#ifdef __linux__
+        _detail->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    }
+
+    FileWatcher::~FileWatcher()
+    {
+#ifdef __linux__
+        if (_detail->fd >= 0)
+            close(_detail->fd);
+#endif
+        delete _detail;
+    }
+
+    void FileWatcher::watch(const std::string & path)
+    {
+        if (path.empty() || _detail->files.count(path))
+            return;
+
+        Detail::File file;
+        size_t slash = path.find_last_of("/\\");
+        file.directory = slash == string::npos ? "." : path.substr(0, slash);
+        file.name = slash == string::npos ? path : path.substr(slash + 1);
+        if (file.directory.empty())
+            file.directory = "/";
+        Detail::stamp(path, file.size, file.modified);
+
+#ifdef __linux__
+        if (_detail->fd >= 0) {
+            // one watch per directory; adding it again returns the same one
+            int wd = inotify_add_watch(_detail->fd, file.directory.c_str(),
+                                       IN_CLOSE_WRITE | IN_MOVED_TO);
+            if (wd >= 0)
+                _detail->directories[wd] = file.directory;
+        }
+#endif
+        _detail->files[path] = file;
+    }
+
+    void FileWatcher::clear()
+    {
+#ifdef __linux__
+        if (_detail->fd >= 0)
+            for (auto & d : _detail->directories)
+                inotify_rm_watch(_detail->fd, d.first);
+        _detail->directories.clear();
+#endif
+        _detail->files.clear();
+    }
+
+    std::vector<std::string> FileWatcher::poll()
+    {
+        std::vector<std::string> changed;
+
+#ifdef __linux__
+        if (_detail->fd >= 0) {
+            alignas(inotify_event) char buffer[4096];
+            for (;;) {
+                ssize_t bytes = read(_detail->fd, buffer, sizeof(buffer));
+                if (bytes <= 0)
+                    break;
+                for (ssize_t i = 0; i < bytes; ) {
+                    const inotify_event * e = (const inotify_event *) (buffer + i);
+                    i += sizeof(inotify_event) + e->len;
+                    auto d = _detail->directories.find(e->wd);
+                    if (!e->len || d == _detail->directories.end())
+                        continue;
+                    for (auto & f : _detail->files)
+                        if (f.second.name == e->name && f.second.directory == d->second &&
+                            std::find(changed.begin(), changed.end(), f.first) == changed.end())
+                            changed.push_back(f.first);
+                }
+            }
+            return changed;
+        }
+#endif
+
+        for (auto & f : _detail->files) {
+            long long size, modified;
+            Detail::stamp(f.first, size, modified);
+            if (size != f.second.size || modified != f.second.modified) {
+                f.second.size = size;
+                f.second.modified = modified;
+                changed.push_back(f.first);
+            }
+        }
+        return changed;
+    }
+
+}
@@ -9,6 +9,7 @@
 
 #include "LabRender/Vertex.h"
 #include "LabRender/gl4.h"
+#include "LabRender/Profiler.h"
 
 
 namespace lab {
@@ -27,6 +28,9 @@ namespace lab {
     void BufferBase::uploadDynamic() {
         if (!id) {
             glGenBuffers(1, &id); }
+        // the element array binding belongs to the bound VAO
+        if (bufferType == BufferType::IndexBuffer)
+            glState().bindVertexArray(0);
         bind();
         glBufferData(bufferType == BufferType::VertexBuffer? GL_ARRAY_BUFFER : GL_ELEMENT_ARRAY_BUFFER,
                      count() * stride(), buffer(), GL_DYNAMIC_DRAW);
@@ -36,6 +40,8 @@ namespace lab {
     void BufferBase::uploadStatic() {
         if (!id) {
             glGenBuffers(1, &id); }
+        if (bufferType == BufferType::IndexBuffer)
+            glState().bindVertexArray(0);
         bind();
         glBufferData(bufferType == BufferType::VertexBuffer? GL_ARRAY_BUFFER : GL_ELEMENT_ARRAY_BUFFER,
                      count() * stride(), buffer(), GL_STATIC_DRAW);
@@ -47,7 +53,7 @@ namespace lab {
     : _vertices(verts), _errorPolicy(ep), _id(0), _stride(0), _offset(0), _indexType(GL_INVALID_ENUM), _needInit(true) {
     }
 
-    VAO::~VAO() { glDeleteVertexArrays(1, &_id); }
+    VAO::~VAO() { glState().deleteVertexArray(_id); }
 
 
     VAO & VAO::attribute(const char *name, SemanticType t, int location, bool normalized) {
@@ -87,13 +93,14 @@ namespace lab {
 
 
     void VAO::bindVAO() const {
-        glBindVertexArray(_id);
+        glState().bindVertexArray(_id);
         checkError(_errorPolicy, TestConditions::exhaustive, "VAO::bindVAO");
     }
-    void VAO::unbindVAO() const { glBindVertexArray(0); }
+    void VAO::unbindVAO() const { glState().bindVertexArray(0); }
 
     bool VAO::uploadVerts() const
     {
+        LR_PROFILE_ZONE("VAO::uploadVerts");
 		if (_indicesMustBeBound) {
 			if (_indices && _indexType != GL_INVALID_VALUE) {
 				bindVAO();
@@ -136,13 +143,11 @@ namespace lab {
             bindVAO();
             glDrawRangeElements(GL_TRIANGLES, 0, (int) _indices->count(), (int) _indices->count(), _indexType, NULL);
             //glDrawElements(mode, _indices->size(), _indexType, NULL);
-            unbindVAO();
         }
         else if (_vertices) {
             bindVAO();
             glDrawArrays(GL_TRIANGLES, 0, (int) _vertices->count());
             checkError(_errorPolicy, TestConditions::exhaustive, "VAO::drawArrays");
-            unbindVAO();
         }
     }
     
@@ -152,10 +157,17 @@ namespace lab {
             glDrawElementsInstanced(GL_TRIANGLES, (int) _indices->count(), _indexType, NULL, instances);
         else
             glDrawArraysInstanced(GL_TRIANGLES, 0, (int) _vertices->count(), instances);
-        unbindVAO();
     }
 
 
+    size_t VAO::triangleCount() const {
+        if (_indices)
+            return _indices->count() / 3;
+        if (_vertices)
+            return _vertices->count() / 3;
+        return 0;
+    }
+
     void VAO::check() const {
         if (_vertices && _vertices->bufferType != BufferBase::BufferType::VertexBuffer) {
             handleGLError(_errorPolicy, GL_INVALID_OPERATION, "expected vertices to have type GL_ARRAY_BUFFER");
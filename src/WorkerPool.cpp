@@ -0,0 +1,91 @@
+//
+//  WorkerPool.cpp
+//  LabRender
+//
+//
+
+#include "LabRender/WorkerPool.h"
+
+#include <algorithm>
+
+namespace lab {
+
+    WorkerPool::WorkerPool(int workers)
+    : _next(0)
+    {
+        if (workers < 0) {
+            int hardware = int(std::thread::hardware_concurrency());
+            workers = std::min(3, std::max(0, hardware - 1));
+        }
+        _workers = workers;
+    }
+
+    WorkerPool::~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _quit = true;
+        }
+        _wake.notify_all();
+        for (std::thread & t : _threads)
+            t.join();
+    }
+
+    void WorkerPool::work()
+    {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wake.wait(lock, [&]() { return _quit || _generation != seen; });
+                if (_quit)
+                    return;
+                seen = _generation;
+            }
+            claim();
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (--_busy == 0)
+                    _done.notify_one();
+            }
+        }
+    }
+
+    void WorkerPool::claim()
+    {
+        for (int i = _next++; i < _count; i = _next++)
+            (*_task)(i);
+    }
+
+    void WorkerPool::run(int count, const std::function<void(int)> & task)
+    {
+        _task = &task;
+        _count = count;
+        _next = 0;
+
+        // one item is left to the calling thread
+        bool parallel = _workers > 0 && count > 1;
+        if (parallel) {
+            if (_threads.empty()) {
+                // started before any generation has been published
+                for (int i = 0; i < _workers; ++i)
+                    _threads.emplace_back([this]() { work(); });
+            }
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _busy = int(_threads.size());
+                ++_generation;
+            }
+            _wake.notify_all();
+        }
+
+        claim();
+
+        if (parallel) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _done.wait(lock, [&]() { return _busy == 0; });
+        }
+        _task = nullptr;
+    }
+
+} // lab